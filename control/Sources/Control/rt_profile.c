@@ -0,0 +1,276 @@
+/**
+ * @file rt_profile.c
+ *
+ * Real-time profile of the flight processes, see rt_profile.h
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "rt_profile.h"
+
+#include <alloca.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static rt_thread_profile_t *find_thread (rt_profile_t *profile, const char *name)
+{
+    int i;
+    for (i = 0; i < profile->threadCount; i++)
+    {
+        if (0 == strcmp (profile->threads[i].name, name))
+        {
+            return &profile->threads[i];
+        }
+    }
+    if (RT_PROFILE_MAX_THREADS == profile->threadCount)
+    {
+        return NULL;
+    }
+    i = profile->threadCount++;
+    memset (&profile->threads[i], 0, sizeof (profile->threads[i]));
+    strncpy (profile->threads[i].name, name, RT_PROFILE_NAME_SIZE - 1);
+    return &profile->threads[i];
+}
+
+// "1", "0,2" or "2-3"
+static uint64_t parse_cpus (const char *list)
+{
+    uint64_t cpus = 0;
+    while ('\0' != *list)
+    {
+        char *end;
+        long first = strtol (list, &end, 10), last = first;
+        if (end == list)
+        {
+            break;
+        }
+        if ('-' == *end)
+        {
+            list = end + 1;
+            last = strtol (list, &end, 10);
+        }
+        for (; first <= last && first < 64; first++)
+        {
+            if (0 <= first)
+            {
+                cpus |= 1ULL << first;
+            }
+        }
+        list = (',' == *end) ? end + 1 : end;
+        if (end == list)
+        {
+            break;
+        }
+    }
+    return cpus;
+}
+
+int rt_profile_load (rt_profile_t *profile, const char *path)
+{
+    char line[256];
+    FILE *f = fopen (path, "r");
+
+    memset (profile, 0, sizeof (*profile));
+    profile->stackPrefault = 256 * 1024;
+    if (NULL == f)
+    {
+        return -1;
+    }
+    while (NULL != fgets (line, sizeof (line), f))
+    {
+        char key[64], value[128], *dot;
+        rt_thread_profile_t *t;
+        if ('#' == line[0] ||
+            2 != sscanf (line, " %63[^= \t] = %127s", key, value))
+        {
+            continue;
+        }
+        if (0 == strcmp (key, "mlockall"))
+        {
+            profile->lockMemory = atoi (value);
+            continue;
+        }
+        if (0 == strcmp (key, "stack_prefault"))
+        {
+            profile->stackPrefault = (size_t)atol (value);
+            continue;
+        }
+        dot = strrchr (key, '.');
+        if (NULL == dot)
+        {
+            fprintf (stderr, "%s : unknown key %s\n", path, key);
+            continue;
+        }
+        *dot = '\0';
+        t = find_thread (profile, key);
+        if (NULL == t)
+        {
+            fprintf (stderr, "%s : too many threads\n", path);
+            continue;
+        }
+        if (0 == strcmp (dot + 1, "cpu"))
+        {
+            t->cpus = parse_cpus (value);
+        }
+        else if (0 == strcmp (dot + 1, "fifo"))
+        {
+            t->fifo = atoi (value);
+        }
+        else
+        {
+            fprintf (stderr, "%s : unknown key %s.%s\n", path, key, dot + 1);
+        }
+    }
+    fclose (f);
+    profile->loaded = 1;
+    return 0;
+}
+
+int rt_profile_apply (const rt_profile_t *profile, const char *name)
+{
+    const rt_thread_profile_t *t = NULL;
+    int failures = 0, i, err;
+
+    if (NULL == profile || !profile->loaded)
+    {
+        return 0;
+    }
+    for (i = 0; i < profile->threadCount; i++)
+    {
+        if (0 == strcmp (profile->threads[i].name, name))
+        {
+            t = &profile->threads[i];
+        }
+    }
+    if (NULL == t)
+    {
+        return 0;
+    }
+
+    if (0 != t->cpus)
+    {
+        cpu_set_t set;
+        CPU_ZERO (&set);
+        for (i = 0; i < 64; i++)
+        {
+            if (t->cpus & (1ULL << i))
+            {
+                CPU_SET (i, &set);
+            }
+        }
+        err = pthread_setaffinity_np (pthread_self (), sizeof (set), &set);
+        if (0 != err)
+        {
+            fprintf (stderr, "%s : can't set cpu affinity (%s)\n", name, strerror (err));
+            failures++;
+        }
+    }
+    if (0 < t->fifo)
+    {
+        struct sched_param param;
+        memset (&param, 0, sizeof (param));
+        param.sched_priority = t->fifo;
+        err = pthread_setschedparam (pthread_self (), SCHED_FIFO, &param);
+        if (0 != err)
+        {
+            fprintf (stderr, "%s : can't use SCHED_FIFO %d (%s)\n", name, t->fifo, strerror (err));
+            failures++;
+        }
+    }
+    if (profile->lockMemory && 0 < profile->stackPrefault)
+    {
+        // Fault the stack in now, mlockall keeps it resident
+        rt_prefault (alloca (profile->stackPrefault), profile->stackPrefault);
+    }
+    return failures;
+}
+
+int rt_profile_lock_memory (const rt_profile_t *profile)
+{
+    if (NULL == profile || !profile->lockMemory)
+    {
+        return 0;
+    }
+    if (0 != mlockall (MCL_CURRENT | MCL_FUTURE))
+    {
+        fprintf (stderr, "mlockall failed (%s)\n", strerror (errno));
+        return -1;
+    }
+    return 0;
+}
+
+void rt_prefault (void *buf, size_t size)
+{
+    volatile uint8_t *p = (volatile uint8_t *)buf;
+    const size_t page = (size_t)sysconf (_SC_PAGESIZE);
+    size_t i;
+    for (i = 0; i < size; i += page)
+    {
+        p[i] = p[i];
+    }
+}
+
+int rt_jitter_init (rt_jitter_t *jitter, const char *name, size_t capacity)
+{
+    jitter->name = name;
+    jitter->capacity = capacity;
+    jitter->count = 0;
+    jitter->samples_us = (uint32_t *)calloc (capacity, sizeof (uint32_t));
+    return (NULL == jitter->samples_us) ? -1 : 0;
+}
+
+void rt_jitter_add (rt_jitter_t *jitter, int64_t latency_ns)
+{
+    if (NULL == jitter->samples_us)
+    {
+        return;
+    }
+    if (latency_ns < 0)
+    {
+        latency_ns = 0;
+    }
+    jitter->samples_us[jitter->count % jitter->capacity] = (uint32_t)(latency_ns / 1000);
+    jitter->count++;
+}
+
+static int compare_u32 (const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+void rt_jitter_report (const rt_jitter_t *jitter, const char *profile, FILE *out)
+{
+    size_t n = (jitter->count < jitter->capacity) ? jitter->count : jitter->capacity;
+    uint32_t *sorted;
+
+    if (0 == n || NULL == jitter->samples_us)
+    {
+        fprintf (out, "%s [%s] : no samples\n", (NULL != jitter->name) ? jitter->name : "jitter", profile);
+        return;
+    }
+    sorted = (uint32_t *)malloc (n * sizeof (uint32_t));
+    if (NULL == sorted)
+    {
+        return;
+    }
+    memcpy (sorted, jitter->samples_us, n * sizeof (uint32_t));
+    qsort (sorted, n, sizeof (uint32_t), compare_u32);
+    fprintf (out, "%s [%s] : %zu samples, p50 %u us, p90 %u us, p99 %u us, p99.9 %u us, max %u us\n",
+             jitter->name, profile, n, sorted[n / 2], sorted[n * 90 / 100], sorted[n * 99 / 100],
+             sorted[n * 999 / 1000], sorted[n - 1]);
+    free (sorted);
+}
+
+void rt_jitter_close (rt_jitter_t *jitter)
+{
+    free (jitter->samples_us);
+    jitter->samples_us = NULL;
+}
@@ -0,0 +1,83 @@
+/**
+ * Real-time profile of the flight processes
+ *
+ * A profile file pins named threads to cores and gives them a SCHED_FIFO
+ * priority, and can lock the process memory :
+ *
+ *   # thread.cpu = core list, thread.fifo = priority (0 keeps SCHED_OTHER)
+ *   video_stage.cpu = 1
+ *   video_stage.fifo = 60
+ *   auto_control.cpu = 2
+ *   auto_control.fifo = 70
+ *   mlockall = 1
+ *
+ * Each thread calls rt_profile_apply with its own name when it starts.
+ * Failing to apply a setting (no CAP_SYS_NICE, core missing ...) is reported
+ * and ignored, the process keeps running with the default scheduling.
+ *
+ * rt_jitter collects latency samples of a periodic loop and prints their
+ * distribution, to compare runs with and without a profile.
+ *
+ * This file is shared with the imageProcess tools and must stay SDK independent.
+ */
+
+#ifndef _RT_PROFILE_H_
+#define _RT_PROFILE_H_ (1)
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RT_PROFILE_MAX_THREADS (16)
+#define RT_PROFILE_NAME_SIZE (32)
+
+typedef struct _rt_thread_profile_ {
+    char name[RT_PROFILE_NAME_SIZE];
+    uint64_t cpus;      // bit n : may run on core n, 0 : any core
+    int fifo;           // SCHED_FIFO priority, 0 : SCHED_OTHER
+} rt_thread_profile_t;
+
+typedef struct _rt_profile_ {
+    int loaded;
+    int lockMemory;
+    size_t stackPrefault;   // bytes of stack touched by rt_profile_apply
+    int threadCount;
+    rt_thread_profile_t threads[RT_PROFILE_MAX_THREADS];
+} rt_profile_t;
+
+// Reads a profile file. Returns 0, -1 if it can't be read.
+int rt_profile_load (rt_profile_t *profile, const char *path);
+
+// Applies the settings of thread name to the calling thread, if any.
+// Returns the number of settings that could not be applied.
+int rt_profile_apply (const rt_profile_t *profile, const char *name);
+
+// mlockall (MCL_CURRENT | MCL_FUTURE) if the profile asks for it, call it
+// once the big buffers are allocated. Returns 0 on success or if not asked.
+int rt_profile_lock_memory (const rt_profile_t *profile);
+
+// Touches every page of buf, so the first frame does not pay the page faults
+void rt_prefault (void *buf, size_t size);
+
+typedef struct _rt_jitter_ {
+    const char *name;
+    uint32_t *samples_us;
+    size_t capacity;
+    size_t count;           // samples seen, only the last capacity are kept
+} rt_jitter_t;
+
+int rt_jitter_init (rt_jitter_t *jitter, const char *name, size_t capacity);
+void rt_jitter_add (rt_jitter_t *jitter, int64_t latency_ns);
+// One line : count, p50, p90, p99, p99.9 and max in us, tagged with profile
+void rt_jitter_report (const rt_jitter_t *jitter, const char *profile, FILE *out);
+void rt_jitter_close (rt_jitter_t *jitter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _RT_PROFILE_H_
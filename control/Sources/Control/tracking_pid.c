@@ -0,0 +1,147 @@
+/**
+ * @file tracking_pid.c
+ *
+ * Four axis PID controller for target tracking, see tracking_pid.h
+ */
+
+#include "tracking_pid.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static const char *axis_names[PID_AXES] = { "roll", "pitch", "gaz", "yaw" };
+
+static float clampf (float v, float limit)
+{
+    if (v > limit)
+    {
+        return limit;
+    }
+    if (v < -limit)
+    {
+        return -limit;
+    }
+    return v;
+}
+
+void tracking_pid_init (tracking_pid_t *pid)
+{
+    int i;
+    memset (pid, 0, sizeof (*pid));
+    for (i = 0; i < PID_AXES; i++)
+    {
+        pid->gains[i].kp = 1.0f;
+        pid->gains[i].limit = 1.0f;
+    }
+    // No lateral error is measured, the roll error is always 0
+    pid->gains[PID_ROLL].kp = 0.0f;
+}
+
+int tracking_pid_reload (tracking_pid_t *pid)
+{
+    struct stat st;
+    char line[256];
+    FILE *f;
+    int i;
+
+    if ('\0' == pid->configName[0])
+    {
+        return 0;
+    }
+    if (0 != stat (pid->configName, &st))
+    {
+        return -1;
+    }
+    if (st.st_mtime == pid->configMtime)
+    {
+        return 0;
+    }
+    f = fopen (pid->configName, "r");
+    if (NULL == f)
+    {
+        return -1;
+    }
+    pid->configMtime = st.st_mtime;
+
+    while (NULL != fgets (line, sizeof (line), f))
+    {
+        char axis[32], term[32];
+        float value;
+        if ('#' == line[0] ||
+            3 != sscanf (line, " %31[a-z]_%31[a-z] = %f", axis, term, &value))
+        {
+            continue;
+        }
+        for (i = 0; i < PID_AXES; i++)
+        {
+            if (0 != strcmp (axis, axis_names[i]))
+            {
+                continue;
+            }
+            if (0 == strcmp (term, "kp"))
+            {
+                pid->gains[i].kp = value;
+            }
+            else if (0 == strcmp (term, "ki"))
+            {
+                pid->gains[i].ki = value;
+            }
+            else if (0 == strcmp (term, "kd"))
+            {
+                pid->gains[i].kd = value;
+            }
+            else if (0 == strcmp (term, "limit"))
+            {
+                pid->gains[i].limit = (value < 0.0f) ? -value : value;
+            }
+            else
+            {
+                fprintf (stderr, "%s : unknown key %s_%s\n", pid->configName, axis, term);
+            }
+        }
+    }
+    fclose (f);
+
+    for (i = 0; i < PID_AXES; i++)
+    {
+        printf ("PID %-5s kp %.3f ki %.3f kd %.3f limit %.3f\n", axis_names[i],
+                pid->gains[i].kp, pid->gains[i].ki, pid->gains[i].kd, pid->gains[i].limit);
+    }
+    return 1;
+}
+
+void tracking_pid_reset (tracking_pid_t *pid)
+{
+    memset (pid->integral, 0, sizeof (pid->integral));
+    memset (pid->last_err, 0, sizeof (pid->last_err));
+    pid->primed = 0;
+}
+
+void tracking_pid_update (tracking_pid_t *pid, const float err[PID_AXES], float dt, float out[PID_AXES])
+{
+    int i;
+    for (i = 0; i < PID_AXES; i++)
+    {
+        const tracking_pid_gains_t *g = &pid->gains[i];
+        float d = 0.0f;
+
+        if (0.0f < dt)
+        {
+            if (pid->primed)
+            {
+                d = (err[i] - pid->last_err[i]) / dt;
+            }
+            pid->integral[i] += err[i] * dt;
+            // Anti windup : the integral term alone never exceeds the limit
+            if (0.0f != g->ki)
+            {
+                float bound = g->limit / ((g->ki < 0.0f) ? -g->ki : g->ki);
+                pid->integral[i] = clampf (pid->integral[i], bound);
+            }
+        }
+        pid->last_err[i] = err[i];
+        out[i] = clampf (g->kp * err[i] + g->ki * pid->integral[i] + g->kd * d, g->limit);
+    }
+    pid->primed = 1;
+}
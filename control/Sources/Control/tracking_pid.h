@@ -0,0 +1,71 @@
+/**
+ * Four axis PID controller for target tracking
+ *
+ * One controller per progressive command axis (roll, pitch, gaz, yaw). Every
+ * control tick takes the tracking errors of all the axes and returns the
+ * four arguments of a single ardrone_at_set_progress_cmd, so the axes are
+ * corrected together instead of one after the other.
+ *
+ * Gains and output limits live in a plain "key = value" file (e.g.
+ * "yaw_kp = 0.8", "pitch_limit = 0.3", keys <axis>_kp / _ki / _kd / _limit)
+ * which tracking_pid_reload re-reads whenever it changes on disk, so the
+ * controller can be tuned in flight.
+ *
+ * This file is SDK independent.
+ */
+
+#ifndef _TRACKING_PID_H_
+#define _TRACKING_PID_H_ (1)
+
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum _tracking_pid_axis_ {
+    PID_ROLL = 0,
+    PID_PITCH,
+    PID_GAZ,
+    PID_YAW,
+    PID_AXES
+} tracking_pid_axis_t;
+
+typedef struct _tracking_pid_gains_ {
+    float kp;
+    float ki;
+    float kd;
+    float limit;        // |output| <= limit, also bounds the integral term
+} tracking_pid_gains_t;
+
+typedef struct _tracking_pid_ {
+    // PARAM
+    tracking_pid_gains_t gains[PID_AXES];
+    char configName[256];
+
+    // INTERNAL
+    float integral[PID_AXES];
+    float last_err[PID_AXES];
+    int primed;         // last_err is valid
+    time_t configMtime;
+} tracking_pid_t;
+
+// Default gains : proportional only, the errors are passed through as before
+void tracking_pid_init (tracking_pid_t *pid);
+
+// Loads configName if it changed since the last call.
+// Returns 1 if the gains were (re)loaded, 0 if unchanged, -1 on error.
+int tracking_pid_reload (tracking_pid_t *pid);
+
+// Forgets the integral and derivative state, call when tracking (re)starts
+void tracking_pid_reset (tracking_pid_t *pid);
+
+// One control step : err holds the error of each axis, dt the time since the
+// previous step in seconds. Writes the command of each axis to out.
+void tracking_pid_update (tracking_pid_t *pid, const float err[PID_AXES], float dt, float out[PID_AXES]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TRACKING_PID_H_
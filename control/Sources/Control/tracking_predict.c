@@ -0,0 +1,89 @@
+/**
+ * @file tracking_predict.c
+ *
+ * Latency compensation of the tracking errors, see tracking_predict.h
+ */
+
+#include "tracking_predict.h"
+
+#include <string.h>
+
+void tracking_predict_init (tracking_predict_t *pred, int64_t maxAge_ns)
+{
+    memset (pred, 0, sizeof (*pred));
+    pred->maxAge_ns = maxAge_ns;
+    pred->window_ns = 250000000LL;
+}
+
+void tracking_predict_reset (tracking_predict_t *pred)
+{
+    pred->count = 0;
+    pred->head = 0;
+}
+
+void tracking_predict_add (tracking_predict_t *pred, int64_t stamp_ns, const float err[PID_AXES])
+{
+    if (0 < pred->count && stamp_ns <= pred->stamp_ns[pred->head])
+    {
+        return;
+    }
+    pred->head = (pred->head + 1) % PREDICT_HISTORY;
+    pred->stamp_ns[pred->head] = stamp_ns;
+    memcpy (pred->err[pred->head], err, sizeof (pred->err[0]));
+    if (pred->count < PREDICT_HISTORY)
+    {
+        pred->count++;
+    }
+}
+
+int tracking_predict_at (const tracking_predict_t *pred, int64_t now_ns, float out[PID_AXES])
+{
+    const int64_t newest = pred->stamp_ns[pred->head];
+    double t[PREDICT_HISTORY];
+    double tmean = 0.0;
+    int idx[PREDICT_HISTORY];
+    int n = 0, i, k;
+
+    if (0 == pred->count || now_ns - newest > pred->maxAge_ns)
+    {
+        return -1;
+    }
+
+    // Results inside the fit window, times in seconds relative to the newest
+    for (k = 0; k < pred->count; k++)
+    {
+        i = (pred->head - k + PREDICT_HISTORY) % PREDICT_HISTORY;
+        if (newest - pred->stamp_ns[i] > pred->window_ns)
+        {
+            break;
+        }
+        idx[n] = i;
+        t[n] = (pred->stamp_ns[i] - newest) * 1e-9;
+        tmean += t[n];
+        n++;
+    }
+    tmean /= n;
+
+    for (k = 0; k < PID_AXES; k++)
+    {
+        double emean = 0.0, num = 0.0, den = 0.0, slope = 0.0;
+        for (i = 0; i < n; i++)
+        {
+            emean += pred->err[idx[i]][k];
+        }
+        emean /= n;
+        // Least squares error rate, a single result is held constant
+        for (i = 0; i < n; i++)
+        {
+            num += (t[i] - tmean) * (pred->err[idx[i]][k] - emean);
+            den += (t[i] - tmean) * (t[i] - tmean);
+        }
+        if (0.0 < den)
+        {
+            slope = num / den;
+        }
+        // Value of the fitted line at now
+        out[k] = (float)(emean + slope * ((now_ns - newest) * 1e-9 - tmean));
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+/**
+ * Latency compensation of the tracking errors
+ *
+ * A tracking result is at least one decode and track cycle old when the
+ * controller reads it. tracking_predict keeps the last results with the
+ * stamp of the frame they come from, fits the error rate of each axis over
+ * them and extrapolates the error to the time of the control tick, which
+ * also lets the controller tick faster than the video. Results older than
+ * a maximum age are refused, the controller then hovers instead of
+ * correcting from stale data.
+ *
+ * This file is SDK independent.
+ */
+
+#ifndef _TRACKING_PREDICT_H_
+#define _TRACKING_PREDICT_H_ (1)
+
+#include <stdint.h>
+
+#include "tracking_pid.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PREDICT_HISTORY (4)
+
+typedef struct _tracking_predict_ {
+    // PARAM
+    int64_t maxAge_ns;      // newest result older than this at tick time : refused
+    int64_t window_ns;      // results older than this relative to the newest are not fitted
+
+    // INTERNAL
+    int64_t stamp_ns[PREDICT_HISTORY];
+    float err[PREDICT_HISTORY][PID_AXES];
+    int count;
+    int head;               // index of the newest result
+} tracking_predict_t;
+
+void tracking_predict_init (tracking_predict_t *pred, int64_t maxAge_ns);
+
+// Forgets the history, call when tracking (re)starts
+void tracking_predict_reset (tracking_predict_t *pred);
+
+// Adds the result of the frame stamped stamp_ns, ignored if not newer than the last one
+void tracking_predict_add (tracking_predict_t *pred, int64_t stamp_ns, const float err[PID_AXES]);
+
+// Writes the errors extrapolated to now_ns to out.
+// Returns 0, or -1 (out untouched) if there is no result younger than maxAge_ns.
+int tracking_predict_at (const tracking_predict_t *pred, int64_t now_ns, float out[PID_AXES]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TRACKING_PREDICT_H_
@@ -0,0 +1,70 @@
+/**
+ * @file navdata.c
+ *
+ * Navdata handler that publishes the drone state to imageProcess, see navdata.h
+ */
+
+#include "navdata.h"
+
+#include <Video/frame_shm.h>
+
+#include <stdio.h>
+
+static struct nav_state *nav_shm = NULL;
+static int nav_shmid = -1;
+
+C_RESULT navdata_client_init (void *data)
+{
+    // data points to the drone id of the channels
+    int drone = (NULL != data) ? *(int *)data : 0;
+    int fresh = 0;
+
+    nav_shm = (struct nav_state *)frame_shm_attach (drone_key (NAV_KEY, drone), sizeof (struct nav_state),
+                                                     &nav_shmid, &fresh);
+    if (NULL == nav_shm)
+    {
+        fprintf (stderr, "can't attach the navdata segment\n");
+        return C_FAIL;
+    }
+    // imageProcess may be reading the state of the previous control process,
+    // the seqlock goes on from there (from even if that one died mid-write)
+    if (nav_shm->seq & 1)
+    {
+        nav_shm->seq++;
+    }
+    return C_OK;
+}
+
+C_RESULT navdata_client_process (const navdata_unpacked_t *const navdata)
+{
+    const navdata_demo_t *nd = &navdata->navdata_demo;
+    struct nav_state val;
+
+    if (NULL == nav_shm)
+    {
+        return C_OK;
+    }
+
+    // navdata_demo units : milli-degrees, mm and mm/s
+    val.ctrl_state = nd->ctrl_state;
+    val.theta = nd->theta / 1000.0f;
+    val.phi = nd->phi / 1000.0f;
+    val.psi = nd->psi / 1000.0f;
+    val.altitude = nd->altitude / 1000.0f;
+    val.vx = nd->vx / 1000.0f;
+    val.vy = nd->vy / 1000.0f;
+    val.vz = nd->vz / 1000.0f;
+    val.stamp_ns = frame_shm_now_ns ();
+    nav_state_write (nav_shm, &val);
+    return C_OK;
+}
+
+C_RESULT navdata_client_release (void)
+{
+    if (NULL != nav_shm)
+    {
+        frame_shm_release (nav_shm, nav_shmid);
+        nav_shm = NULL;
+    }
+    return C_OK;
+}
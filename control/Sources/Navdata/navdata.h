@@ -0,0 +1,19 @@
+/**
+ * Navdata handler that publishes the drone state to imageProcess
+ *
+ * Attitude, altitude and speeds of every navdata_demo packet are copied to
+ * the NAV_KEY shared memory segment (struct nav_state, see Video/frame_shm.h),
+ * which the tracker uses to compensate the motion of the camera.
+ */
+
+#ifndef _NAVDATA_H_
+#define _NAVDATA_H_ (1)
+
+#include <ardrone_tool/Navdata/ardrone_navdata_client.h>
+
+// data : int * drone id, NULL for drone 0
+C_RESULT navdata_client_init (void *data);
+C_RESULT navdata_client_process (const navdata_unpacked_t *const navdata);
+C_RESULT navdata_client_release (void);
+
+#endif // _NAVDATA_H_
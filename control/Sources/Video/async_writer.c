@@ -0,0 +1,267 @@
+/**
+ * @file async_writer.c
+ *
+ * Background file writer for the recording stages, see async_writer.h
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // O_DIRECT
+#endif
+
+#include "async_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Writes size bytes at the writer file position, retrying short writes
+static int write_all (async_writer_t *w, const uint8_t *buf, size_t size, uint64_t offset)
+{
+    while (0 < size)
+    {
+        ssize_t n = pwrite (w->fd, buf, size, offset);
+        if (n < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static void *writer_thread (void *arg)
+{
+    async_writer_t *w = (async_writer_t *)arg;
+
+    for (;;)
+    {
+        uint32_t n;
+        size_t size;
+        int res;
+
+        pthread_mutex_lock (&w->lock);
+        while (0 == w->queued && !w->stop)
+        {
+            pthread_cond_wait (&w->not_empty, &w->lock);
+        }
+        if (0 == w->queued)
+        {
+            pthread_mutex_unlock (&w->lock);
+            break;
+        }
+        // Batch every contiguous full block in one write
+        n = w->queued;
+        if (w->write_index + n > w->block_count)
+        {
+            n = w->block_count - w->write_index;
+        }
+        pthread_mutex_unlock (&w->lock);
+
+        size = n * w->block_size;
+        res = write_all (w, w->pool + (size_t)w->write_index * w->block_size, size, w->file_pos);
+        w->file_pos += size;
+        w->write_index = (w->write_index + n) % w->block_count;
+
+        pthread_mutex_lock (&w->lock);
+        w->queued -= n;
+        w->stats.write_calls++;
+        if (0 == res)
+        {
+            w->stats.bytes_written += size;
+        }
+        else
+        {
+            w->stats.write_errors++;
+        }
+        pthread_cond_signal (&w->not_full);
+        pthread_mutex_unlock (&w->lock);
+    }
+    return NULL;
+}
+
+int async_writer_open (async_writer_t *w, const char *name, size_t block_size, uint32_t block_count, int direct)
+{
+    memset (w, 0, sizeof (*w));
+    w->fd = -1;
+    if (0 != block_size % ASYNC_WRITER_ALIGN || 2 > block_count)
+    {
+        return -1;
+    }
+    if (direct)
+    {
+        w->fd = open (name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        w->direct = (0 <= w->fd);
+    }
+    if (0 > w->fd)
+    {
+        w->fd = open (name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (0 > w->fd)
+    {
+        return -1;
+    }
+    if (0 != posix_memalign ((void **)&w->pool, ASYNC_WRITER_ALIGN, block_size * block_count))
+    {
+        close (w->fd);
+        w->fd = -1;
+        return -1;
+    }
+    // Fault the pool in now rather than on the video thread
+    memset (w->pool, 0, block_size * block_count);
+    w->block_size = block_size;
+    w->block_count = block_count;
+
+    pthread_mutex_init (&w->lock, NULL);
+    pthread_cond_init (&w->not_empty, NULL);
+    pthread_cond_init (&w->not_full, NULL);
+    if (0 != pthread_create (&w->thread, NULL, writer_thread, w))
+    {
+        free (w->pool);
+        w->pool = NULL;
+        close (w->fd);
+        w->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void queue_fill_block (async_writer_t *w)
+{
+    pthread_mutex_lock (&w->lock);
+    w->queued++;
+    if (w->queued > w->stats.queued_high_water)
+    {
+        w->stats.queued_high_water = w->queued;
+    }
+    pthread_cond_signal (&w->not_empty);
+    pthread_mutex_unlock (&w->lock);
+
+    w->fill_index = (w->fill_index + 1) % w->block_count;
+    w->fill_pos = 0;
+}
+
+int async_writer_write (async_writer_t *w, const struct iovec *iov, int iovcnt, int wait)
+{
+    size_t need = 0;
+    int i;
+
+    if (NULL == w->pool)
+    {
+        return -1;
+    }
+    for (i = 0; i < iovcnt; i++)
+    {
+        need += iov[i].iov_len;
+    }
+
+    if (!wait)
+    {
+        size_t room;
+        pthread_mutex_lock (&w->lock);
+        // The fill block is free unless every block waits for the disk
+        room = (w->block_count - w->queued) * w->block_size - w->fill_pos;
+        if (need > room)
+        {
+            w->stats.records_dropped++;
+            w->stats.bytes_dropped += need;
+            pthread_mutex_unlock (&w->lock);
+            return -1;
+        }
+        pthread_mutex_unlock (&w->lock);
+    }
+
+    for (i = 0; i < iovcnt; i++)
+    {
+        const uint8_t *src = (const uint8_t *)iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+
+        while (0 < len)
+        {
+            size_t n = w->block_size - w->fill_pos;
+            if (wait)
+            {
+                pthread_mutex_lock (&w->lock);
+                while (w->queued == w->block_count)
+                {
+                    pthread_cond_wait (&w->not_full, &w->lock);
+                }
+                pthread_mutex_unlock (&w->lock);
+            }
+            if (n > len)
+            {
+                n = len;
+            }
+            memcpy (w->pool + (size_t)w->fill_index * w->block_size + w->fill_pos, src, n);
+            w->fill_pos += n;
+            src += n;
+            len -= n;
+            if (w->fill_pos == w->block_size)
+            {
+                queue_fill_block (w);
+            }
+        }
+    }
+
+    pthread_mutex_lock (&w->lock);
+    w->stats.records_written++;
+    pthread_mutex_unlock (&w->lock);
+    return 0;
+}
+
+void async_writer_close (async_writer_t *w, const void *head, size_t head_size)
+{
+    if (NULL == w->pool)
+    {
+        return;
+    }
+
+    pthread_mutex_lock (&w->lock);
+    w->stop = 1;
+    pthread_cond_signal (&w->not_empty);
+    pthread_mutex_unlock (&w->lock);
+    pthread_join (w->thread, NULL);
+
+    // O_DIRECT needs aligned sizes, the tail and the header go through the page cache
+    if (w->direct)
+    {
+        fcntl (w->fd, F_SETFL, fcntl (w->fd, F_GETFL) & ~O_DIRECT);
+    }
+    if (0 < w->fill_pos)
+    {
+        if (0 == write_all (w, w->pool + (size_t)w->fill_index * w->block_size, w->fill_pos, w->file_pos))
+        {
+            w->stats.bytes_written += w->fill_pos;
+        }
+        else
+        {
+            w->stats.write_errors++;
+        }
+        w->file_pos += w->fill_pos;
+    }
+    if (NULL != head && 0 != write_all (w, (const uint8_t *)head, head_size, 0))
+    {
+        w->stats.write_errors++;
+    }
+    close (w->fd);
+    w->fd = -1;
+
+    fprintf (stderr, "recording: %llu bytes in %u records, %u records (%llu bytes) dropped, %u write errors, %u/%u blocks queued at most\n",
+             (unsigned long long)w->stats.bytes_written, w->stats.records_written,
+             w->stats.records_dropped, (unsigned long long)w->stats.bytes_dropped,
+             w->stats.write_errors, w->stats.queued_high_water, w->block_count);
+
+    free (w->pool);
+    w->pool = NULL;
+    pthread_cond_destroy (&w->not_full);
+    pthread_cond_destroy (&w->not_empty);
+    pthread_mutex_destroy (&w->lock);
+}
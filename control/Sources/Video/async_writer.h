@@ -0,0 +1,83 @@
+/**
+ * Background file writer for the recording stages
+ *
+ * The video thread copies each record into a preallocated pool of aligned
+ * blocks and returns immediately. A writer thread flushes full blocks with
+ * large sequential writes (several contiguous blocks per write call), so a
+ * disk stall never reaches the decoder. When the pool is full, a whole
+ * record is dropped and counted instead of blocking the caller.
+ *
+ * With O_DIRECT, blocks bypass the page cache. The last partial block is
+ * written through the page cache on close.
+ *
+ * This file is shared with the imageProcess tools and must stay SDK independent.
+ */
+
+#ifndef _ASYNC_WRITER_H_
+#define _ASYNC_WRITER_H_ (1)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ASYNC_WRITER_BLOCK_SIZE   (1 << 20)
+#define ASYNC_WRITER_BLOCK_COUNT  (32)
+#define ASYNC_WRITER_ALIGN        (4096)
+
+typedef struct _async_writer_stats_ {
+    uint64_t bytes_written;
+    uint64_t bytes_dropped;
+    uint32_t records_written;
+    uint32_t records_dropped;    // overflow : the pool had no room for the record
+    uint32_t write_calls;
+    uint32_t write_errors;
+    uint32_t queued_high_water;  // most full blocks ever waiting for the disk
+} async_writer_stats_t;
+
+typedef struct _async_writer_ {
+    int fd;
+    int direct;
+    uint8_t *pool;
+    size_t block_size;
+    uint32_t block_count;
+
+    // producer side, only touched by the recording stage
+    uint32_t fill_index;
+    size_t fill_pos;
+
+    // writer thread side
+    uint32_t write_index;
+    uint64_t file_pos;
+
+    // shared, protected by lock
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint32_t queued;
+    int stop;
+    pthread_t thread;
+
+    async_writer_stats_t stats;
+} async_writer_t;
+
+// direct : open with O_DIRECT (falls back to buffered I/O if unsupported)
+int async_writer_open (async_writer_t *w, const char *name, size_t block_size, uint32_t block_count, int direct);
+
+// Appends one record made of iovcnt pieces, all or nothing.
+// wait == 0 : returns -1 and counts an overflow if the pool can not hold the record
+// wait != 0 : blocks until the writer thread frees enough room (never drops)
+int async_writer_write (async_writer_t *w, const struct iovec *iov, int iovcnt, int wait);
+
+// Drains the pool, then writes head at offset 0 (if not NULL) and closes the file
+void async_writer_close (async_writer_t *w, const void *head, size_t head_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ASYNC_WRITER_H_
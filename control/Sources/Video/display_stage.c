@@ -14,6 +14,9 @@
  *  the AR.Drone live video feed. The GTK Thread is started here to improve the example readability
  *  (we have all the gtk-related code in one file)
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // semtimedop
+#endif
 //my header file
 #include <unistd.h>  
 #include <stdlib.h>  
@@ -26,7 +29,11 @@
 #include <sys/ipc.h>
 #include <sys/sem.h>
 #include <sys/shm.h>
+#include <pthread.h>
 #include "semaphore.h"
+#include "track_stats.h"
+#include "trace_ring.h"
+#include "pre_stage.h"
 
 // Self header file
 #include "display_stage.h"
@@ -34,27 +41,28 @@
 // GTK/Cairo headers
 #include <cairo.h>
 #include <gtk/gtk.h>
+
+static struct track_stats *stats = NULL;
+// a frame is dropped rather than the GTK thread blocked behind imageProcess
+#define PUBLISH_LOCK_TIMEOUT_MS (20)
+static pid_t image_pid = 0;
+static int publish_stalled = 0;
+// held by the GTK thread while it publishes, display_stage_detach waits for it
+static pthread_mutex_t publish_lock = PTHREAD_MUTEX_INITIALIZER;
 /*// my global
 static IplImage *currframe = NULL;
 static IplImage *dst = NULL;*/
 
 
 // my func
-void* create_shared_memory(key_t key, size_t size, int *shmid) {
-    void *shm = NULL;
-
-    *shmid = shmget((key_t)key, size, 0666|IPC_CREAT);
-    if (*shmid == -1) {
-        fprintf(stderr, "shmget failed\n");
-        exit(EXIT_FAILURE);
-    }
+void* create_shared_memory(key_t key, size_t size, int *shmid, int *fresh) {
+    void *shm = frame_shm_attach(key, size, shmid, fresh);
 
-    shm = shmat(*shmid, 0, 0);
-    if (shm == (void*)-1) {
-        fprintf(stderr, "shmat failed\n");
+    if (shm == NULL) {
+        fprintf(stderr, "shmget/shmat failed\n");
         exit(EXIT_FAILURE);
     }
-    fprintf(stderr, "create shmid:%d\n", *shmid);
+    fprintf(stderr, "%s shmid:%d\n", *fresh ? "create" : "reattach", *shmid);
     return shm;
 }
 
@@ -121,6 +129,62 @@ void getActualFrameSize (display_stage_cfg_t *cfg, uint32_t *width, uint32_t *he
     *height = cfg->decoder_info->height;
 }
 
+// Copies the frame to the shared memory for imageProcess
+static void publish_frame (display_stage_cfg_t *cfg, uint32_t actual_width, uint32_t actual_height)
+{
+    int64_t wait_start = frame_shm_now_ns ();
+    TRACE_BEGIN (TRACE_PUBLISH_WAIT, 0);
+    frame_shm_beat (shared_info, 1);
+    if (image_pid != shared_info->image_pid && 0 != shared_info->image_pid)
+    {
+        image_pid = shared_info->image_pid;
+        printf ("imageProcess %d attached\n", (int)image_pid);
+    }
+    // imageProcess --decode reads the H.264 stream from pre_stage, nothing to copy
+    bool_t publish = !pre_stage_stream_decoded ();
+    int locked = publish ? semaphore_P_timed (sem_id, PUBLISH_LOCK_TIMEOUT_MS) : -1;
+    if (0 == locked)
+        exit(EXIT_FAILURE);
+    if (!publish)
+    {
+        TRACE_END (TRACE_PUBLISH_WAIT);
+    }
+    else if (0 > locked)
+    {
+        // imageProcess holds the frame, hung or stopped : SEM_UNDO releases it if it dies
+        TRACE_END (TRACE_PUBLISH_WAIT);
+        if (!publish_stalled)
+        {
+            fprintf (stderr, "imageProcess %s, frames are not published\n",
+                     frame_shm_peer_alive (shared_info, 1) ? "is slow" : "is not responding");
+        }
+        publish_stalled = 1;
+    }
+    else
+    {
+        publish_stalled = 0;
+        TRACE_END (TRACE_PUBLISH_WAIT);
+        TRACE_BEGIN (TRACE_PUBLISH, shared_info->frame_id + 1);
+        int64_t copy_start = frame_shm_now_ns ();
+        shared_info->width = actual_width;
+        shared_info->height = actual_height;
+        shared_info->size = cfg->fbSize;
+        shared_info->frame_id += 1;
+        shared_info->stamp_ns = copy_start;
+        vp_os_memcpy(shared_data, cfg->frameBuffer, cfg->fbSize);
+        if (!semaphore_V(sem_id))
+            exit(EXIT_FAILURE);
+        frame_shm_publish (shared_info);
+        TRACE_END (TRACE_PUBLISH);
+        if (NULL != stats)
+        {
+            stat_timer_add (&stats->control.publish_wait, copy_start - wait_start);
+            stat_timer_add (&stats->control.publish, frame_shm_now_ns () - copy_start);
+            stat_add (&stats->control.frames_published, 1);
+        }
+    }
+}
+
 // Redraw function, called by GTK each time we ask for a frame redraw
 static gboolean
 on_expose_event (GtkWidget *widget,
@@ -152,15 +216,13 @@ on_expose_event (GtkWidget *widget,
     cairo_surface_t *surface = cairo_image_surface_create_for_data (cfg->frameBuffer, CAIRO_FORMAT_RGB16_565, width, height, stride);
 
     // my code
-    if (!semaphore_P(sem_id))
-        exit(EXIT_FAILURE);
-        shared_info->width = actual_width;
-        shared_info->height = actual_height;
-        shared_info->size = cfg->fbSize;
-        shared_info->frame_id += 1;
-        vp_os_memcpy(shared_data, cfg->frameBuffer, cfg->fbSize);
-    if (!semaphore_V(sem_id))
-        exit(EXIT_FAILURE);
+    // the channel is left on exit while the window is still drawn
+    pthread_mutex_lock (&publish_lock);
+    if (NULL != info_shm)
+    {
+        publish_frame (cfg, actual_width, actual_height);
+    }
+    pthread_mutex_unlock (&publish_lock);
 
     cairo_set_source_surface (cr, surface, 0.0, 0.0);
 
@@ -185,6 +247,10 @@ DEFINE_THREAD_ROUTINE(gtk, data)
     display_stage_cfg_t *cfg = (display_stage_cfg_t *)data;
     cfg->widget = window;
 
+    // Frames are copied to the shared memory from the expose callback
+    rt_profile_apply (cfg->rt, "shm_publisher");
+    TRACE_THREAD ("shm_publisher");
+
     g_signal_connect (window, "expose-event", G_CALLBACK (on_expose_event), data);
     g_signal_connect (window, "destroy", G_CALLBACK (gtk_main_quit), NULL);
 
@@ -215,6 +281,10 @@ DEFINE_THREAD_ROUTINE(gtk, data)
 
 C_RESULT display_stage_open (display_stage_cfg_t *cfg)
 {
+    // Stages are opened by the video thread itself
+    rt_profile_apply (cfg->rt, "video_stage");
+    TRACE_THREAD ("video_stage");
+
     // Check that we use RGB565
     if (2 != cfg->bpp)
     {
@@ -227,33 +297,35 @@ C_RESULT display_stage_open (display_stage_cfg_t *cfg)
         cfg->paramsOK = TRUE;
         cfg->frameBuffer = NULL;
         cfg->fbSize = 0;
-        START_THREAD (gtk, cfg);
-        
-        // shared memory
-        info_shm = create_shared_memory(SHARE_KEY, sizeof(struct tran_data), &info_shmid);
-        data_shm = create_shared_memory(DATA_KEY, sizeof(uint8_t)*DATA_SIZE, &data_shmid);
-        err_shm = create_shared_memory(ERR_KEY, sizeof(struct area_err), &err_shmid);
+
+        // shared memory, an imageProcess already running keeps its place in it
+        int fresh = 0;
+        info_shm = create_shared_memory(drone_key(SHARE_KEY, cfg->droneId), sizeof(struct tran_data), &info_shmid, &fresh);
         shared_info = (struct tran_data*) info_shm;
+        image_pid = frame_shm_claim(shared_info, info_shmid, fresh, 1);
+        if (0 != image_pid)
+            printf("imageProcess %d is running, reattached to it\n", (int)image_pid);
+        data_shm = create_shared_memory(drone_key(DATA_KEY, cfg->droneId), sizeof(uint8_t)*DATA_SIZE, &data_shmid, &fresh);
+        err_shm = create_shared_memory(drone_key(ERR_KEY, cfg->droneId), sizeof(struct area_err), &err_shmid, &fresh);
         shared_data = (uint8_t*) data_shm;
         err_info = (struct area_err*) err_shm;
-
-        shared_info->frame_id = -1;
-
-        // semaphore
-        sem_id = semget(SEM_KEY, 1, 0666 | IPC_CREAT);
-        sem_id2 = semget(SEM_KEY2, 1, 0666 | IPC_CREAT);
-        sem_id3 = semget(SEM_KEY3, 1, 0666 | IPC_CREAT);
-        if (!set_semvalue(sem_id)) {
-                fprintf(stderr, "Failed to init semaphore\n");
-                exit(EXIT_FAILURE);
-        }
-        if (!set_semvalue(sem_id3)) {
+        rt_prefault (shared_data, DATA_SIZE);
+        stats = track_stats_attach (drone_key (STATS_KEY, cfg->droneId), 0);
+
+        // semaphore, not reset under an imageProcess that may hold it
+        sem_id = open_semaphore(drone_key(SEM_KEY, cfg->droneId));
+        sem_id2 = semget(drone_key(SEM_KEY2, cfg->droneId), 1, 0666 | IPC_CREAT);
+        sem_id3 = open_semaphore(drone_key(SEM_KEY3, cfg->droneId));
+        if (sem_id == -1 || sem_id3 == -1) {
                 fprintf(stderr, "Failed to init semaphore\n");
                 exit(EXIT_FAILURE);
         }
+        // seq is left alone, it is the futex word imageProcess keeps bumping
         err_info->x_err = 0;
         err_info->y_err = 0;
         err_info->z_err = 0;
+        err_info->stamp_ns = 0;
+        START_THREAD (gtk, cfg);
         //
         //namedWindow( "CamShift Demo", 0 );
     }
@@ -275,6 +347,11 @@ C_RESULT display_stage_transform (display_stage_cfg_t *cfg, vp_api_io_data_t *in
     }
     // Copy last frame to frameBuffer
     vp_os_memcpy (cfg->frameBuffer, in->buffers[in->indexBuffer], cfg->fbSize);
+    if (NULL != stats)
+    {
+        stat_add (&stats->control.frames_received, 1);
+    }
+    TRACE_INSTANT (TRACE_FRAME_DECODED, cfg->fbSize);
 
     // Ask GTK to redraw the window
     uint32_t width = 0, height = 0;
@@ -296,17 +373,31 @@ C_RESULT display_stage_transform (display_stage_cfg_t *cfg, vp_api_io_data_t *in
     return C_OK;
 }
 
-void del_share_memory(void* shm, int shmid) {
-    if (shmdt(shm) == -1) {
-        fprintf(stderr, "shmdt failed\n");
-        exit(EXIT_FAILURE);
+// Leaves the channel. The segments and semaphores are only removed when
+// no imageProcess is attached any more, a running one keeps them for the
+// next control process.
+void display_stage_detach (void)
+{
+    pthread_mutex_lock (&publish_lock);
+    if (NULL == info_shm)
+    {
+        pthread_mutex_unlock (&publish_lock);
+        return;
     }
-
-    if (shmctl(shmid, IPC_RMID, 0) == -1) {
-        fprintf(stderr, "shmtcl(RMID) failed\n");
-        exit(EXIT_FAILURE);
+    int alone = !frame_shm_pid_alive (shared_info->image_pid);
+    frame_shm_leave (shared_info, 1);
+    frame_shm_release (info_shm, info_shmid);
+    frame_shm_release (data_shm, data_shmid);
+    frame_shm_release (err_shm, err_shmid);
+    info_shm = data_shm = err_shm = NULL;
+    if (alone)
+    {
+        // already gone if an imageProcess cleaned up after a crash of ours
+        semctl (sem_id, 0, IPC_RMID);
+        semctl (sem_id3, 0, IPC_RMID);
     }
-    fprintf(stderr, "del shm_id:%d\n", shmid);
+    pthread_mutex_unlock (&publish_lock);
+    fprintf (stderr, "left the shared memory%s\n", alone ? ", removed" : ", imageProcess still attached");
 }
 
 C_RESULT display_stage_close (display_stage_cfg_t *cfg)
@@ -318,10 +409,6 @@ C_RESULT display_stage_close (display_stage_cfg_t *cfg)
         cfg->frameBuffer = NULL;
     }
 
-    // delete shared memory and semaphore
-    del_share_memory(info_shm, info_shmid);
-    del_share_memory(data_shm, data_shmid);
-    del_share_memory(err_shm, err_shmid);
-    del_semaphore(sem_id);
+    // the channel is left by ardrone_tool_shutdown_custom, auto_control still reads the results
     return C_OK;
 }
@@ -9,11 +9,14 @@
 #include <ardrone_tool/Video/video_stage.h>
 #include <inttypes.h>
 #include <gtk/gtk.h>
+#include <Control/rt_profile.h>
 
 typedef struct _display_stage_cfg_ {
     // PARAM
     float bpp;
     vp_api_picture_t *decoder_info;
+    const rt_profile_t *rt;     // video_stage and shm_publisher threads
+    int droneId;                // shared memory channels of this drone, see drone_key
 
     // INTERNAL
     uint8_t *frameBuffer;
@@ -24,18 +27,7 @@ typedef struct _display_stage_cfg_ {
 } display_stage_cfg_t;
 
 // my struct
-struct tran_data {
-    int size;
-    int width;
-    int height;
-    int frame_id;
-};
-
-struct area_err {
-    float x_err;
-    float y_err;
-    float z_err;
-};
+#include "frame_shm.h"
 
 static struct tran_data *shared_info;
 struct area_err *err_info;
@@ -45,17 +37,11 @@ static void *info_shm, *data_shm, *err_shm;
 static int sem_id, sem_id2, sem_id3;
 static int pre_err_id;
 
-static const key_t SHARE_KEY = 1333;
-static const key_t DATA_KEY = 1313;
-static const key_t SEM_KEY = 9999;
-static const key_t SEM_KEY2 = 7777;
-static const key_t SEM_KEY3 = 6666;
-static const key_t ERR_KEY = 1995;
-static const int DATA_SIZE = 1048576;
-
 C_RESULT display_stage_open (display_stage_cfg_t *cfg);
 C_RESULT display_stage_transform (display_stage_cfg_t *cfg, vp_api_io_data_t *in, vp_api_io_data_t *out);
 C_RESULT display_stage_close (display_stage_cfg_t *cfg);
+// leaves the shared memory, once the video and auto_control threads are stopped
+void display_stage_detach (void);
 
 extern const vp_api_stage_funcs_t display_stage_funcs;
 
@@ -0,0 +1,130 @@
+/**
+ * @file frame_codec.c
+ *
+ * Lossless codecs for recorded decoded frames, see frame_codec.h
+ */
+
+#include "frame_codec.h"
+
+#include <string.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+
+// dst = a ^ b, a word at a time
+static void xor_frames (const uint8_t *a, const uint8_t *b, uint8_t *dst, size_t size)
+{
+    size_t i = 0;
+    for (; i + sizeof (uint64_t) <= size; i += sizeof (uint64_t))
+    {
+        uint64_t x, y;
+        memcpy (&x, a + i, sizeof (x));
+        memcpy (&y, b + i, sizeof (y));
+        x ^= y;
+        memcpy (dst + i, &x, sizeof (x));
+    }
+    for (; i < size; i++)
+    {
+        dst[i] = a[i] ^ b[i];
+    }
+}
+#endif // HAVE_LZ4
+
+int frame_codec_available (int codec)
+{
+    switch (codec)
+    {
+    case FRAME_CODEC_RAW:
+        return 1;
+#ifdef HAVE_LZ4
+    case FRAME_CODEC_LZ4:
+    case FRAME_CODEC_LZ4_DELTA:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+size_t frame_codec_bound (size_t raw_size)
+{
+#ifdef HAVE_LZ4
+    return LZ4_compressBound ((int)raw_size);
+#else
+    return raw_size;
+#endif
+}
+
+size_t frame_codec_encode (int codec, const uint8_t *src, const uint8_t *prev, size_t raw_size,
+                           uint8_t *tmp, uint8_t *dst, size_t dst_capacity)
+{
+#ifndef HAVE_LZ4
+    // only the delta codec uses them
+    (void)prev;
+    (void)tmp;
+#endif
+    switch (codec)
+    {
+    case FRAME_CODEC_RAW:
+        if (raw_size > dst_capacity)
+        {
+            return 0;
+        }
+        memcpy (dst, src, raw_size);
+        return raw_size;
+#ifdef HAVE_LZ4
+    case FRAME_CODEC_LZ4_DELTA:
+        if (NULL == prev || NULL == tmp)
+        {
+            return 0;
+        }
+        xor_frames (src, prev, tmp, raw_size);
+        src = tmp;
+        // Fall through
+    case FRAME_CODEC_LZ4:
+    {
+        int n = LZ4_compress_default ((const char *)src, (char *)dst, (int)raw_size, (int)dst_capacity);
+        return (0 < n) ? (size_t)n : 0;
+    }
+#endif
+    default:
+        return 0;
+    }
+}
+
+int frame_codec_decode (int codec, const uint8_t *src, size_t size, const uint8_t *prev,
+                        uint8_t *dst, size_t raw_size)
+{
+#ifndef HAVE_LZ4
+    (void)prev;
+#endif
+    switch (codec)
+    {
+    case FRAME_CODEC_RAW:
+        if (size != raw_size)
+        {
+            return -1;
+        }
+        memcpy (dst, src, raw_size);
+        return 0;
+#ifdef HAVE_LZ4
+    case FRAME_CODEC_LZ4:
+    case FRAME_CODEC_LZ4_DELTA:
+        if (LZ4_decompress_safe ((const char *)src, (char *)dst, (int)size, (int)raw_size) != (int)raw_size)
+        {
+            return -1;
+        }
+        if (FRAME_CODEC_LZ4_DELTA == codec)
+        {
+            if (NULL == prev)
+            {
+                return -1;
+            }
+            xor_frames (dst, prev, dst, raw_size);
+        }
+        return 0;
+#endif
+    default:
+        return -1;
+    }
+}
@@ -0,0 +1,54 @@
+/**
+ * Lossless codecs for recorded decoded frames
+ *
+ * FRAME_CODEC_LZ4 compresses a frame on its own. FRAME_CODEC_LZ4_DELTA first
+ * XORs the frame with the previous one, so the static parts of the scene
+ * become long zero runs, then compresses the result. A delta frame can only
+ * be decoded after the previous frame, the writer inserts a key frame every
+ * FRAME_CODEC_KEY_INTERVAL frames to bound the cost of a seek.
+ *
+ * LZ4 support needs HAVE_LZ4 and liblz4, without it only FRAME_CODEC_RAW is available.
+ * This file is shared with the imageProcess tools and must stay SDK independent.
+ */
+
+#ifndef _FRAME_CODEC_H_
+#define _FRAME_CODEC_H_ (1)
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_CODEC_KEY_INTERVAL (30)
+
+typedef enum _frame_codec_ {
+    FRAME_CODEC_RAW = 0,
+    FRAME_CODEC_LZ4 = 1,
+    FRAME_CODEC_LZ4_DELTA = 2,
+} frame_codec_t;
+
+// 1 if this build can encode / decode codec
+int frame_codec_available (int codec);
+
+// Worst case encoded size of a raw_size frame
+size_t frame_codec_bound (size_t raw_size);
+
+// Encodes raw_size bytes of src into dst. prev is the previous raw frame
+// (FRAME_CODEC_LZ4_DELTA only) and tmp a raw_size scratch buffer.
+// Returns the encoded size, 0 on failure.
+size_t frame_codec_encode (int codec, const uint8_t *src, const uint8_t *prev, size_t raw_size,
+                           uint8_t *tmp, uint8_t *dst, size_t dst_capacity);
+
+// Decodes size bytes of src into the raw_size bytes of dst. prev is the
+// previous decoded frame (FRAME_CODEC_LZ4_DELTA only).
+// Returns 0 on success.
+int frame_codec_decode (int codec, const uint8_t *src, size_t size, const uint8_t *prev,
+                        uint8_t *dst, size_t raw_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _FRAME_CODEC_H_
@@ -0,0 +1,327 @@
+/**
+ * @file frame_record.c
+ *
+ * Writer side of the indexed frame container, see frame_record.h
+ */
+
+#include "frame_record.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const uint8_t zeros[FRAME_RECORD_ALIGN] = {0};
+
+static void fill_file_header (frame_record_writer_t *rec, frame_record_file_header_t *header, uint64_t index_offset)
+{
+    memset (header, 0, sizeof (*header));
+    header->magic = FRAME_RECORD_MAGIC;
+    header->version = FRAME_RECORD_VERSION;
+    header->header_size = sizeof (frame_record_file_header_t);
+    header->frame_header_size = sizeof (frame_record_frame_header_t);
+    header->index_offset = index_offset;
+    header->frame_count = rec->count;
+    header->start_time_us = rec->start_time_us;
+}
+
+// Appends one frame to the file and the index, -1 if it was dropped
+static int append_frame (frame_record_writer_t *rec, frame_record_frame_header_t *hdr, const uint8_t *data, int wait)
+{
+    struct iovec iov[3];
+    uint64_t end;
+
+    if (rec->count == rec->capacity)
+    {
+        uint32_t capacity = (0 == rec->capacity) ? 1024 : rec->capacity * 2;
+        uint64_t *index = (uint64_t *)realloc (rec->index, capacity * sizeof (uint64_t));
+        if (NULL == index)
+        {
+            return -1;
+        }
+        rec->index = index;
+        rec->capacity = capacity;
+    }
+
+    hdr->magic = FRAME_RECORD_FRAME_MAGIC;
+    end = rec->offset + sizeof (frame_record_frame_header_t) + hdr->size;
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof (frame_record_frame_header_t);
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = hdr->size;
+    iov[2].iov_base = (void *)zeros;
+    iov[2].iov_len = FRAME_RECORD_ALIGNED (end) - end;
+    if (0 != async_writer_write (&rec->out, iov, 3, wait))
+    {
+        return -1;
+    }
+
+    rec->index[rec->count++] = rec->offset;
+    rec->offset = FRAME_RECORD_ALIGNED (end);
+    return 0;
+}
+
+static double elapsed_ms (const struct timespec *from)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - from->tv_sec) * 1000.0 + (now.tv_nsec - from->tv_nsec) / 1000000.0;
+}
+
+static void encode_frame (frame_record_writer_t *rec, frame_record_frame_header_t *hdr, const uint8_t *data)
+{
+    struct timespec start;
+    uint32_t raw_size = hdr->size;
+    int codec = rec->codec;
+    size_t size;
+
+    // Delta frames need the previous frame of the same size
+    if (FRAME_CODEC_LZ4_DELTA == codec &&
+        (0 == rec->since_key || rec->prev_size != raw_size))
+    {
+        codec = FRAME_CODEC_LZ4;
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    size = frame_codec_encode (codec, data, rec->prev, raw_size, rec->tmp, rec->encoded, rec->encoded_capacity);
+    rec->encode_ms += elapsed_ms (&start);
+
+    hdr->raw_size = raw_size;
+    if (0 == size || raw_size <= size)
+    {
+        // Incompressible, store as is
+        hdr->codec = FRAME_CODEC_RAW;
+        hdr->flags = FRAME_FLAG_KEY;
+    }
+    else
+    {
+        hdr->codec = codec;
+        hdr->size = size;
+        hdr->flags = (FRAME_CODEC_LZ4_DELTA == codec) ? 0 : FRAME_FLAG_KEY;
+        data = rec->encoded;
+    }
+    rec->since_key = (hdr->flags & FRAME_FLAG_KEY) ? 1 : (rec->since_key + 1) % FRAME_CODEC_KEY_INTERVAL;
+    rec->raw_bytes += raw_size;
+    rec->encoded_bytes += hdr->size;
+
+    // Off the video thread, waiting for the disk is fine here
+    append_frame (rec, hdr, data, 1);
+}
+
+static void *encoder_thread (void *arg)
+{
+    frame_record_writer_t *rec = (frame_record_writer_t *)arg;
+
+    for (;;)
+    {
+        frame_record_frame_header_t hdr;
+        const uint8_t *data;
+
+        pthread_mutex_lock (&rec->lock);
+        while (0 == rec->slot_queued && !rec->stop)
+        {
+            pthread_cond_wait (&rec->not_empty, &rec->lock);
+        }
+        if (0 == rec->slot_queued)
+        {
+            pthread_mutex_unlock (&rec->lock);
+            break;
+        }
+        hdr = rec->slot_hdr[rec->slot_read];
+        data = rec->slots + (size_t)rec->slot_read * FRAME_RECORD_MAX_FRAME;
+        pthread_mutex_unlock (&rec->lock);
+
+        encode_frame (rec, &hdr, data);
+        memcpy (rec->prev, data, hdr.raw_size);
+        rec->prev_size = hdr.raw_size;
+
+        pthread_mutex_lock (&rec->lock);
+        rec->slot_read = (rec->slot_read + 1) % FRAME_RECORD_SLOTS;
+        rec->slot_queued--;
+        pthread_mutex_unlock (&rec->lock);
+    }
+    return NULL;
+}
+
+static int start_encoder (frame_record_writer_t *rec)
+{
+    rec->encoded_capacity = frame_codec_bound (FRAME_RECORD_MAX_FRAME);
+    rec->slots = (uint8_t *)malloc ((size_t)FRAME_RECORD_SLOTS * FRAME_RECORD_MAX_FRAME);
+    rec->prev = (uint8_t *)malloc (FRAME_RECORD_MAX_FRAME);
+    rec->tmp = (uint8_t *)malloc (FRAME_RECORD_MAX_FRAME);
+    rec->encoded = (uint8_t *)malloc (rec->encoded_capacity);
+    if (NULL == rec->slots || NULL == rec->prev || NULL == rec->tmp || NULL == rec->encoded)
+    {
+        return -1;
+    }
+    // Fault the slots in now rather than on the video thread
+    memset (rec->slots, 0, (size_t)FRAME_RECORD_SLOTS * FRAME_RECORD_MAX_FRAME);
+
+    pthread_mutex_init (&rec->lock, NULL);
+    pthread_cond_init (&rec->not_empty, NULL);
+    if (0 != pthread_create (&rec->encoder, NULL, encoder_thread, rec))
+    {
+        pthread_cond_destroy (&rec->not_empty);
+        pthread_mutex_destroy (&rec->lock);
+        return -1;
+    }
+    return 0;
+}
+
+static void stop_encoder (frame_record_writer_t *rec)
+{
+    pthread_mutex_lock (&rec->lock);
+    rec->stop = 1;
+    pthread_cond_signal (&rec->not_empty);
+    pthread_mutex_unlock (&rec->lock);
+    pthread_join (rec->encoder, NULL);
+    pthread_cond_destroy (&rec->not_empty);
+    pthread_mutex_destroy (&rec->lock);
+}
+
+static void free_encoder (frame_record_writer_t *rec)
+{
+    free (rec->slots);
+    free (rec->prev);
+    free (rec->tmp);
+    free (rec->encoded);
+    rec->slots = rec->prev = rec->tmp = rec->encoded = NULL;
+}
+
+int frame_record_open (frame_record_writer_t *rec, const char *name, int direct, int codec)
+{
+    frame_record_file_header_t header;
+    struct iovec iov;
+    struct timespec now;
+
+    memset (rec, 0, sizeof (*rec));
+    if (!frame_codec_available (codec))
+    {
+        fprintf (stderr, "frame_record: codec %d not available in this build, recording raw frames\n", codec);
+        codec = FRAME_CODEC_RAW;
+    }
+    rec->codec = codec;
+    if (0 != async_writer_open (&rec->out, name, ASYNC_WRITER_BLOCK_SIZE, ASYNC_WRITER_BLOCK_COUNT, direct))
+    {
+        return -1;
+    }
+    if (FRAME_CODEC_RAW != codec && 0 != start_encoder (rec))
+    {
+        free_encoder (rec);
+        async_writer_close (&rec->out, NULL, 0);
+        return -1;
+    }
+    rec->opened = 1;
+    clock_gettime (CLOCK_REALTIME, &now);
+    rec->start_time_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+    fill_file_header (rec, &header, 0);
+    iov.iov_base = &header;
+    iov.iov_len = sizeof (header);
+    async_writer_write (&rec->out, &iov, 1, 1);
+    rec->offset = sizeof (frame_record_file_header_t);
+    return 0;
+}
+
+int frame_record_write (frame_record_writer_t *rec, frame_record_frame_header_t *hdr, const uint8_t *data)
+{
+    uint32_t slot;
+
+    if (!rec->opened)
+    {
+        return -1;
+    }
+    if (FRAME_CODEC_RAW == rec->codec)
+    {
+        hdr->codec = FRAME_CODEC_RAW;
+        hdr->raw_size = hdr->size;
+        hdr->flags = FRAME_FLAG_KEY;
+        return append_frame (rec, hdr, data, 0);
+    }
+
+    // Hand the raw frame to the encoder thread, never wait for it
+    if (hdr->size > FRAME_RECORD_MAX_FRAME)
+    {
+        return -1;
+    }
+    pthread_mutex_lock (&rec->lock);
+    if (FRAME_RECORD_SLOTS == rec->slot_queued)
+    {
+        rec->slots_dropped++;
+        pthread_mutex_unlock (&rec->lock);
+        return -1;
+    }
+    slot = rec->slot_write;
+    pthread_mutex_unlock (&rec->lock);
+
+    memcpy (rec->slots + (size_t)slot * FRAME_RECORD_MAX_FRAME, data, hdr->size);
+    rec->slot_hdr[slot] = *hdr;
+
+    pthread_mutex_lock (&rec->lock);
+    rec->slot_write = (slot + 1) % FRAME_RECORD_SLOTS;
+    rec->slot_queued++;
+    pthread_cond_signal (&rec->not_empty);
+    pthread_mutex_unlock (&rec->lock);
+    return 0;
+}
+
+void frame_record_close (frame_record_writer_t *rec)
+{
+    frame_record_file_header_t header;
+    frame_record_trailer_t trailer;
+    struct iovec iov[2];
+
+    if (!rec->opened)
+    {
+        return;
+    }
+
+    if (FRAME_CODEC_RAW != rec->codec)
+    {
+        stop_encoder (rec);
+        free_encoder (rec);
+        fprintf (stderr, "frame_record: %u frames dropped before encoding, ratio %.2f, encoder %.1f MB/s\n",
+                 rec->slots_dropped,
+                 (0 < rec->encoded_bytes) ? (double)rec->raw_bytes / rec->encoded_bytes : 0.0,
+                 (0 < rec->encode_ms) ? rec->raw_bytes / 1000.0 / rec->encode_ms : 0.0);
+    }
+
+    // The index must not be dropped, wait for the writer thread if needed
+    trailer.magic = FRAME_RECORD_INDEX_MAGIC;
+    trailer.frame_count = rec->count;
+    trailer.index_offset = rec->offset;
+    iov[0].iov_base = rec->index;
+    iov[0].iov_len = rec->count * sizeof (uint64_t);
+    iov[1].iov_base = &trailer;
+    iov[1].iov_len = sizeof (trailer);
+    async_writer_write (&rec->out, iov, 2, 1);
+
+    fill_file_header (rec, &header, rec->offset);
+    async_writer_close (&rec->out, &header, sizeof (header));
+    rec->opened = 0;
+
+    free (rec->index);
+    rec->index = NULL;
+}
+
+void frame_record_picture_size (uint32_t bufSize, uint32_t bpp, uint16_t *width, uint16_t *height)
+{
+    static const uint16_t sizes[][2] = {
+        {176, 144},   // QCIF
+        {320, 240},   // QVGA
+        {640, 360},   // 360p
+        {1280, 720},  // 720p
+    };
+    uint32_t i;
+
+    *width = 0;
+    *height = 0;
+    for (i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++)
+    {
+        if (bufSize == (uint32_t)sizes[i][0] * sizes[i][1] * bpp)
+        {
+            *width = sizes[i][0];
+            *height = sizes[i][1];
+            return;
+        }
+    }
+}
@@ -0,0 +1,139 @@
+/**
+ * Indexed container for recorded video frames
+ *
+ * Layout (all fields little endian, every block starts on a 64 byte boundary) :
+ *  - file header
+ *  - for each frame : frame header, frame data, padding
+ *  - frame index : one uint64_t file offset per frame header
+ *  - trailer
+ *
+ * The file header is rewritten on close with the index position, so a reader
+ * can mmap the file and reach any frame in O(1). A recording that was not
+ * closed (crash, power loss) has index_offset == 0 and can still be read by
+ * walking the frame headers.
+ *
+ * Frames are handed to an async_writer, a frame that does not fit in its
+ * buffer pool is dropped (and counted) rather than stalling the video thread.
+ *
+ * Frames can be stored compressed (frame_codec.h). The video thread then only
+ * copies the raw frame into one of FRAME_RECORD_SLOTS slots, and an encoder
+ * thread compresses and writes it.
+ *
+ * This file is shared with the imageProcess tools and must stay SDK independent.
+ */
+
+#ifndef _FRAME_RECORD_H_
+#define _FRAME_RECORD_H_ (1)
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "async_writer.h"
+#include "frame_codec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_RECORD_MAGIC         (0x52465241) // "ARFR"
+#define FRAME_RECORD_FRAME_MAGIC   (0x4D415246) // "FRAM"
+#define FRAME_RECORD_INDEX_MAGIC   (0x58444E49) // "INDX"
+#define FRAME_RECORD_VERSION       (2) // 1 : no codec, always raw
+#define FRAME_RECORD_ALIGN         (64)
+
+#define FRAME_RECORD_SLOTS         (8)
+#define FRAME_RECORD_MAX_FRAME     (1280 * 720 * 3)
+
+#define FRAME_RECORD_ALIGNED(v)    (((v) + FRAME_RECORD_ALIGN - 1) & ~((uint64_t)FRAME_RECORD_ALIGN - 1))
+
+typedef enum _frame_record_pix_fmt_ {
+    FRAME_PIX_RGB565 = 0,
+    FRAME_PIX_RGB24 = 1,
+} frame_record_pix_fmt_t;
+
+#define FRAME_FLAG_KEY             (1 << 0) // decodable without the previous frame
+
+typedef struct _frame_record_file_header_ {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;        // sizeof (frame_record_file_header_t)
+    uint32_t frame_header_size;  // sizeof (frame_record_frame_header_t)
+    uint64_t index_offset;       // 0 until the recording is closed
+    uint32_t frame_count;
+    uint32_t flags;
+    uint64_t start_time_us;      // CLOCK_REALTIME when the recording started
+    uint8_t  reserved[24];
+} frame_record_file_header_t;
+
+typedef struct _frame_record_frame_header_ {
+    uint32_t magic;
+    uint32_t frame_id;           // PaVE frame number, or a counter on AR.Drone 1
+    uint32_t timestamp;          // PaVE timestamp (ms), 0 on AR.Drone 1
+    uint16_t width;
+    uint16_t height;
+    uint16_t pix_fmt;            // frame_record_pix_fmt_t
+    uint16_t codec;              // frame_codec_t
+    uint32_t size;               // bytes of frame data following this header
+    uint64_t capture_us;         // CLOCK_MONOTONIC when the stage got the frame
+    uint32_t raw_size;           // decoded size of the frame data
+    uint32_t flags;              // FRAME_FLAG_*
+    uint8_t  reserved[24];
+} frame_record_frame_header_t;
+
+typedef struct _frame_record_trailer_ {
+    uint32_t magic;              // FRAME_RECORD_INDEX_MAGIC
+    uint32_t frame_count;
+    uint64_t index_offset;
+} frame_record_trailer_t;
+
+typedef struct _frame_record_writer_ {
+    async_writer_t out;
+    int opened;
+    int codec;
+    uint64_t offset;             // where the next frame header goes
+    uint64_t *index;
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t start_time_us;
+
+    // codec != FRAME_CODEC_RAW : raw frames waiting for the encoder thread
+    uint8_t *slots;
+    frame_record_frame_header_t slot_hdr[FRAME_RECORD_SLOTS];
+    uint32_t slot_read;
+    uint32_t slot_write;
+    uint32_t slot_queued;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_t encoder;
+    int stop;
+
+    // encoder thread state
+    uint8_t *prev;
+    uint8_t *tmp;
+    uint8_t *encoded;
+    size_t encoded_capacity;
+    uint32_t prev_size;
+    uint32_t since_key;
+
+    // statistics
+    uint32_t slots_dropped;      // the encoder was FRAME_RECORD_SLOTS frames behind
+    uint64_t raw_bytes;
+    uint64_t encoded_bytes;
+    double encode_ms;
+} frame_record_writer_t;
+
+// direct : write with O_DIRECT, see async_writer_open
+// codec : frame_codec_t, falls back to FRAME_CODEC_RAW if not available in this build
+int frame_record_open (frame_record_writer_t *rec, const char *name, int direct, int codec);
+// Returns -1 if the frame was dropped, it is then not part of the index
+int frame_record_write (frame_record_writer_t *rec, frame_record_frame_header_t *hdr, const uint8_t *data);
+void frame_record_close (frame_record_writer_t *rec);
+
+// Buffer geometry of the drone stream sizes, 0x0 if unknown
+void frame_record_picture_size (uint32_t bufSize, uint32_t bpp, uint16_t *width, uint16_t *height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _FRAME_RECORD_H_
@@ -0,0 +1,427 @@
+/**
+ * Shared memory layout between the control process and imageProcess
+ *
+ * display_stage publishes the last decoded RGB565 frame : tran_data in the
+ * SHARE_KEY segment, the pixels in the DATA_KEY segment, both under the
+ * SEM_KEY semaphore, and bumps tran_data.frame_seq, a futex the fleet
+ * workers of imageProcess sleep on while no drone has a new frame
+ * (frame_shm_wait_any). imageProcess copies the frame out, then writes the
+ * tracking errors to the ERR_KEY segment under SEM_KEY3 and bumps
+ * area_err.seq, a futex the control thread sleeps on until a new result
+ * arrives (area_err_wait).
+ *
+ * Frames are stamped with the CLOCK_MONOTONIC time they were published and
+ * every result carries the stamp of the frame it was computed from, so the
+ * controller knows how old the error it acts on is.
+ *
+ * The navdata handler publishes the drone attitude, altitude and speeds in
+ * the NAV_KEY segment. It is a seqlock, not a semaphore : the writer never
+ * waits and readers retry if they raced with a write (nav_state_read).
+ *
+ * Either process can die and be restarted while the other keeps running.
+ * The SHARE_KEY segment starts with a versioned header holding the PID of
+ * each side and a heartbeat both refresh while they run. A segment nobody
+ * else is attached to when it is claimed is stale and its header is reset,
+ * otherwise the newcomer picks up where its predecessor stopped : the frame
+ * counter keeps going and imageProcess resumes the target saved in
+ * track_resume. On exit a process only removes the segments nobody else
+ * is attached to (frame_shm_release).
+ *
+ * This file is shared with the imageProcess tools and must stay SDK independent.
+ */
+
+#ifndef _FRAME_SHM_H_
+#define _FRAME_SHM_H_ (1)
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define FRAME_SHM_MAGIC (0x46534831)            // "FSH1"
+#define FRAME_SHM_VERSION (3)                   // bump with any layout change below
+#define FRAME_SHM_STALE_NS (1000000000LL)       // a peer silent for this long is hung or gone
+#define TRACK_RESUME_BINS (64)
+
+// Target of the running imageProcess, for the next one if it gets
+// restarted. A seqlock like nav_state, imageProcess is the only writer.
+struct track_resume {
+    uint32_t seq;               // odd while a write is in progress, 0 : nothing saved
+    int32_t hsize;
+    float hist[TRACK_RESUME_BINS];
+    int32_t vmin, vmax, smin;
+    int32_t x, y, width, height;        // search window
+    int32_t frame_width, frame_height;  // frame the window is in
+    int32_t ref_width, ref_height;      // frame ini_area is measured in
+};
+
+struct tran_data {
+    // header, valid once magic is set
+    uint32_t magic;
+    uint32_t version;
+    int32_t control_pid;        // 0 when detached
+    int32_t image_pid;
+    int64_t control_beat_ns;    // frame_shm_now_ns of the last sign of life
+    int64_t image_beat_ns;
+
+    int size;
+    int width;
+    int height;
+    int frame_id;
+    int64_t stamp_ns;           // publish time, frame_shm_now_ns
+    uint32_t frame_seq;         // bumped after every published frame, futex word
+
+    struct track_resume resume;
+};
+
+struct area_err {
+    float x_err;
+    float y_err;
+    float z_err;
+    uint32_t seq;               // bumped after every result, futex word
+    int64_t stamp_ns;           // stamp_ns of the frame the errors come from
+};
+
+struct nav_state {
+    uint32_t seq;               // odd while a write is in progress
+    uint32_t ctrl_state;
+    float theta;                // pitch, degrees
+    float phi;                  // roll, degrees
+    float psi;                  // yaw, degrees
+    float altitude;             // m
+    float vx, vy, vz;           // m/s
+    int64_t stamp_ns;           // reception time, frame_shm_now_ns
+};
+
+static const key_t SHARE_KEY = 1333;
+static const key_t DATA_KEY = 1313;
+static const key_t SEM_KEY = 9999;
+static const key_t SEM_KEY2 = 7777;
+static const key_t SEM_KEY3 = 6666;
+static const key_t ERR_KEY = 1995;
+static const key_t NAV_KEY = 2016;
+
+// Several control processes can share one imageProcess : the channels of
+// drone n use the keys above plus n * DRONE_KEY_STRIDE (also the statistics
+// and trace keys), drone 0 keeps the historical keys.
+#define DRONE_KEY_STRIDE (10000)
+#define MAX_DRONES (32)
+
+static inline key_t drone_key (key_t key, int drone)
+{
+    return key + drone * DRONE_KEY_STRIDE;
+}
+// a 720p RGB565 frame, the largest the drone streams
+static const int DATA_SIZE = 1280 * 720 * 2;
+
+// CLOCK_MONOTONIC in ns, the same time base in both processes
+static inline int64_t frame_shm_now_ns (void)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Called by imageProcess once a result is written, wakes every waiter
+static inline void area_err_publish (struct area_err *err)
+{
+    __sync_fetch_and_add (&err->seq, 1);
+    syscall (SYS_futex, &err->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Sleeps while err->seq == seq, at most timeout_ns. Returns the current seq,
+// different from seq if a new result arrived.
+static inline uint32_t area_err_wait (struct area_err *err, uint32_t seq, long timeout_ns)
+{
+    struct timespec timeout;
+
+    if (0 < timeout_ns && seq == *(volatile uint32_t *)&err->seq)
+    {
+        timeout.tv_sec = timeout_ns / 1000000000L;
+        timeout.tv_nsec = timeout_ns % 1000000000L;
+        // Not a private futex, the word lives in a segment shared by two processes
+        syscall (SYS_futex, &err->seq, FUTEX_WAIT, seq, &timeout, NULL, 0);
+    }
+    return *(volatile uint32_t *)&err->seq;
+}
+
+// Called by the control process once a frame is published, wakes every waiter
+static inline void frame_shm_publish (struct tran_data *info)
+{
+    __sync_fetch_and_add (&info->frame_seq, 1);
+    syscall (SYS_futex, &info->frame_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Sleeps while infos[i]->frame_seq == seqs[i] for all n channels, at most
+// timeout_ns. Returns 0 on a new frame or the timeout, -1 if the kernel
+// can't wait on several futexes (futex_waitv, Linux 5.16).
+static inline int frame_shm_wait_any (struct tran_data *const *infos, const uint32_t *seqs, int n, long timeout_ns)
+{
+#if defined (SYS_futex_waitv) && defined (FUTEX_32)
+    struct futex_waitv waiters[MAX_DRONES];
+    struct timespec deadline;
+    int i;
+
+    if (MAX_DRONES < n)
+    {
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+    {
+        // not FUTEX_PRIVATE_FLAG, the words live in segments of other processes
+        waiters[i].val = seqs[i];
+        waiters[i].uaddr = (uintptr_t)&infos[i]->frame_seq;
+        waiters[i].flags = FUTEX_32;
+        waiters[i].__reserved = 0;
+    }
+    // an absolute time on the given clock, unlike FUTEX_WAIT
+    clock_gettime (CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ns / 1000000000L;
+    deadline.tv_nsec += timeout_ns % 1000000000L;
+    if (1000000000L <= deadline.tv_nsec)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    if (-1 == syscall (SYS_futex_waitv, waiters, n, 0, &deadline, CLOCK_MONOTONIC) && ENOSYS == errno)
+    {
+        return -1;
+    }
+    return 0;
+#else
+    (void)infos;
+    (void)seqs;
+    (void)n;
+    (void)timeout_ns;
+    return -1;
+#endif
+}
+
+// Single writer, the navdata thread
+static inline void nav_state_write (struct nav_state *nav, const struct nav_state *val)
+{
+    volatile struct nav_state *dst = nav;
+    // a write interrupted by a crash leaves seq odd, start again from even
+    uint32_t seq = dst->seq | 1;
+
+    dst->seq = seq;
+    __sync_synchronize ();
+    dst->ctrl_state = val->ctrl_state;
+    dst->theta = val->theta;
+    dst->phi = val->phi;
+    dst->psi = val->psi;
+    dst->altitude = val->altitude;
+    dst->vx = val->vx;
+    dst->vy = val->vy;
+    dst->vz = val->vz;
+    dst->stamp_ns = val->stamp_ns;
+    __sync_synchronize ();
+    dst->seq = seq + 1;
+}
+
+// Consistent copy of nav into val. Returns 0, or -1 if nothing was published
+// yet or no consistent copy could be taken (the writer died halfway).
+static inline int nav_state_read (const struct nav_state *nav, struct nav_state *val)
+{
+    const volatile struct nav_state *src = nav;
+    uint32_t seq;
+    int tries;
+
+    for (tries = 0; tries < 1000; tries++)
+    {
+        seq = src->seq;
+        if (seq & 1)
+        {
+            // the writer may be gone halfway, do not spin on it forever
+            continue;
+        }
+        __sync_synchronize ();
+        val->ctrl_state = src->ctrl_state;
+        val->theta = src->theta;
+        val->phi = src->phi;
+        val->psi = src->psi;
+        val->altitude = src->altitude;
+        val->vx = src->vx;
+        val->vy = src->vy;
+        val->vz = src->vz;
+        val->stamp_ns = src->stamp_ns;
+        __sync_synchronize ();
+        if (seq == src->seq)
+        {
+            val->seq = seq;
+            return (0 == seq) ? -1 : 0;
+        }
+    }
+    return -1;
+}
+
+// 1 if pid is a running process (EPERM : it runs under another user)
+static inline int frame_shm_pid_alive (pid_t pid)
+{
+    return 0 < pid && (0 == kill (pid, 0) || EPERM == errno);
+}
+
+static inline int frame_shm_nattch (int shmid)
+{
+    struct shmid_ds ds;
+
+    return (0 == shmctl (shmid, IPC_STAT, &ds)) ? (int)ds.shm_nattch : -1;
+}
+
+// Attaches the segment of key, creating it if needed. A segment smaller
+// than size was left by an older layout : it is removed and created again,
+// the processes still attached to it keep their copy. *fresh is set when
+// the segment was just created (zeroed). NULL on failure.
+static inline void *frame_shm_attach (key_t key, size_t size, int *shmid, int *fresh)
+{
+    void *shm;
+
+    *fresh = 0;
+    *shmid = shmget (key, size, 0666 | IPC_CREAT | IPC_EXCL);
+    if (-1 != *shmid)
+    {
+        *fresh = 1;
+    }
+    else if (EEXIST == errno)
+    {
+        *shmid = shmget (key, size, 0666);
+        if (-1 == *shmid && EINVAL == errno)
+        {
+            int old = shmget (key, 0, 0666);
+            if (-1 != old)
+            {
+                shmctl (old, IPC_RMID, NULL);
+            }
+            *shmid = shmget (key, size, 0666 | IPC_CREAT | IPC_EXCL);
+            *fresh = (-1 != *shmid);
+        }
+    }
+    if (-1 == *shmid)
+    {
+        return NULL;
+    }
+    shm = shmat (*shmid, NULL, 0);
+    return ((void *)-1 == shm) ? NULL : shm;
+}
+
+// Detaches, and removes the segment if nobody else is attached to it
+static inline void frame_shm_release (void *shm, int shmid)
+{
+    int alone = (1 == frame_shm_nattch (shmid));
+
+    shmdt (shm);
+    if (alone)
+    {
+        shmctl (shmid, IPC_RMID, NULL);
+    }
+}
+
+// Takes the control (control = 1) or the imageProcess side of the channel
+// in info, attached to shmid. The header is reset if the segment is new,
+// of another version, or stale : only the caller attached and the other
+// side not running. Returns the PID of the other side if it is alive, else 0.
+static inline pid_t frame_shm_claim (struct tran_data *info, int shmid, int fresh, int control)
+{
+    pid_t peer = control ? info->image_pid : info->control_pid;
+    int valid = !fresh && FRAME_SHM_MAGIC == info->magic && FRAME_SHM_VERSION == info->version;
+
+    if (!valid || (1 == frame_shm_nattch (shmid) && !frame_shm_pid_alive (peer)))
+    {
+        memset (info, 0, sizeof (*info));
+        info->frame_id = -1;
+        info->version = FRAME_SHM_VERSION;
+        __sync_synchronize ();
+        info->magic = FRAME_SHM_MAGIC;
+        peer = 0;
+    }
+    if (control)
+    {
+        info->control_pid = getpid ();
+        info->control_beat_ns = frame_shm_now_ns ();
+    }
+    else
+    {
+        info->image_pid = getpid ();
+        info->image_beat_ns = frame_shm_now_ns ();
+    }
+    return frame_shm_pid_alive (peer) ? peer : 0;
+}
+
+static inline void frame_shm_beat (struct tran_data *info, int control)
+{
+    *(volatile int64_t *)(control ? &info->control_beat_ns : &info->image_beat_ns) = frame_shm_now_ns ();
+}
+
+// 1 if the other side is attached, running and beating
+static inline int frame_shm_peer_alive (const struct tran_data *info, int control)
+{
+    const volatile struct tran_data *v = info;
+    pid_t peer = control ? v->image_pid : v->control_pid;
+    int64_t beat = control ? v->image_beat_ns : v->control_beat_ns;
+
+    return frame_shm_pid_alive (peer) && frame_shm_now_ns () - beat < FRAME_SHM_STALE_NS;
+}
+
+// Leaves the channel, the segment itself is left to frame_shm_release
+static inline void frame_shm_leave (struct tran_data *info, int control)
+{
+    if (control)
+    {
+        info->control_pid = 0;
+    }
+    else
+    {
+        info->image_pid = 0;
+    }
+}
+
+static inline void track_resume_write (struct track_resume *dst, const struct track_resume *val)
+{
+    uint32_t seq = *(volatile uint32_t *)&dst->seq;
+
+    // a write interrupted by a crash leaves seq odd, start again from even
+    seq |= 1;
+    *(volatile uint32_t *)&dst->seq = seq;
+    __sync_synchronize ();
+    memcpy ((char *)dst + sizeof (dst->seq), (const char *)val + sizeof (val->seq),
+            sizeof (*dst) - sizeof (dst->seq));
+    __sync_synchronize ();
+    *(volatile uint32_t *)&dst->seq = seq + 1;
+}
+
+// Consistent copy of src into val. Returns 0, or -1 if nothing was saved.
+static inline int track_resume_read (const struct track_resume *src, struct track_resume *val)
+{
+    uint32_t seq;
+    int tries;
+
+    for (tries = 0; tries < 1000; tries++)
+    {
+        seq = *(const volatile uint32_t *)&src->seq;
+        if (seq & 1)
+        {
+            // the writer may be gone halfway, do not spin on it forever
+            continue;
+        }
+        __sync_synchronize ();
+        memcpy ((char *)val + sizeof (val->seq), (const char *)src + sizeof (src->seq),
+                sizeof (*val) - sizeof (val->seq));
+        __sync_synchronize ();
+        if (seq == *(const volatile uint32_t *)&src->seq)
+        {
+            val->seq = seq;
+            return (0 == seq) ? -1 : 0;
+        }
+    }
+    return -1;
+}
+
+#endif // _FRAME_SHM_H_
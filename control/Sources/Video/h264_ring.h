@@ -0,0 +1,206 @@
+/**
+ * Ring of encoded video frames between the control process and imageProcess
+ *
+ * pre_stage_transform sees every H.264 access unit of an AR.Drone 2 before
+ * the SDK decodes it and appends its payload to the H264_RING_KEY segment.
+ * imageProcess --decode reads the ring and decodes the stream itself, a few
+ * tens of kB per frame go through the shared memory instead of 1.8 MB of
+ * RGB565. While such a reader is attached (reader_pid), display_stage stops
+ * publishing the decoded frame.
+ *
+ * One writer, any number of readers and no lock : the writer never waits.
+ * A record is an h264_record followed by the payload, padded to 8 bytes,
+ * and never wraps : a record that would not fit before the end of the data
+ * is preceded by a padding record up to the end (or by nothing if not even
+ * a record header fits). Positions count bytes since the ring was created,
+ * the data offset is position % H264_RING_DATA_SIZE. Before writing over
+ * [pos, end) the writer raises reserve to end, once done it raises head to
+ * end and wakes the readers (a futex on head_seq). A reader copies a record
+ * out, then checks reserve did not pass its start plus the ring size :
+ * otherwise the writer lapped it, the copy is torn and the reader starts
+ * again from head (h264_ring_read returns -1), at the next IDR frame.
+ *
+ * This file is shared with the imageProcess tools and must stay SDK independent.
+ */
+
+#ifndef _H264_RING_H_
+#define _H264_RING_H_ (1)
+
+#include <stddef.h>
+#include <Video/frame_shm.h>
+
+#define H264_RING_MAGIC (0x48323634)            // "H264"
+#define H264_RING_VERSION (1)
+// several seconds of 720p at the 4 Mbit/s of the drone, a reader late by
+// that much is lapped
+#define H264_RING_DATA_SIZE (4 << 20)
+// an access unit larger than this is not published
+#define H264_RING_MAX_PAYLOAD (H264_RING_DATA_SIZE / 8)
+#define H264_RECORD_PAD (0xFFFFFFFFu)
+#define H264_RECORD_IDR (1u)                    // SPS, PPS and an IDR slice : a decoder can start here
+
+static const key_t H264_RING_KEY = 2020;
+
+struct h264_record {
+    uint32_t size;              // payload bytes, H264_RECORD_PAD up to the end of the data
+    uint32_t flags;
+    uint32_t frame_number;      // PaVE frame_number
+    uint16_t width;             // PaVE display size
+    uint16_t height;
+    int64_t stamp_ns;           // frame_shm_now_ns when pre_stage got the frame
+};
+
+struct h264_ring {
+    uint32_t magic;
+    uint32_t version;
+    int32_t writer_pid;         // 0 when detached
+    int32_t reader_pid;         // the imageProcess decoding the stream, 0 if none
+    uint32_t head_seq;          // bumped after every record, futex word
+    uint32_t pad;
+    uint64_t head;              // end of the last complete record
+    uint64_t reserve;           // end of the bytes being written
+    uint64_t records;
+    uint8_t data[H264_RING_DATA_SIZE];
+};
+
+static inline uint64_t h264_record_len (uint32_t size)
+{
+    return (sizeof (struct h264_record) + size + 7) & ~(uint64_t)7;
+}
+
+// Attaches the ring of key, initialized if new or of another version. NULL on failure.
+static inline struct h264_ring *h264_ring_attach (key_t key, int *shmid)
+{
+    int fresh;
+    struct h264_ring *ring = (struct h264_ring *)frame_shm_attach (key, sizeof (struct h264_ring), shmid, &fresh);
+
+    if (NULL != ring && (fresh || H264_RING_MAGIC != ring->magic || H264_RING_VERSION != ring->version))
+    {
+        memset (ring, 0, offsetof (struct h264_ring, data));
+        ring->version = H264_RING_VERSION;
+        __sync_synchronize ();
+        ring->magic = H264_RING_MAGIC;
+    }
+    return ring;
+}
+
+// Single writer. Returns 0, or -1 if the payload is empty or too large for the ring.
+static inline int h264_ring_write (struct h264_ring *ring, const struct h264_record *rec, const void *payload)
+{
+    volatile struct h264_ring *v = ring;
+    uint64_t len = h264_record_len (rec->size);
+    uint64_t pos = v->head;
+    uint64_t off = pos % H264_RING_DATA_SIZE;
+    uint64_t pad = 0;
+
+    if (0 == rec->size || H264_RING_MAX_PAYLOAD < rec->size)
+    {
+        return -1;
+    }
+    if (H264_RING_DATA_SIZE < off + len)
+    {
+        pad = H264_RING_DATA_SIZE - off;
+    }
+    v->reserve = pos + pad + len;
+    __sync_synchronize ();
+    if (sizeof (struct h264_record) <= pad)
+    {
+        struct h264_record marker;
+        memset (&marker, 0, sizeof (marker));
+        marker.size = H264_RECORD_PAD;
+        memcpy (ring->data + off, &marker, sizeof (marker));
+    }
+    off = (pos + pad) % H264_RING_DATA_SIZE;
+    memcpy (ring->data + off, rec, sizeof (*rec));
+    memcpy (ring->data + off + sizeof (*rec), payload, rec->size);
+    __sync_synchronize ();
+    v->head = pos + pad + len;
+    v->records++;
+    __sync_fetch_and_add (&ring->head_seq, 1);
+    syscall (SYS_futex, &ring->head_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    return 0;
+}
+
+// 1 if the bytes from pos on were not overwritten since they were read
+static inline int h264_ring_intact (const struct h264_ring *ring, uint64_t pos)
+{
+    __sync_synchronize ();
+    return ((const volatile struct h264_ring *)ring)->reserve <= pos + H264_RING_DATA_SIZE;
+}
+
+// Copies the record at *pos into rec and its payload into buf (buf_size
+// bytes at most) and moves *pos past it. Returns the payload size, 0 if
+// there is no new record, or -1 if the reader was lapped or the record is
+// larger than buf : *pos is moved to head, the stream has a gap.
+static inline int h264_ring_read (const struct h264_ring *ring, uint64_t *pos, struct h264_record *rec,
+                                  uint8_t *buf, size_t buf_size)
+{
+    const volatile struct h264_ring *v = ring;
+
+    for (;;)
+    {
+        uint64_t head = v->head;
+        uint64_t off = *pos % H264_RING_DATA_SIZE;
+        __sync_synchronize ();
+        if (*pos == head)
+        {
+            return 0;
+        }
+        if (head - *pos > H264_RING_DATA_SIZE)
+        {
+            *pos = head;
+            return -1;
+        }
+        if (H264_RING_DATA_SIZE - off < sizeof (*rec))
+        {
+            *pos += H264_RING_DATA_SIZE - off;
+            continue;
+        }
+        memcpy (rec, ring->data + off, sizeof (*rec));
+        if (!h264_ring_intact (ring, *pos))
+        {
+            *pos = v->head;
+            return -1;
+        }
+        if (H264_RECORD_PAD == rec->size)
+        {
+            *pos += H264_RING_DATA_SIZE - off;
+            continue;
+        }
+        if (buf_size < rec->size || H264_RING_DATA_SIZE < off + h264_record_len (rec->size))
+        {
+            *pos = v->head;
+            return -1;
+        }
+        memcpy (buf, ring->data + off + sizeof (*rec), rec->size);
+        if (!h264_ring_intact (ring, *pos))
+        {
+            *pos = v->head;
+            return -1;
+        }
+        *pos += h264_record_len (rec->size);
+        return (int)rec->size;
+    }
+}
+
+// Sleeps while ring->head_seq == seq, at most timeout_ns. Returns the current seq.
+static inline uint32_t h264_ring_wait (struct h264_ring *ring, uint32_t seq, long timeout_ns)
+{
+    struct timespec timeout;
+
+    if (0 < timeout_ns && seq == *(volatile uint32_t *)&ring->head_seq)
+    {
+        timeout.tv_sec = timeout_ns / 1000000000L;
+        timeout.tv_nsec = timeout_ns % 1000000000L;
+        syscall (SYS_futex, &ring->head_seq, FUTEX_WAIT, seq, &timeout, NULL, 0);
+    }
+    return *(volatile uint32_t *)&ring->head_seq;
+}
+
+// 1 while an imageProcess decodes the stream, display_stage need not publish
+static inline int h264_ring_has_reader (const struct h264_ring *ring)
+{
+    return NULL != ring && frame_shm_pid_alive (((const volatile struct h264_ring *)ring)->reader_pid);
+}
+
+#endif // _H264_RING_H_
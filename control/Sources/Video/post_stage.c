@@ -5,9 +5,11 @@
  */
 
 #include "post_stage.h"
+#include "pre_stage.h"
 
 #include <ardrone_tool/ardrone_version.h>
 #include <string.h>
+#include <time.h>
 #include <video_encapsulation.h>
 
 const vp_api_stage_funcs_t post_stage_funcs = {
@@ -20,10 +22,17 @@ const vp_api_stage_funcs_t post_stage_funcs = {
 
 C_RESULT post_stage_open (post_stage_cfg_t *cfg)
 {
-    cfg->outputFile = NULL;
+    cfg->recording = FALSE;
     if (NULL != cfg->outputName && 0 < strlen (cfg->outputName))
     {
-        cfg->outputFile = fopen (cfg->outputName, "wb");
+        if (0 == frame_record_open (&cfg->record, cfg->outputName, cfg->directIO, cfg->codec))
+        {
+            cfg->recording = TRUE;
+        }
+        else
+        {
+            fprintf (stderr, "Can not open %s for recording\n", cfg->outputName);
+        }
     }
     return C_OK;
 }
@@ -36,9 +45,20 @@ C_RESULT post_stage_transform (post_stage_cfg_t *cfg, vp_api_io_data_t *in, vp_a
     out->buffers = in->buffers;
     out->indexBuffer = in->indexBuffer;
     //
-    if (NULL != cfg->outputFile)
+    if (TRUE == cfg->recording)
     {
-        fwrite (in->buffers[in->indexBuffer], 1, in->size, cfg->outputFile);
+        frame_record_frame_header_t hdr;
+        struct timespec now;
+
+        vp_os_memset (&hdr, 0, sizeof (hdr));
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        hdr.frame_id = pre_stage_frame_info.frame_number;
+        hdr.timestamp = pre_stage_frame_info.timestamp;
+        hdr.pix_fmt = (3 == cfg->bpp) ? FRAME_PIX_RGB24 : FRAME_PIX_RGB565;
+        hdr.size = in->size;
+        hdr.capture_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+        frame_record_picture_size (in->size, cfg->bpp, &hdr.width, &hdr.height);
+        frame_record_write (&cfg->record, &hdr, in->buffers[in->indexBuffer]);
     }
 
     return C_OK;
@@ -46,10 +66,10 @@ C_RESULT post_stage_transform (post_stage_cfg_t *cfg, vp_api_io_data_t *in, vp_a
 
 C_RESULT post_stage_close (post_stage_cfg_t *cfg)
 {
-    if (NULL != cfg->outputFile)
+    if (TRUE == cfg->recording)
     {
-        fclose (cfg->outputFile);
-        cfg->outputFile = NULL;
+        frame_record_close (&cfg->record);
+        cfg->recording = FALSE;
     }
     return C_OK;
 }
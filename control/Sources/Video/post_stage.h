@@ -1,5 +1,6 @@
 /**
- * Post decoding stage that dump the raw decoded video
+ * Post decoding stage that records the decoded video
+ * Frames are stored in the indexed container described in frame_record.h
  */
 
 #ifndef _POST_STAGE_H_
@@ -8,12 +9,17 @@
 #include <stdio.h>
 #include <VP_Api/vp_api_stage.h>
 #include <VP_Api/vp_api.h>
+#include <Video/frame_record.h>
 
 typedef struct _post_stage_cfg_ {
     // PARAM
     char outputName[256];
+    uint32_t bpp;
+    int directIO;
+    int codec;             // frame_codec_t, compression runs on a background thread
     // INTERNAL
-    FILE *outputFile;
+    frame_record_writer_t record;
+    bool_t recording;
 } post_stage_cfg_t;
 
 C_RESULT post_stage_open (post_stage_cfg_t *cfg);
@@ -8,7 +8,9 @@
 
 #include <ardrone_tool/ardrone_version.h>
 #include <string.h>
+#include <pthread.h>
 #include <video_encapsulation.h>
+#include <Video/h264_ring.h>
 
 const vp_api_stage_funcs_t pre_stage_funcs = {
     NULL,
@@ -17,6 +19,13 @@ const vp_api_stage_funcs_t pre_stage_funcs = {
     (vp_api_stage_close_t) pre_stage_close
 };
 
+pre_stage_frame_info_t pre_stage_frame_info = {0, 0};
+
+static struct h264_ring *ring = NULL;
+static int ring_shmid = -1;
+// the video thread owns the ring, the GTK thread reads it in pre_stage_stream_decoded
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
 bool_t hasPaVE (uint8_t *buffer)
 {
     bool_t retVal = FALSE;
@@ -30,14 +39,51 @@ bool_t hasPaVE (uint8_t *buffer)
 
 C_RESULT pre_stage_open (pre_stage_cfg_t *cfg)
 {
-    cfg->outputFile = NULL;
+    cfg->recording = FALSE;
     if (NULL != cfg->outputName && 0 < strlen (cfg->outputName))
     {
-        cfg->outputFile = fopen (cfg->outputName, "wb");
+        if (0 == async_writer_open (&cfg->writer, cfg->outputName, ASYNC_WRITER_BLOCK_SIZE, ASYNC_WRITER_BLOCK_COUNT, cfg->directIO))
+        {
+            cfg->recording = TRUE;
+        }
+        else
+        {
+            fprintf (stderr, "Can not open %s for recording\n", cfg->outputName);
+        }
+    }
+    // the ring goes on from the last frame of a previous control process
+    ring = h264_ring_attach (drone_key (H264_RING_KEY, cfg->droneId), &ring_shmid);
+    if (NULL == ring)
+    {
+        fprintf (stderr, "Can not attach the encoded frame ring, imageProcess --decode gets nothing\n");
+    }
+    else
+    {
+        ring->writer_pid = getpid ();
     }
     return C_OK;
 }
 
+// Only H.264 (AR.Drone 2) goes to the ring, imageProcess has no decoder for the others
+static void publish_encoded (parrot_video_encapsulation_t *PaVE, uint8_t *videoData)
+{
+    struct h264_record rec;
+
+    if (NULL == ring || CODEC_MPEG4_AVC != PaVE->video_codec)
+    {
+        return;
+    }
+    vp_os_memset (&rec, 0, sizeof (rec));
+    rec.size = PaVE->payload_size;
+    rec.flags = (FRAME_TYPE_IDR_FRAME == PaVE->frame_type) ? H264_RECORD_IDR : 0;
+    rec.frame_number = PaVE->frame_number;
+    rec.width = PaVE->display_width;
+    rec.height = PaVE->display_height;
+    rec.stamp_ns = frame_shm_now_ns ();
+    // never blocks, an oversized access unit is left out and the reader waits for the next IDR frame
+    h264_ring_write (ring, &rec, videoData);
+}
+
 C_RESULT pre_stage_transform (pre_stage_cfg_t *cfg, vp_api_io_data_t *in, vp_api_io_data_t *out)
 {
     // Copy in to out
@@ -46,30 +92,69 @@ C_RESULT pre_stage_transform (pre_stage_cfg_t *cfg, vp_api_io_data_t *in, vp_api
     out->buffers = in->buffers;
     out->indexBuffer = in->indexBuffer;
     //
-    if (NULL != cfg->outputFile)
+    if (hasPaVE (in->buffers[in->indexBuffer])) // AR.Drone 2
+    {
+        parrot_video_encapsulation_t *PaVE = (parrot_video_encapsulation_t *)in->buffers[in->indexBuffer];
+        pre_stage_frame_info.frame_number = PaVE->frame_number;
+        pre_stage_frame_info.timestamp = PaVE->timestamp;
+        publish_encoded (PaVE, &(in->buffers[in->indexBuffer][PaVE->header_size]));
+    }
+    else // AR.Drone 1
     {
+        pre_stage_frame_info.frame_number++;
+        pre_stage_frame_info.timestamp = 0;
+    }
+    if (TRUE == cfg->recording)
+    {
+        // Never blocks, a frame that does not fit in the writer pool is dropped and counted
+        struct iovec iov;
         if (hasPaVE (in->buffers[in->indexBuffer])) // AR.Drone 2
         {
             parrot_video_encapsulation_t *PaVE = (parrot_video_encapsulation_t *)in->buffers[in->indexBuffer];
             uint8_t *videoData = &(in->buffers[in->indexBuffer][PaVE->header_size]);
             uint32_t videoSize = PaVE->payload_size;
-            fwrite (videoData, 1, videoSize, cfg->outputFile);
+            iov.iov_base = videoData;
+            iov.iov_len = videoSize;
         }
         else // AR.Drone 1
         {
-            fwrite (in->buffers[in->indexBuffer], 1, in->size, cfg->outputFile);
+            iov.iov_base = in->buffers[in->indexBuffer];
+            iov.iov_len = in->size;
         }
+        async_writer_write (&cfg->writer, &iov, 1, 0);
     }
 
     return C_OK;
 }
 
+// Leaves the encoded frame ring
+static void pre_stage_detach (void)
+{
+    pthread_mutex_lock (&ring_lock);
+    if (NULL != ring)
+    {
+        ring->writer_pid = 0;
+        frame_shm_release (ring, ring_shmid);
+        ring = NULL;
+    }
+    pthread_mutex_unlock (&ring_lock);
+}
+
 C_RESULT pre_stage_close (pre_stage_cfg_t *cfg)
 {
-    if (NULL != cfg->outputFile)
+    if (TRUE == cfg->recording)
     {
-        fclose (cfg->outputFile);
-        cfg->outputFile = NULL;
+        async_writer_close (&cfg->writer, NULL, 0);
+        cfg->recording = FALSE;
     }
+    pre_stage_detach ();
     return C_OK;
 }
+
+bool_t pre_stage_stream_decoded (void)
+{
+    pthread_mutex_lock (&ring_lock);
+    bool_t decoded = h264_ring_has_reader (ring) ? TRUE : FALSE;
+    pthread_mutex_unlock (&ring_lock);
+    return decoded;
+}
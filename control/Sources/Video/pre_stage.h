@@ -1,5 +1,6 @@
 /**
  * Pre decoding stage that dump the raw encoded Drone 2 video
+ * and publish it to imageProcess --decode (Video/h264_ring.h)
  * Don't do anything on AR.Drone 1
  */
 
@@ -9,17 +10,32 @@
 #include <stdio.h>
 #include <VP_Api/vp_api_stage.h>
 #include <VP_Api/vp_api.h>
+#include <Video/async_writer.h>
 
 typedef struct _pre_stage_cfg_ {
     // PARAM
     char outputName[256];
+    int directIO;
+    int droneId;                // ring of this drone, see drone_key
     // INTERNAL
-    FILE *outputFile;
+    async_writer_t writer;
+    bool_t recording;
 } pre_stage_cfg_t;
 
+// PaVE header fields of the frame going through the pipeline
+// Set by pre_stage_transform and read by the post stages of the same video thread
+typedef struct _pre_stage_frame_info_ {
+    uint32_t frame_number;
+    uint32_t timestamp;
+} pre_stage_frame_info_t;
+
+extern pre_stage_frame_info_t pre_stage_frame_info;
+
 C_RESULT pre_stage_open (pre_stage_cfg_t *cfg);
 C_RESULT pre_stage_transform (pre_stage_cfg_t *cfg, vp_api_io_data_t *in, vp_api_io_data_t *out);
 C_RESULT pre_stage_close (pre_stage_cfg_t *cfg);
+// TRUE while an imageProcess decodes the ring itself, the decoded frame need not be published
+bool_t pre_stage_stream_decoded (void);
 
 extern const vp_api_stage_funcs_t pre_stage_funcs;
 
@@ -0,0 +1,121 @@
+/**
+ * @file trace_ring.c
+ *
+ * Binary trace of the pipeline stages, see trace_ring.h
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "trace_ring.h"
+
+const char *trace_event_names[TRACE_EVENT_COUNT] = {
+    "frame decoded",
+    "publish",
+    "publish wait",
+    "copy",
+    "copy wait",
+    "convert",
+    "track",
+    "result",
+    "control wait",
+    "control step",
+    "stale result",
+};
+
+#ifdef TRACE_ENABLED
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/syscall.h>
+
+static struct trace_segment *segment = NULL;
+static __thread struct trace_thread_ring *ring = NULL;
+static __thread int ring_full = 0;
+
+int trace_init (key_t key)
+{
+    int shmid = shmget (key, sizeof (struct trace_segment), 0666 | IPC_CREAT);
+    void *shm;
+    if (-1 == shmid)
+    {
+        fprintf (stderr, "shmget failed for the trace segment\n");
+        return -1;
+    }
+    shm = shmat (shmid, 0, 0);
+    if ((void *)-1 == shm)
+    {
+        fprintf (stderr, "shmat failed for the trace segment\n");
+        return -1;
+    }
+    memset (shm, 0, sizeof (struct trace_segment));
+    ((struct trace_segment *)shm)->pid = getpid ();
+    __atomic_store_n (&((struct trace_segment *)shm)->magic, TRACE_MAGIC, __ATOMIC_RELEASE);
+    segment = (struct trace_segment *)shm;
+    return 0;
+}
+
+static struct trace_thread_ring *claim_ring (const char *name)
+{
+    uint32_t index;
+    struct trace_thread_ring *r;
+
+    if (NULL == segment)
+    {
+        return NULL;
+    }
+    index = __atomic_fetch_add (&segment->threads, 1, __ATOMIC_ACQ_REL);
+    if (TRACE_MAX_THREADS <= index)
+    {
+        return NULL;
+    }
+    r = &segment->rings[index];
+    r->tid = (int32_t)syscall (SYS_gettid);
+    strncpy (r->name, name, sizeof (r->name) - 1);
+    return r;
+}
+
+void trace_thread (const char *name)
+{
+    if (NULL == ring && !ring_full)
+    {
+        ring = claim_ring (name);
+        ring_full = (NULL == ring);
+    }
+}
+
+void trace_record (int event, int phase, uint32_t arg)
+{
+    struct trace_record *rec;
+    struct timespec now;
+    uint64_t head;
+
+    if (NULL == ring)
+    {
+        if (ring_full || NULL == segment)
+        {
+            return;
+        }
+        trace_thread ("thread");
+        if (NULL == ring)
+        {
+            return;
+        }
+    }
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    head = ring->head;
+    rec = &ring->records[head & (TRACE_RING_SIZE - 1)];
+    rec->stamp_ns = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+    rec->event = (uint16_t)event;
+    rec->phase = (uint8_t)phase;
+    rec->arg = arg;
+    // Publish the record, the reader never looks past head
+    __atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#endif // TRACE_ENABLED
@@ -0,0 +1,109 @@
+/**
+ * Binary trace of the pipeline stages
+ *
+ * Every thread that records events owns a ring of fixed size events in its
+ * process trace segment (TRACE_KEY_CONTROL, TRACE_KEY_IMAGE). A ring has a
+ * single writer, recording an event is a few stores and no lock, the oldest
+ * events are overwritten. imageProcess/trace_export reads the segments of
+ * both processes and merges them into one Chrome / Perfetto trace, the
+ * stamps are CLOCK_MONOTONIC in both processes.
+ *
+ * Tracing is compiled in with TRACE_ENABLED only, without it the TRACE_*
+ * macros expand to nothing and this module is empty.
+ *
+ * This file is shared with the imageProcess tools and must stay SDK independent.
+ */
+
+#ifndef _TRACE_RING_H_
+#define _TRACE_RING_H_ (1)
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static const key_t TRACE_KEY_CONTROL = 2018;
+static const key_t TRACE_KEY_IMAGE = 2019;
+
+#define TRACE_MAGIC (0x54524331)    // "TRC1"
+#define TRACE_MAX_THREADS (16)
+#define TRACE_RING_SIZE (8192)      // events per thread, power of two
+
+// Stages, the names are in trace_event_names
+typedef enum _trace_event_ {
+    TRACE_FRAME_DECODED = 0,        // instant, arg : frame size
+    TRACE_PUBLISH,                  // frame copy to the shared memory, arg : frame_id
+    TRACE_PUBLISH_WAIT,
+    TRACE_COPY,                     // frame copy out of the shared memory, arg : frame_id
+    TRACE_COPY_WAIT,
+    TRACE_CONVERT,
+    TRACE_TRACK,                    // arg : frame_id
+    TRACE_RESULT,                   // result written back, arg : frame_id
+    TRACE_CONTROL_WAIT,             // control thread waiting for a result or a tick
+    TRACE_CONTROL_STEP,
+    TRACE_STALE,                    // instant, no recent result
+    TRACE_EVENT_COUNT
+} trace_event_t;
+
+typedef enum _trace_phase_ {
+    TRACE_PHASE_BEGIN = 'B',
+    TRACE_PHASE_END = 'E',
+    TRACE_PHASE_INSTANT = 'i',
+} trace_phase_t;
+
+struct trace_record {
+    int64_t stamp_ns;
+    uint16_t event;
+    uint8_t phase;
+    uint8_t pad;
+    uint32_t arg;
+};
+
+struct trace_thread_ring {
+    int32_t tid;
+    char name[28];
+    uint64_t head;                  // records written, the next one goes to head % TRACE_RING_SIZE
+    struct trace_record records[TRACE_RING_SIZE];
+};
+
+struct trace_segment {
+    uint32_t magic;
+    int32_t pid;
+    uint32_t threads;               // rings in use
+    uint32_t pad;
+    struct trace_thread_ring rings[TRACE_MAX_THREADS];
+};
+
+extern const char *trace_event_names[TRACE_EVENT_COUNT];
+
+#ifdef TRACE_ENABLED
+
+// Creates and clears the segment of this process
+int trace_init (key_t key);
+// Names the ring of the calling thread, threads that don't call it get "thread"
+void trace_thread (const char *name);
+void trace_record (int event, int phase, uint32_t arg);
+
+#define TRACE_INIT(key) trace_init (key)
+#define TRACE_THREAD(name) trace_thread (name)
+#define TRACE_BEGIN(event, arg) trace_record ((event), TRACE_PHASE_BEGIN, (uint32_t)(arg))
+#define TRACE_END(event) trace_record ((event), TRACE_PHASE_END, 0)
+#define TRACE_INSTANT(event, arg) trace_record ((event), TRACE_PHASE_INSTANT, (uint32_t)(arg))
+
+#else
+
+#define TRACE_INIT(key) ((void)0)
+#define TRACE_THREAD(name) ((void)0)
+#define TRACE_BEGIN(event, arg) ((void)0)
+#define TRACE_END(event) ((void)0)
+#define TRACE_INSTANT(event, arg) ((void)0)
+
+#endif // TRACE_ENABLED
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TRACE_RING_H_
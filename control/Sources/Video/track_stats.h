@@ -0,0 +1,115 @@
+/**
+ * Shared memory statistics page of the tracking pipeline
+ *
+ * Both processes keep their counters and stage timers in the STATS_KEY
+ * segment, each in its own section, which it clears when it starts. Every
+ * field has a single writer and is updated with plain relaxed stores, no
+ * lock and no atomic read-modify-write on the hot path. Readers such as
+ * imageProcess/trackstat take periodic snapshots and work with the
+ * differences between them, a torn read only skews one sample.
+ *
+ * This file is shared with the imageProcess tools and must stay SDK independent.
+ */
+
+#ifndef _TRACK_STATS_H_
+#define _TRACK_STATS_H_ (1)
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+static const key_t STATS_KEY = 2017;
+#define TRACK_STATS_VERSION (2)
+
+struct stat_timer {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;        // since the process started
+};
+
+// Written by the control process
+struct control_stats {
+    int32_t pid;
+    uint32_t pad;
+    uint64_t frames_received;   // decoded frames reaching display_stage
+    uint64_t frames_published;  // copied to the shared memory
+    uint64_t commands_sent;     // progressive commands from auto_control
+    uint64_t results_stale;     // ticks without a recent enough result
+    struct stat_timer publish_wait;     // waiting for SEM_KEY
+    struct stat_timer publish;          // frame copy to the shared memory
+    struct stat_timer result_wait;      // waiting for SEM_KEY3
+    struct stat_timer control_step;     // result read to command sent
+};
+
+// Written by imageProcess
+struct image_stats {
+    int32_t pid;
+    uint32_t pad;
+    uint64_t frames_copied;     // taken from the shared memory
+    uint64_t frames_processed;  // tracked
+    uint64_t frames_dropped;    // published but overwritten before the copy
+    uint64_t results;           // written back to ERR_KEY
+    uint64_t camshift_iterations;
+    struct stat_timer copy_wait;        // waiting for SEM_KEY
+    struct stat_timer copy;             // frame copy out of the shared memory
+    struct stat_timer convert;          // RGB565 to BGR
+    struct stat_timer track;            // tracker_process
+    struct stat_timer result_wait;      // waiting for SEM_KEY3
+    uint64_t scale_switches;    // changes of the processing scale (scale_governor.h)
+    uint32_t scale;             // processing scale divisor of the next frame, 1, 2 or 4
+    uint32_t budget_us;         // track time budget of the governor, 0 while unknown
+};
+
+struct track_stats {
+    uint32_t version;
+    uint32_t pad;
+    struct control_stats control;
+    struct image_stats image;
+};
+
+// Maps the page of key (drone_key (STATS_KEY, drone)), creating it if needed. NULL on failure.
+static inline struct track_stats *track_stats_attach (key_t key, int readonly)
+{
+    int shmid = shmget (key, sizeof (struct track_stats), readonly ? 0444 : (0666 | IPC_CREAT));
+    void *shm;
+    if (-1 == shmid)
+    {
+        return NULL;
+    }
+    shm = shmat (shmid, 0, readonly ? SHM_RDONLY : 0);
+    if ((void *)-1 == shm)
+    {
+        return NULL;
+    }
+    if (!readonly)
+    {
+        ((struct track_stats *)shm)->version = TRACK_STATS_VERSION;
+    }
+    return (struct track_stats *)shm;
+}
+
+// Single writer per field : no read-modify-write atomic needed
+static inline void stat_add (uint64_t *counter, uint64_t value)
+{
+    __atomic_store_n (counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static inline void stat_timer_add (struct stat_timer *timer, int64_t ns)
+{
+    if (ns < 0)
+    {
+        ns = 0;
+    }
+    __atomic_store_n (&timer->total_ns, timer->total_ns + (uint64_t)ns, __ATOMIC_RELAXED);
+    if ((uint64_t)ns > timer->max_ns)
+    {
+        __atomic_store_n (&timer->max_ns, (uint64_t)ns, __ATOMIC_RELAXED);
+    }
+    // count last, a reader never sees a count without its time
+    __atomic_store_n (&timer->count, timer->count + 1, __ATOMIC_RELEASE);
+}
+
+#endif // _TRACK_STATS_H_
@@ -19,6 +19,37 @@
  *         NOTE : if -eNAME arg is not present, encoded video will not be recorded
  *         NOTE : This is NOT the equivalent of the official record function for AR.Drone2 !
  *
+ *  -rFileName : Record decoded video to FileName
+ *               - Frames are stored with their size, PaVE frame number and timestamp
+ *               in the indexed container of Video/frame_record.h (see imageProcess/replay)
+ *         NOTE : if -rNAME arg is not present, decoded video will not be recorded
+ *
+ *  -z : compress the -r recording (LZ4 on the difference with the previous frame)
+ *       Frames are compressed by a background thread, imageProcess/replay decodes them
+ *
+ *  -d : write the -e / -r recordings with O_DIRECT (bypass the page cache)
+ *       Recordings are always written by a background thread, the video thread never waits for the disk
+ *
+ *  -fN : run the tracking controller at N Hz (default 30)
+ *        - the controller also wakes up as soon as imageProcess publishes a new result
+ *
+ *  -aN : act on tracking results at most N ms old (default 150)
+ *        - results are extrapolated to the control tick, older ones make the drone hover
+ *
+ *  -pFileName : read the tracking PID gains and limits from FileName (see Control/tracking_pid.h)
+ *              - the file is re-read whenever it changes, the controller can be tuned in flight
+ *
+ *  -tFileName : real-time profile, cores and SCHED_FIFO priorities of the video_stage,
+ *               shm_publisher and auto_control threads, mlockall (see Control/rt_profile.h)
+ *               - the wake-up jitter of the control tick is printed on exit
+ *
+ *  -nID : drone ID, the shared memory channels (frames, results, navdata, statistics,
+ *        trace) of each drone are separate, one imageProcess can serve several drones
+ *        - default 0, the historical keys
+ *
+ *  -iIP : connect to IP instead of the drone address (192.168.1.1)
+ *        - e.g. a local stand-in such as imageProcess/drone_sim
+ *
  *  -b : use bottom camera instead of frontal camera
  *
  *  -c : use alternative video codec
@@ -33,6 +64,7 @@
 // Generic includes
 #include <ardrone_api.h>
 #include <signal.h>
+#include <unistd.h>
 
 // ARDrone Tool includes
 #include <ardrone_tool/ardrone_tool.h>
@@ -44,7 +76,14 @@
 
 // App includes
 #include <Video/pre_stage.h>
+#include <Video/post_stage.h>
 #include <Video/display_stage.h>
+#include <Control/tracking_pid.h>
+#include <Control/tracking_predict.h>
+#include <Navdata/navdata.h>
+#include <Control/rt_profile.h>
+#include <Video/track_stats.h>
+#include <Video/trace_ring.h>
 
 // GTK includes
 #include <gtk/gtk.h>
@@ -56,6 +95,7 @@
 int exit_program = 1;
 
 pre_stage_cfg_t precfg;
+post_stage_cfg_t postcfg;
 display_stage_cfg_t dispCfg;
 
 codec_type_t drone1Codec = P264_CODEC;
@@ -64,21 +104,28 @@ ZAP_VIDEO_CHANNEL videoChannel = ZAP_CHANNEL_HORI;
 
 #define FILENAMESIZE (256)
 char encodedFileName[FILENAMESIZE] = {0};
+char decodedFileName[FILENAMESIZE] = {0};
+int directIO = 0;
+int decodedCodec = FRAME_CODEC_RAW;
+int controlRateHz = 30;
+char pidFileName[FILENAMESIZE] = {0};
+int maxResultAgeMs = 150;
+rt_profile_t rtProfile;
+rt_jitter_t controlJitter;
+struct track_stats *trackStats = NULL;
+int droneId = 0;
 
 void controlCHandler (int signal)
 {
-    // Flush all streams before terminating
-    // delete shared memory and semaphore
-    del_share_memory(info_shm, info_shmid);
-    del_share_memory(data_shm, data_shmid);
-    del_share_memory(err_shm, err_shmid);
-    del_semaphore(sem_id);
-    // Flush all streams before terminating
-    fflush (NULL);
-    usleep (200000); // Wait 200 msec to be sure that flush occured
-    printf ("\nAll files were flushed\n");
-    endwin();
-    exit (0);
+    // Only ask ardrone_tool to stop : the video thread then closes its stages,
+    // which drains the recordings and writes their index, and the shared
+    // memory is left once the threads using it are stopped (see
+    // ardrone_tool_shutdown_custom). A second Ctrl-C doesn't wait.
+    if (0 == exit_program)
+    {
+        _exit (1);
+    }
+    exit_program = 0;
 }
 
 /**
@@ -86,7 +133,6 @@ void controlCHandler (int signal)
  */
 int main (int argc, char *argv[])
 {
-    signal (SIGABRT, &controlCHandler);
     signal (SIGTERM, &controlCHandler);
     signal (SIGINT, &controlCHandler);
     int prevargc = argc;
@@ -103,6 +149,26 @@ int main (int argc, char *argv[])
             strncpy (encodedFileName, name, FILENAMESIZE);
         }
 
+        if ('-' == argv[index][0] &&
+            'r' == argv[index][1])
+        {
+            char *fullname = argv[index];
+            char *name = &fullname[2];
+            strncpy (decodedFileName, name, FILENAMESIZE);
+        }
+
+        if ('-' == argv[index][0] &&
+            'z' == argv[index][1])
+        {
+            decodedCodec = FRAME_CODEC_LZ4_DELTA;
+        }
+
+        if ('-' == argv[index][0] &&
+            'd' == argv[index][1])
+        {
+            directIO = 1;
+        }
+
         if ('-' == argv[index][0] &&
             'c' == argv[index][1])
         {
@@ -110,6 +176,61 @@ int main (int argc, char *argv[])
             drone2Codec = H264_720P_CODEC;
         }
 
+        if ('-' == argv[index][0] &&
+            'f' == argv[index][1])
+        {
+            controlRateHz = atoi (&argv[index][2]);
+            if (0 >= controlRateHz)
+            {
+                controlRateHz = 30;
+            }
+        }
+
+        if ('-' == argv[index][0] &&
+            'a' == argv[index][1])
+        {
+            maxResultAgeMs = atoi (&argv[index][2]);
+            if (0 >= maxResultAgeMs)
+            {
+                maxResultAgeMs = 150;
+            }
+        }
+
+        if ('-' == argv[index][0] &&
+            'p' == argv[index][1])
+        {
+            strncpy (pidFileName, &argv[index][2], FILENAMESIZE - 1);
+        }
+
+        if ('-' == argv[index][0] &&
+            't' == argv[index][1])
+        {
+            if (0 != rt_profile_load (&rtProfile, &argv[index][2]))
+            {
+                fprintf (stderr, "Can't read real-time profile %s\n", &argv[index][2]);
+                return -1;
+            }
+        }
+
+        if ('-' == argv[index][0] &&
+            'n' == argv[index][1])
+        {
+            droneId = atoi (&argv[index][2]);
+            if (0 > droneId || MAX_DRONES <= droneId)
+            {
+                fprintf (stderr, "Drone ID must be between 0 and %d\n", MAX_DRONES - 1);
+                return -1;
+            }
+        }
+
+        if ('-' == argv[index][0] &&
+            'i' == argv[index][1] &&
+            '\0' != argv[index][2])
+        {
+            // Dotted IPv4 address, at most 15 characters
+            strncpy (wifi_ardrone_ip, &argv[index][2], 15);
+        }
+
         if ('-' == argv[index][0] &&
             'b' == argv[index][1])
         {
@@ -150,7 +271,7 @@ C_RESULT ardrone_tool_init_custom (void)
      * Define the number of video stages we'll add before/after decoding
      */
 #define EXAMPLE_PRE_STAGES 1
-#define EXAMPLE_POST_STAGES 1
+#define EXAMPLE_POST_STAGES 2
 
     /**
      * Allocate useful structures :
@@ -235,6 +356,8 @@ C_RESULT ardrone_tool_init_custom (void)
 
     vp_os_memset (&precfg, 0, sizeof (pre_stage_cfg_t));
     strncpy (precfg.outputName, encodedFileName, 255);
+    precfg.directIO = directIO;
+    precfg.droneId = droneId;
 
     example_pre_stages->stages_list[stages_index].name = "Encoded Dumper"; // Debug info
     example_pre_stages->stages_list[stages_index].type = VP_API_FILTER_DECODER; // Debug info
@@ -251,9 +374,22 @@ C_RESULT ardrone_tool_init_custom (void)
      */
     stages_index = 0;
 
+    vp_os_memset (&postcfg, 0, sizeof (post_stage_cfg_t));
+    strncpy (postcfg.outputName, decodedFileName, 255);
+    postcfg.bpp = bpp;
+    postcfg.directIO = directIO;
+    postcfg.codec = decodedCodec;
+
+    example_post_stages->stages_list[stages_index].name = "Decoded Dumper"; // Debug info
+    example_post_stages->stages_list[stages_index].type = VP_API_FILTER_DECODER; // Debug info
+    example_post_stages->stages_list[stages_index].cfg  = &postcfg;
+    example_post_stages->stages_list[stages_index++].funcs  = post_stage_funcs;
+
     vp_os_memset (&dispCfg, 0, sizeof (display_stage_cfg_t));
     dispCfg.bpp = bpp;
     dispCfg.decoder_info = in_picture;
+    dispCfg.rt = &rtProfile;
+    dispCfg.droneId = droneId;
 
     example_post_stages->stages_list[stages_index].name = "Decoded display"; // Debug info
     example_post_stages->stages_list[stages_index].type = VP_API_OUTPUT_SDL; // Debug info
@@ -277,6 +413,21 @@ C_RESULT ardrone_tool_init_custom (void)
     params->needSetPriority = 0;
     params->priority = 0;
 
+    // Trace rings read by imageProcess/trace_export, when built with TRACE_ENABLED
+    TRACE_INIT (drone_key (TRACE_KEY_CONTROL, droneId));
+
+    // Counters read by imageProcess/trackstat, the control section is ours
+    trackStats = track_stats_attach (drone_key (STATS_KEY, droneId), 0);
+    if (NULL != trackStats)
+    {
+        vp_os_memset (&trackStats->control, 0, sizeof (trackStats->control));
+        trackStats->control.pid = getpid ();
+    }
+
+    // Lock the buffers allocated so far and everything allocated later
+    rt_jitter_init (&controlJitter, "control tick wake-up", 1 << 16);
+    rt_profile_lock_memory (&rtProfile);
+
     /**
      * Start the video thread (and the video recorder thread for AR.Drone 2)
      */
@@ -299,6 +450,7 @@ C_RESULT ardrone_tool_init_custom (void)
 C_RESULT ardrone_tool_shutdown_custom ()
 {
     video_stage_resume_thread(); //Resume thread to kill it !
+    // The stages are closed when it returns : recordings complete, H.264 ring left
     JOIN_THREAD(video_stage);
     if (2 <= ARDRONE_VERSION ())
     {
@@ -308,7 +460,14 @@ C_RESULT ardrone_tool_shutdown_custom ()
 
     //JOIN_THREAD(keyboard_control); //write  by custom
     JOIN_THREAD(auto_control);
-    JOIN_THREAD(control_switch);
+    // kept for imageProcess if it is still running
+    display_stage_detach ();
+    // control_switch stays in gtk_main until the process exits, not joined.
+    // The navdata shared memory is released by the navdata handler table.
+    rt_jitter_report (&controlJitter, rtProfile.loaded ? "profile" : "default", stdout);
+    fflush (NULL);
+    printf ("\nAll files were flushed\n");
+    endwin();
     return C_OK;
 }
 
@@ -338,6 +497,29 @@ bool_t ardrone_tool_exit ()
 const float alpha = 0.3;
 const float beta = 0.7;
 static volatile int tracking = 0;
+static pthread_mutex_t tracking_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tracking_changed = PTHREAD_COND_INITIALIZER;
+
+// auto_control sleeps on tracking_changed while tracking is off
+void set_tracking(int on) {
+    pthread_mutex_lock(&tracking_lock);
+    tracking = on;
+    pthread_cond_broadcast(&tracking_changed);
+    pthread_mutex_unlock(&tracking_lock);
+}
+
+static void timespec_add_ns(struct timespec *t, long ns) {
+    t->tv_sec += ns / 1000000000L;
+    t->tv_nsec += ns % 1000000000L;
+    if (t->tv_nsec >= 1000000000L) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000L;
+    }
+}
+
+static long timespec_diff_ns(const struct timespec *a, const struct timespec *b) {
+    return (a->tv_sec - b->tv_sec) * 1000000000L + (a->tv_nsec - b->tv_nsec);
+}
 
 PROTO_THREAD_ROUTINE(keyboard_control, NO_PARAM); //
 PROTO_THREAD_ROUTINE(auto_control, NO_PARAM);
@@ -353,20 +535,20 @@ void takeOff(GtkWidget *widget, gpointer *data)
 void land(GtkWidget *widget, gpointer *data)
 {
     int t = 0;
-    tracking = 0;
+    set_tracking(0);
     ardrone_tool_set_ui_pad_start(0);
     printf("land\n");
 }
 
 void tracking_func(GtkWidget *widget, gpointer *data)
 {
-    tracking = 1;
+    set_tracking(1);
     printf("tracking\n");
 }
 
 void stopTracking(GtkWidget *widget, gpointer *data)
 {
-    tracking = 0;
+    set_tracking(0);
     printf("stop_tracking\n");
 }
 
@@ -439,25 +621,116 @@ DEFINE_THREAD_ROUTINE(control_switch, NO_PARAM) {
 }
 
 DEFINE_THREAD_ROUTINE(auto_control, NO_PARAM) {
-    while (true) {
+    const long period = 1000000000L / controlRateHz;
+    // err_info is attached by the video thread, don't touch it before tracking starts
+    uint32_t seq = 0;
+    struct timespec now, next, last_step, last_reload;
+    tracking_pid_t pid;
+    tracking_predict_t pred;
+    float err[PID_AXES], cmd[PID_AXES];
+    int64_t stamp_ns;
+    int stale = 1;
+
+    tracking_pid_init(&pid);
+    strncpy(pid.configName, pidFileName, sizeof(pid.configName) - 1);
+    if (tracking_pid_reload(&pid) < 0)
+        fprintf(stderr, "Can't read PID config %s, using the defaults\n", pid.configName);
+    tracking_predict_init(&pred, maxResultAgeMs * 1000000LL);
+    rt_profile_apply(&rtProfile, "auto_control");
+    TRACE_THREAD("auto_control");
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    last_reload = next;
+    while (exit_program) {
+        // Sleep while tracking is off, wake up every 100 ms to notice the exit
+        pthread_mutex_lock(&tracking_lock);
         if (!tracking) {
-            continue;
+            while (!tracking && exit_program) {
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                timespec_add_ns(&deadline, 100000000L);
+                pthread_cond_timedwait(&tracking_changed, &tracking_lock, &deadline);
+            }
+            // Fresh start, no integral or derivative from the previous run
+            tracking_pid_reset(&pid);
+            tracking_predict_reset(&pred);
+            clock_gettime(CLOCK_MONOTONIC, &last_step);
+        }
+        pthread_mutex_unlock(&tracking_lock);
+        if (!exit_program)
+            break;
+
+        // Block until imageProcess publishes a new result or the next tick is due
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        TRACE_BEGIN(TRACE_CONTROL_WAIT, 0);
+        seq = area_err_wait(err_info, seq, timespec_diff_ns(&next, &now));
+        TRACE_END(TRACE_CONTROL_WAIT);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long late = timespec_diff_ns(&now, &next);
+        if (late >= 0) {
+            timespec_add_ns(&next, period);
+            // More than a tick late (tracking was off), restart from now
+            if (timespec_diff_ns(&now, &next) >= 0) {
+                next = now;
+                timespec_add_ns(&next, period);
+            } else {
+                rt_jitter_add(&controlJitter, late);
+            }
         }
+        // Pick up gain changes once a second
+        if (timespec_diff_ns(&now, &last_reload) >= 1000000000L) {
+            tracking_pid_reload(&pid);
+            last_reload = now;
+        }
+
+        int64_t wait_start = frame_shm_now_ns();
+        TRACE_BEGIN(TRACE_CONTROL_STEP, seq);
         if (!semaphore_P(sem_id3))
             exit(EXIT_FAILURE);
-        float x_err = err_info->x_err;
-        float y_err = -err_info->y_err;
-        float z_err = -err_info->z_err;
+        int64_t step_start = frame_shm_now_ns();
+        // x_err is corrected by yaw alone, no lateral error is measured for roll
+        err[PID_ROLL] = 0;
+        err[PID_YAW] = err_info->x_err;
+        err[PID_GAZ] = -err_info->y_err;
+        err[PID_PITCH] = -err_info->z_err;
+        stamp_ns = err_info->stamp_ns;
         if (!semaphore_V(sem_id3))
             exit(EXIT_FAILURE);
-        if (x_err > 0.18) free_flight(3,0,0,0,x_err);
-        else if (z_err > 0.25) free_flight(3, 0, z_err, 0, 0);
-        else {
-            free_flight(3,0,0,0,x_err);
-            free_flight(3,0,0,y_err,0);
-            free_flight(3, 0, z_err, 0, 0);
+        tracking_predict_add(&pred, stamp_ns, err);
+        if (trackStats)
+            stat_timer_add(&trackStats->control.result_wait, step_start - wait_start);
+
+        // Errors as they should be now, not when the frame was captured
+        if (tracking_predict_at(&pred, (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec, err) < 0) {
+            // No recent result, don't correct from stale data
+            if (!stale)
+                printf("tracking result too old, hovering\n");
+            stale = 1;
+            tracking_pid_reset(&pid);
+            ardrone_at_set_progress_cmd(0, 0, 0, 0, 0);
+            last_step = now;
+            if (trackStats) {
+                stat_add(&trackStats->control.results_stale, 1);
+                stat_add(&trackStats->control.commands_sent, 1);
+            }
+            TRACE_INSTANT(TRACE_STALE, 0);
+            TRACE_END(TRACE_CONTROL_STEP);
+            continue;
+        }
+        stale = 0;
+
+        tracking_pid_update(&pid, err, timespec_diff_ns(&now, &last_step) * 1e-9f, cmd);
+        last_step = now;
+        // All the axes in a single progressive command, hover if tracking just stopped
+        if (tracking)
+            ardrone_at_set_progress_cmd(3, cmd[PID_ROLL], cmd[PID_PITCH], cmd[PID_GAZ], cmd[PID_YAW]);
+        else
+            ardrone_at_set_progress_cmd(0, 0, 0, 0, 0);
+        if (trackStats) {
+            stat_add(&trackStats->control.commands_sent, 1);
+            stat_timer_add(&trackStats->control.control_step, frame_shm_now_ns() - step_start);
         }
-        //free_flight(3, 0, z_err, y_err, x_err);
+        TRACE_END(TRACE_CONTROL_STEP);
     }
     return (THREAD_RET)0;
 }
@@ -491,7 +764,7 @@ DEFINE_THREAD_ROUTINE(keyboard_control, NO_PARAM) { //
                 case 'r':
                     printw("land");
                     int t = 0;
-                    tracking = 0;
+                    set_tracking(0);
                     for (; t < 100; t++) ardrone_tool_set_ui_pad_start(0);
                     take_off_bit = 0;
                     break;
@@ -533,11 +806,11 @@ DEFINE_THREAD_ROUTINE(keyboard_control, NO_PARAM) { //
                     break;
                 case 't':
                     printw("tracking");
-                    tracking = 1;
+                    set_tracking(1);
                     break;
                 case 'y':
                     printw("stop tracking");
-                    tracking = 0;
+                    set_tracking(0);
                     break;
                 default:
                     break;
@@ -565,4 +838,5 @@ THREAD_TABLE_ENTRY(gtk, 20)
 END_THREAD_TABLE
 
 BEGIN_NAVDATA_HANDLER_TABLE
+NAVDATA_HANDLER_TABLE_ENTRY(navdata_client_init, navdata_client_process, navdata_client_release, &droneId)
 END_NAVDATA_HANDLER_TABLE
\ No newline at end of file
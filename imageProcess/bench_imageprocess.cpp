@@ -0,0 +1,388 @@
+/**
+ * Microbenchmarks of the per-frame kernels of the tracking path.
+ *
+ * Each kernel runs on its own, on a synthetic scene (seeded noise and a
+ * saturated target) at the four stream sizes: RGB565 unpacking, RGB to HSV,
+ * inRange + mixChannels, calcBackProject, CamShift, the whole tracker_process
+ * (fused strip pass on --threads cores) from BGR, RGB565 and YUV 4:2:0,
+ * and the shared memory handoff between the publisher and the copy thread.
+ * The per-pixel kernels also run as "_generic", on their runtime sized
+ * instances, against the ones specialized for the stream sizes (see
+ * tracker_fixed_kernels), and RGB565 tracking at the reduced processing
+ * scales of the governor (scale_governor.h). One JSON object per kernel and size is written to
+ * stdout, so runs before and after a change can be compared by a script.
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <algorithm>
+#include <vector>
+#include "semaphore.h"
+#include "tracker.h"
+#include "timing.h"
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+using namespace std;
+
+const char* keys =
+{
+    "{help h     |        | show help message}"
+    "{iterations |200     | timed runs per kernel and size}"
+    "{warmup     |10      | untimed runs before timing}"
+    "{seed       |20180601| seed of the synthetic scene}"
+    "{kernel     |        | only run kernels whose name contains this}"
+    "{sizes      |176x144,320x240,640x360,1280x720| frame sizes to run}"
+    "{threads    |1       | strip pool threads of tracker_process}"
+};
+
+// inputs and outputs of every kernel for one frame size
+struct bench_frame {
+    Size size;
+    Mat rgb565;
+    Mat yuv;            // I420, as imageProcess --decode gets it
+    Mat bgr, hsv, hue, mask, hist, backproj;
+    Rect target;
+    track_params params;
+    tracker trk;
+};
+
+typedef void (*kernel_fn)(bench_frame& f);
+
+static void make_scene(bench_frame& f, Size size, uint64_t seed)
+{
+    RNG rng(seed);
+    Mat scene(size, CV_8UC3);
+    // cluttered background, then one saturated target a fifth of the height wide
+    rng.fill(scene, RNG::UNIFORM, Scalar::all(0), Scalar::all(256));
+    GaussianBlur(scene, scene, Size(5, 5), 0);
+    int r = size.height / 10;
+    Point c(size.width / 2 + rng.uniform(-r, r), size.height / 2 + rng.uniform(-r, r));
+    ellipse(scene, c, Size(r, r * 3 / 4), 0, 0, 360, Scalar(40, 40, 220), FILLED);
+
+    f.size = size;
+    f.target = Rect(c.x - r / 2, c.y - r / 2, r, r);
+    cvtColor(scene, f.rgb565, COLOR_BGR2BGR565);
+    cvtColor(scene, f.yuv, COLOR_BGR2YUV_I420);
+    f.bgr.create(size, CV_8UC3);
+    rgb565_to_rgb888(f.rgb565.data, size.width, size.height, f.bgr.data);
+
+    f.params.vmin = 10;
+    f.params.vmax = 256;
+    f.params.smin = 30;
+    f.params.ini_area = 150 * 150;
+    tracker_init(f.trk);
+    // hue, mask, histogram and back projection for the later kernels
+    tracker_select(f.trk, f.target);
+    track_result res;
+    tracker_process(f.trk, f.bgr, f.params, res);
+    cvtColor(f.bgr, f.hsv, COLOR_BGR2HSV);
+    f.hue = f.trk.hue.clone();
+    f.mask = f.trk.mask.clone();
+    f.hist = f.trk.hist.clone();
+    f.backproj = f.trk.backproj.clone();
+}
+
+static void bench_rgb565_to_rgb888(bench_frame& f)
+{
+    rgb565_to_rgb888(f.rgb565.data, f.size.width, f.size.height, f.bgr.data);
+}
+
+static void bench_bgr2hsv(bench_frame& f)
+{
+    cvtColor(f.bgr, f.hsv, COLOR_BGR2HSV);
+}
+
+static void bench_inrange_mix(bench_frame& f)
+{
+    const track_params& p = f.params;
+    inRange(f.hsv, Scalar(0, p.smin, MIN(p.vmin, p.vmax)),
+            Scalar(180, 256, MAX(p.vmin, p.vmax)), f.mask);
+    int ch[] = {0, 0};
+    f.hue.create(f.hsv.size(), f.hsv.depth());
+    mixChannels(&f.hsv, 1, &f.hue, 1, ch, 1);
+}
+
+static void bench_back_project(bench_frame& f)
+{
+    const float* phranges = f.trk.hranges;
+    calcBackProject(&f.hue, 1, 0, f.hist, f.backproj, &phranges);
+    f.backproj &= f.mask;
+}
+
+static void bench_camshift(bench_frame& f)
+{
+    // same start every run, the search converges over the same iterations
+    Rect window = f.target;
+    CamShift(f.backproj, window, TermCriteria(TermCriteria::EPS | TermCriteria::COUNT, 10, 1));
+}
+
+static void bench_tracker_process(bench_frame& f)
+{
+    track_result res;
+    tracker_process(f.trk, f.bgr, f.params, res);
+}
+
+static void bench_tracker_process_rgb565(bench_frame& f)
+{
+    track_result res;
+    tracker_process_rgb565(f.trk, f.rgb565.data, f.size.width, f.size.height, f.params, res);
+}
+
+static void bench_tracker_process_yuv420(bench_frame& f)
+{
+    int w = f.size.width, h = f.size.height;
+    const uint8_t *planes[3] = { f.yuv.data, f.yuv.data + w * h, f.yuv.data + w * h + w * h / 4 };
+    int steps[3] = { w, w / 2, w / 2 };
+    track_result res;
+    tracker_process_yuv420(f.trk, planes, steps, w, h, f.params, res);
+}
+
+// the same on the runtime sized kernels, the gap is what specializing buys
+static void bench_rgb565_to_rgb888_generic(bench_frame& f)
+{
+    tracker_fixed_kernels(false);
+    bench_rgb565_to_rgb888(f);
+    tracker_fixed_kernels(true);
+}
+
+static void bench_tracker_process_generic(bench_frame& f)
+{
+    tracker_fixed_kernels(false);
+    bench_tracker_process(f);
+    tracker_fixed_kernels(true);
+}
+
+static void bench_tracker_process_rgb565_generic(bench_frame& f)
+{
+    tracker_fixed_kernels(false);
+    bench_tracker_process_rgb565(f);
+    tracker_fixed_kernels(true);
+}
+
+// the processing scales the governor switches to
+static void bench_tracker_process_rgb565_scale2(bench_frame& f)
+{
+    f.trk.scale = 2;
+    bench_tracker_process_rgb565(f);
+    f.trk.scale = 1;
+}
+
+static void bench_tracker_process_rgb565_scale4(bench_frame& f)
+{
+    f.trk.scale = 4;
+    bench_tracker_process_rgb565(f);
+    f.trk.scale = 1;
+}
+
+struct handoff_info {
+    int size;
+    int width;
+    int height;
+    int frame_id;
+    double publish_ms;
+};
+
+// shared memory handoff, publisher and copy thread as in display_stage / imageProcess
+struct handoff {
+    int info_shmid, data_shmid;
+    handoff_info *info;
+    uint8_t *shared;
+    int sem_lock;       // sem_id2 of imageProcess, guards the segment
+    int sem_ready;      // a new frame was published
+    int sem_done;       // the copy thread took it
+    vector<uint8_t> copy;
+    const uint8_t *frame;
+    int frames;
+    vector<double> latency;
+};
+
+static void* handoff_copy_thread(void* arg)
+{
+    handoff& h = *(handoff*)arg;
+    for (int i = 0; i < h.frames; i++) {
+        if (!semaphore_P(h.sem_ready) || !semaphore_P(h.sem_lock))
+            exit(EXIT_FAILURE);
+        memcpy(&h.copy[0], h.shared, h.info->size);
+        h.latency[i] = now_ms() - h.info->publish_ms;
+        if (!semaphore_V(h.sem_lock) || !semaphore_V(h.sem_done))
+            exit(EXIT_FAILURE);
+    }
+    return NULL;
+}
+
+static int private_semaphore(int value)
+{
+    int id = semget(IPC_PRIVATE, 1, 0600 | IPC_CREAT);
+    union semun arg;
+    arg.val = value;
+    if (id == -1 || semctl(id, 0, SETVAL, arg) == -1) {
+        fprintf(stderr, "semget failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return id;
+}
+
+// per-frame publish to copied latency, in ms
+static vector<double> bench_handoff(const bench_frame& f, int frames)
+{
+    handoff h;
+    size_t size = f.rgb565.total() * f.rgb565.elemSize();
+    h.info_shmid = shmget(IPC_PRIVATE, sizeof(handoff_info), 0600 | IPC_CREAT);
+    h.data_shmid = shmget(IPC_PRIVATE, size, 0600 | IPC_CREAT);
+    if (h.info_shmid == -1 || h.data_shmid == -1) {
+        fprintf(stderr, "shmget failed\n");
+        exit(EXIT_FAILURE);
+    }
+    h.info = (handoff_info*)shmat(h.info_shmid, 0, 0);
+    h.shared = (uint8_t*)shmat(h.data_shmid, 0, 0);
+    if (h.info == (void*)-1 || h.shared == (void*)-1) {
+        fprintf(stderr, "shmat failed\n");
+        exit(EXIT_FAILURE);
+    }
+    h.sem_lock = private_semaphore(1);
+    h.sem_ready = private_semaphore(0);
+    h.sem_done = private_semaphore(0);
+    h.copy.resize(size);
+    h.frame = f.rgb565.data;
+    h.frames = frames;
+    h.latency.resize(frames);
+    memset(h.shared, 0, size);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, handoff_copy_thread, &h) != 0)
+        exit(EXIT_FAILURE);
+    for (int i = 0; i < frames; i++) {
+        if (!semaphore_P(h.sem_lock))
+            exit(EXIT_FAILURE);
+        h.info->publish_ms = now_ms();
+        h.info->size = (int)size;
+        h.info->width = f.size.width;
+        h.info->height = f.size.height;
+        h.info->frame_id = i;
+        memcpy(h.shared, h.frame, size);
+        if (!semaphore_V(h.sem_lock) || !semaphore_V(h.sem_ready) || !semaphore_P(h.sem_done))
+            exit(EXIT_FAILURE);
+    }
+    pthread_join(tid, NULL);
+
+    shmdt(h.info);
+    shmdt(h.shared);
+    shmctl(h.info_shmid, IPC_RMID, 0);
+    shmctl(h.data_shmid, IPC_RMID, 0);
+    del_semaphore(h.sem_lock);
+    del_semaphore(h.sem_ready);
+    del_semaphore(h.sem_done);
+    return h.latency;
+}
+
+static vector<double> time_kernel(kernel_fn fn, bench_frame& f, int warmup, int iterations)
+{
+    vector<double> ms(iterations);
+    for (int i = 0; i < warmup; i++)
+        fn(f);
+    for (int i = 0; i < iterations; i++) {
+        double t0 = now_ms();
+        fn(f);
+        ms[i] = now_ms() - t0;
+    }
+    return ms;
+}
+
+static double percentile(const vector<double>& sorted, double p)
+{
+    size_t i = (size_t)(p / 100 * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+static void report(const char* kernel, const bench_frame& f, uint64_t seed, int threads, vector<double> ms)
+{
+    sort(ms.begin(), ms.end());
+    double sum = 0;
+    for (size_t i = 0; i < ms.size(); i++)
+        sum += ms[i];
+    double mean = sum / ms.size();
+    double mpix = mean > 0 ? f.size.area() / (mean * 1000) : 0;
+    printf("{\"kernel\":\"%s\",\"width\":%d,\"height\":%d,\"seed\":%llu,\"threads\":%d,\"iterations\":%d,"
+           "\"mean_us\":%.2f,\"min_us\":%.2f,\"p50_us\":%.2f,\"p90_us\":%.2f,\"p99_us\":%.2f,"
+           "\"max_us\":%.2f,\"mpix_per_s\":%.1f}\n",
+           kernel, f.size.width, f.size.height, (unsigned long long)seed, threads, (int)ms.size(),
+           mean * 1000, ms.front() * 1000, percentile(ms, 50) * 1000, percentile(ms, 90) * 1000,
+           percentile(ms, 99) * 1000, ms.back() * 1000, mpix);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    CommandLineParser parser(argc, argv, keys);
+    if (parser.has("help")) {
+        parser.printMessage();
+        return EXIT_SUCCESS;
+    }
+    int iterations = parser.get<int>("iterations");
+    int warmup = parser.get<int>("warmup");
+    uint64_t seed = (uint64_t)parser.get<double>("seed");
+    string filter = parser.has("kernel") ? parser.get<string>("kernel") : "";
+    int threads = parser.get<int>("threads");
+    if (iterations <= 0 || warmup < 0 || threads < 1) {
+        fprintf(stderr, "iterations and threads must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    vector<Size> sizes;
+    string list = parser.get<string>("sizes");
+    for (size_t pos = 0; pos < list.size();) {
+        size_t end = list.find(',', pos);
+        if (end == string::npos)
+            end = list.size();
+        int w = 0, h = 0;
+        if (sscanf(list.substr(pos, end - pos).c_str(), "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+            fprintf(stderr, "bad size list, expected WIDTHxHEIGHT,...\n");
+            return EXIT_FAILURE;
+        }
+        sizes.push_back(Size(w, h));
+        pos = end + 1;
+    }
+
+    static const struct { const char* name; kernel_fn fn; } kernels[] = {
+        { "rgb565_to_rgb888", bench_rgb565_to_rgb888 },
+        { "rgb565_to_rgb888_generic", bench_rgb565_to_rgb888_generic },
+        { "bgr2hsv", bench_bgr2hsv },
+        { "inrange_mixchannels", bench_inrange_mix },
+        { "calcbackproject", bench_back_project },
+        { "camshift", bench_camshift },
+        { "tracker_process", bench_tracker_process },
+        { "tracker_process_generic", bench_tracker_process_generic },
+        { "tracker_process_rgb565", bench_tracker_process_rgb565 },
+        { "tracker_process_rgb565_generic", bench_tracker_process_rgb565_generic },
+        { "tracker_process_yuv420", bench_tracker_process_yuv420 },
+        { "tracker_process_rgb565_scale2", bench_tracker_process_rgb565_scale2 },
+        { "tracker_process_rgb565_scale4", bench_tracker_process_rgb565_scale4 },
+    };
+
+    // results are comparable only with the same threading
+    fprintf(stderr, "opencv %s, %d threads, %s\n", CV_VERSION, getNumThreads(),
+            useOptimized() ? "optimized" : "not optimized");
+    // the per-pixel cost should scale with --threads, the rest does not use the pool
+    strip_pool *pool = threads > 1 ? strip_pool_create(threads, NULL) : NULL;
+    for (size_t s = 0; s < sizes.size(); s++) {
+        bench_frame f;
+        make_scene(f, sizes[s], seed);
+        f.trk.pool = pool;
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+            if (!filter.empty() && string(kernels[k].name).find(filter) == string::npos)
+                continue;
+            report(kernels[k].name, f, seed, threads, time_kernel(kernels[k].fn, f, warmup, iterations));
+        }
+        if (filter.empty() || string("shm_handoff").find(filter) != string::npos) {
+            bench_handoff(f, warmup);
+            report("shm_handoff", f, seed, threads, bench_handoff(f, iterations));
+        }
+    }
+    strip_pool_destroy(pool);
+    return 0;
+}
@@ -0,0 +1,681 @@
+/**
+ * Local stand-in for the AR.Drone 2 command and navdata endpoints.
+ *
+ * Listens where ardrone_tool expects the drone: AT commands on UDP 5556,
+ * navdata on UDP 5554, the version file on FTP 5551 and the configuration
+ * on TCP 5559. Every AT command is timestamped on arrival; AT*REF and
+ * AT*PCMD drive a crude flight model whose attitude, altitude and speeds are
+ * sent back as navdata_demo packets, so the control binary runs without a
+ * drone (start it with -i and the --ip address below).
+ *
+ * On exit the command rate, the AT*PCMD inter-arrival jitter, sequence
+ * problems and the statistics of every PCMD axis are printed. --log writes
+ * every command with its arrival time for plotting the axis streams.
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <math.h>
+#include <errno.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "timing.h"
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+using namespace std;
+
+const char* keys =
+{
+    "{help h     |         | show help message}"
+    "{ip         |127.0.0.2| address to serve on, give it to the control binary with -i}"
+    "{navdata_hz |15       | navdata rate, 15 in demo mode, 200 otherwise}"
+    "{duration   |0        | stop after this many seconds, 0 waits for ctrl-c}"
+    "{version    |2.4.8    | firmware version served in version.txt}"
+    "{log        |         | write every AT command to this csv file}"
+};
+
+#define AT_PORT       5556
+#define NAVDATA_PORT  5554
+#define FTP_PORT      5551
+#define CONTROL_PORT  5559
+
+// ardrone_state bits and control states of navdata_common.h
+#define STATE_FLY            (1U << 0)
+#define STATE_COMMAND_ACK    (1U << 6)
+#define STATE_NAVDATA_DEMO   (1U << 10)
+#define STATE_BOOTSTRAP      (1U << 11)
+#define STATE_COM_WATCHDOG   (1U << 30)
+#define STATE_EMERGENCY      (1U << 31)
+#define CTRL_LANDED          2
+#define CTRL_FLYING          3
+#define CTRL_HOVERING        4
+
+#define NAVDATA_HEADER       0x55667788
+#define NAVDATA_DEMO_TAG     0
+#define NAVDATA_CKS_TAG      0xFFFF
+
+#define REF_TAKEOFF          (1 << 9)
+#define REF_EMERGENCY        (1 << 8)
+
+// no AT command for this long sets the drone communication watchdog
+#define WATCHDOG_MS          250
+
+enum at_type { AT_PCMD, AT_REF, AT_CONFIG, AT_CTRL, AT_COMWDG, AT_OTHER, AT_TYPES };
+static const char* at_names[AT_TYPES] = { "PCMD", "REF", "CONFIG", "CTRL", "COMWDG", "other" };
+
+struct at_command {
+    double time_ms;
+    uint32_t seq;
+    int type;
+    int flag;           // PCMD flag, REF input, CTRL mode
+    float roll, pitch, gaz, yaw;
+};
+
+#pragma pack(push, 1)
+struct navdata_demo {
+    uint16_t tag;
+    uint16_t size;
+    uint32_t ctrl_state;
+    uint32_t vbat_flying_percentage;
+    float theta;            // milli-degrees
+    float phi;
+    float psi;
+    int32_t altitude;       // mm
+    float vx, vy, vz;       // mm/s
+    uint32_t num_frames;
+    float detection_camera_rot[9];
+    float detection_camera_trans[3];
+    uint32_t detection_tag_index;
+    uint32_t detection_camera_type;
+    float drone_camera_rot[9];
+    float drone_camera_trans[3];
+};
+
+struct navdata_packet {
+    uint32_t header;
+    uint32_t ardrone_state;
+    uint32_t sequence;
+    uint32_t vision_defined;
+    navdata_demo demo;
+    uint16_t cks_tag;
+    uint16_t cks_size;
+    uint32_t cks;
+};
+#pragma pack(pop)
+
+struct sim {
+    pthread_mutex_t lock;
+    string ip;
+    string version;
+    double navdata_hz;
+    int control_fd;                 // connected configuration socket, -1 if none
+
+    // drone state
+    bool flying;
+    bool emergency;
+    bool ack;
+    bool demo;
+    at_command last_pcmd;
+    int last_ref;
+    double last_command_ms;
+    float theta, phi, psi, altitude, vx, vy, vz;
+
+    // what the control binary sent
+    vector<at_command> commands;
+    int packets;
+    int navdata_sent;
+    double start_ms;
+};
+
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal(int)
+{
+    quit = 1;
+}
+
+static int open_socket(const string& ip, int port, int type)
+{
+    int fd = socket(AF_INET, type, 0);
+    if (fd < 0) {
+        fprintf(stderr, "socket failed\n");
+        exit(EXIT_FAILURE);
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // lets the threads notice quit
+    struct timeval tv = { 0, 100000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr(ip.c_str());
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "can not bind %s:%d: %s\n", ip.c_str(), port, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (type == SOCK_STREAM && listen(fd, 1) < 0) {
+        fprintf(stderr, "listen failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+static float int_to_float(int v)
+{
+    float f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+// one "AT*NAME=seq,args" command
+static void parse_command(sim& s, const char* cmd, double t)
+{
+    if (strncmp(cmd, "AT*", 3) != 0)
+        return;
+    const char* eq = strchr(cmd, '=');
+    if (eq == NULL)
+        return;
+    string name(cmd + 3, eq - cmd - 3);
+    at_command c;
+    memset(&c, 0, sizeof(c));
+    c.time_ms = t;
+    c.type = AT_OTHER;
+    c.seq = strtoul(eq + 1, NULL, 10);
+    const char* args = strchr(eq + 1, ',');
+
+    if (name == "PCMD" || name == "PCMD_MAG") {
+        int v[5] = { 0 };
+        if (args == NULL || sscanf(args, ",%d,%d,%d,%d,%d", &v[0], &v[1], &v[2], &v[3], &v[4]) != 5)
+            return;
+        c.type = AT_PCMD;
+        c.flag = v[0];
+        c.roll = int_to_float(v[1]);
+        c.pitch = int_to_float(v[2]);
+        c.gaz = int_to_float(v[3]);
+        c.yaw = int_to_float(v[4]);
+    }
+    else if (name == "REF") {
+        if (args == NULL)
+            return;
+        c.type = AT_REF;
+        c.flag = atoi(args + 1);
+    }
+    else if (name == "CONFIG")
+        c.type = AT_CONFIG;
+    else if (name == "CTRL") {
+        c.type = AT_CTRL;
+        c.flag = args != NULL ? atoi(args + 1) : 0;
+    }
+    else if (name == "COMWDG")
+        c.type = AT_COMWDG;
+
+    pthread_mutex_lock(&s.lock);
+    s.commands.push_back(c);
+    s.last_command_ms = t;
+    switch (c.type) {
+    case AT_PCMD:
+        s.last_pcmd = c;
+        break;
+    case AT_REF:
+        // the emergency bit toggles the emergency state on its rising edge
+        if ((c.flag & REF_EMERGENCY) && !(s.last_ref & REF_EMERGENCY)) {
+            s.emergency = !s.emergency;
+            s.flying = false;
+        }
+        else if (!s.emergency) {
+            s.flying = (c.flag & REF_TAKEOFF) != 0;
+        }
+        s.last_ref = c.flag;
+        break;
+    case AT_CONFIG:
+        // every configuration is acknowledged until AT*CTRL=ACK_CONTROL_MODE
+        if (strstr(cmd, "navdata_demo") != NULL)
+            s.demo = strstr(cmd, "TRUE") != NULL;
+        s.ack = true;
+        break;
+    case AT_CTRL:
+        if (c.flag == 5)
+            s.ack = false;
+        else if (c.flag == 4 && s.control_fd >= 0) {
+            // CFG_GET_CONTROL_MODE: the configuration goes out on the control socket
+            string config =
+                "general:num_version_config = 1\n"
+                "general:num_version_mb = 33\n"
+                "general:num_version_soft = " + s.version + "\n"
+                "general:drone_serial = STANDIN\n"
+                "general:navdata_demo = " + string(s.demo ? "TRUE" : "FALSE") + "\n"
+                "control:euler_angle_max = 0.20943952\n"
+                "control:control_vz_max = 700\n"
+                "control:control_yaw = 1.7453293\n"
+                "control:outdoor = FALSE\n"
+                "video:video_codec = 129\n";
+            if (write(s.control_fd, config.c_str(), config.size() + 1) < 0)
+                fprintf(stderr, "can not send the configuration\n");
+        }
+        break;
+    }
+    pthread_mutex_unlock(&s.lock);
+}
+
+static void* at_thread(void* arg)
+{
+    sim& s = *(sim*)arg;
+    int fd = open_socket(s.ip, AT_PORT, SOCK_DGRAM);
+    char buf[4096];
+    while (!quit) {
+        ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
+        double t = now_ms();
+        if (n <= 0)
+            continue;
+        buf[n] = '\0';
+        pthread_mutex_lock(&s.lock);
+        s.packets++;
+        pthread_mutex_unlock(&s.lock);
+        // several commands per datagram, each ends with \r
+        char* save = NULL;
+        for (char* cmd = strtok_r(buf, "\r", &save); cmd != NULL; cmd = strtok_r(NULL, "\r", &save))
+            parse_command(s, cmd, t);
+    }
+    close(fd);
+    return NULL;
+}
+
+static uint32_t checksum(const uint8_t* data, size_t size)
+{
+    uint32_t cks = 0;
+    for (size_t i = 0; i < size; i++)
+        cks += data[i];
+    return cks;
+}
+
+// integrates the last PCMD over dt seconds, returns the packet
+static void flight_step(sim& s, double now, double dt, uint32_t sequence, navdata_packet& p)
+{
+    pthread_mutex_lock(&s.lock);
+    const at_command& c = s.last_pcmd;
+    bool progressive = s.flying && (c.flag & 1);
+    // euler_angle_max 12 deg, control_vz_max 700 mm/s, control_yaw 100 deg/s
+    s.theta = progressive ? c.pitch * 12000 : 0;
+    s.phi = progressive ? c.roll * 12000 : 0;
+    if (progressive)
+        s.psi += c.yaw * 100000 * dt;
+    if (s.psi > 180000)
+        s.psi -= 360000;
+    if (s.psi < -180000)
+        s.psi += 360000;
+    s.vx = -s.theta / 12000 * 2000;
+    s.vy = s.phi / 12000 * 2000;
+    s.vz = progressive ? c.gaz * 700 : 0;
+    if (s.flying && s.altitude < 800)
+        s.vz = 1000;            // take off to hover height
+    if (!s.flying && s.altitude > 0)
+        s.vz = -700;
+    s.altitude = max(0.0f, (float)(s.altitude + s.vz * dt));
+
+    uint32_t state = STATE_NAVDATA_DEMO;
+    if (s.flying)
+        state |= STATE_FLY;
+    if (s.emergency)
+        state |= STATE_EMERGENCY;
+    if (s.ack)
+        state |= STATE_COMMAND_ACK;
+    if (!s.demo)
+        state |= STATE_BOOTSTRAP;
+    if (s.last_command_ms > 0 && now - s.last_command_ms > WATCHDOG_MS)
+        state |= STATE_COM_WATCHDOG;
+
+    memset(&p, 0, sizeof(p));
+    p.header = NAVDATA_HEADER;
+    p.ardrone_state = state;
+    p.sequence = sequence;
+    p.demo.tag = NAVDATA_DEMO_TAG;
+    p.demo.size = sizeof(navdata_demo);
+    p.demo.ctrl_state = (uint32_t)(!s.flying ? CTRL_LANDED : progressive ? CTRL_FLYING : CTRL_HOVERING) << 16;
+    p.demo.vbat_flying_percentage = 80;
+    p.demo.theta = s.theta;
+    p.demo.phi = s.phi;
+    p.demo.psi = s.psi;
+    p.demo.altitude = (int32_t)s.altitude;
+    p.demo.vx = s.vx;
+    p.demo.vy = s.vy;
+    p.demo.vz = s.vz;
+    pthread_mutex_unlock(&s.lock);
+
+    p.cks_tag = NAVDATA_CKS_TAG;
+    p.cks_size = 8;
+    p.cks = checksum((const uint8_t*)&p, offsetof(navdata_packet, cks_tag));
+}
+
+static void* navdata_thread(void* arg)
+{
+    sim& s = *(sim*)arg;
+    int fd = open_socket(s.ip, NAVDATA_PORT, SOCK_DGRAM);
+    struct sockaddr_in client;
+    socklen_t client_len = 0;
+    uint32_t sequence = 1;
+    double period = 1000.0 / s.navdata_hz;
+    double next = now_ms();
+    char buf[64];
+
+    while (!quit) {
+        // the client pokes the port to (re)start the stream
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int flags = client_len == 0 ? 0 : MSG_DONTWAIT;
+        if (recvfrom(fd, buf, sizeof(buf), flags, (struct sockaddr*)&from, &from_len) > 0) {
+            client = from;
+            client_len = from_len;
+        }
+        if (client_len == 0)
+            continue;
+        sleep_until_ms(next);
+        double now = now_ms();
+        navdata_packet p;
+        flight_step(s, now, period / 1000, sequence++, p);
+        sendto(fd, &p, sizeof(p), 0, (struct sockaddr*)&client, client_len);
+        pthread_mutex_lock(&s.lock);
+        s.navdata_sent++;
+        pthread_mutex_unlock(&s.lock);
+        next += period;
+        if (next < now)
+            next = now + period;
+    }
+    close(fd);
+    return NULL;
+}
+
+static void reply(int fd, const char* text)
+{
+    if (write(fd, text, strlen(text)) < 0)
+        fprintf(stderr, "ftp: write failed\n");
+}
+
+// just enough FTP for ardrone_tool to fetch version.txt
+static void ftp_session(sim& s, int fd)
+{
+    string version = s.version + "\n";
+    int data_fd = -1;
+    char line[512];
+    size_t len = 0;
+
+    reply(fd, "220 stand-in\r\n");
+    while (!quit) {
+        ssize_t n = read(fd, line + len, sizeof(line) - 1 - len);
+        if (n == 0)
+            break;
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            break;
+        }
+        len += n;
+        line[len] = '\0';
+        char* end;
+        while ((end = strstr(line, "\r\n")) != NULL) {
+            *end = '\0';
+            string cmd(line);
+            memmove(line, end + 2, len - (end + 2 - line) + 1);
+            len = strlen(line);
+
+            if (cmd.compare(0, 4, "USER") == 0 || cmd.compare(0, 4, "PASS") == 0)
+                reply(fd, "230 logged in\r\n");
+            else if (cmd.compare(0, 4, "TYPE") == 0 || cmd.compare(0, 4, "MODE") == 0)
+                reply(fd, "200 ok\r\n");
+            else if (cmd.compare(0, 3, "CWD") == 0)
+                reply(fd, "250 ok\r\n");
+            else if (cmd.compare(0, 3, "PWD") == 0)
+                reply(fd, "257 \"/\"\r\n");
+            else if (cmd.compare(0, 4, "SIZE") == 0) {
+                char msg[64];
+                snprintf(msg, sizeof(msg), "213 %d\r\n", (int)version.size());
+                reply(fd, msg);
+            }
+            else if (cmd.compare(0, 4, "PASV") == 0) {
+                if (data_fd >= 0)
+                    close(data_fd);
+                data_fd = open_socket(s.ip, 0, SOCK_STREAM);
+                struct sockaddr_in addr;
+                socklen_t addr_len = sizeof(addr);
+                getsockname(data_fd, (struct sockaddr*)&addr, &addr_len);
+                unsigned ip = ntohl(addr.sin_addr.s_addr), port = ntohs(addr.sin_port);
+                char msg[128];
+                snprintf(msg, sizeof(msg), "227 Entering Passive Mode (%u,%u,%u,%u,%u,%u)\r\n",
+                         ip >> 24, (ip >> 16) & 255, (ip >> 8) & 255, ip & 255, port >> 8, port & 255);
+                reply(fd, msg);
+            }
+            else if (cmd.compare(0, 4, "RETR") == 0 && data_fd >= 0) {
+                reply(fd, "150 sending\r\n");
+                int conn = -1;
+                for (int tries = 0; conn < 0 && tries < 20 && !quit; tries++)
+                    conn = accept(data_fd, NULL, NULL);
+                if (conn >= 0) {
+                    reply(conn, version.c_str());
+                    close(conn);
+                }
+                close(data_fd);
+                data_fd = -1;
+                reply(fd, conn >= 0 ? "226 done\r\n" : "425 no data connection\r\n");
+            }
+            else if (cmd.compare(0, 4, "QUIT") == 0) {
+                reply(fd, "221 bye\r\n");
+                if (data_fd >= 0)
+                    close(data_fd);
+                return;
+            }
+            else
+                reply(fd, "502 not implemented\r\n");
+        }
+        if (len >= sizeof(line) - 1)
+            len = 0;
+    }
+    if (data_fd >= 0)
+        close(data_fd);
+}
+
+static void* ftp_thread(void* arg)
+{
+    sim& s = *(sim*)arg;
+    int fd = open_socket(s.ip, FTP_PORT, SOCK_STREAM);
+    while (!quit) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0)
+            continue;
+        ftp_session(s, conn);
+        close(conn);
+    }
+    close(fd);
+    return NULL;
+}
+
+static void* control_thread(void* arg)
+{
+    sim& s = *(sim*)arg;
+    int fd = open_socket(s.ip, CONTROL_PORT, SOCK_STREAM);
+    while (!quit) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0)
+            continue;
+        pthread_mutex_lock(&s.lock);
+        if (s.control_fd >= 0)
+            close(s.control_fd);
+        s.control_fd = conn;
+        pthread_mutex_unlock(&s.lock);
+    }
+    pthread_mutex_lock(&s.lock);
+    if (s.control_fd >= 0)
+        close(s.control_fd);
+    s.control_fd = -1;
+    pthread_mutex_unlock(&s.lock);
+    close(fd);
+    return NULL;
+}
+
+static double percentile(const vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t i = (size_t)(p / 100 * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+static void report(const sim& s, double elapsed_ms)
+{
+    const vector<at_command>& cmds = s.commands;
+    double seconds = elapsed_ms / 1000;
+    int count[AT_TYPES] = { 0 };
+    for (size_t i = 0; i < cmds.size(); i++)
+        count[cmds[i].type]++;
+
+    printf("%.1f s, %d packets (%.1f/s), %d commands (%.1f/s), %d navdata sent\n",
+           seconds, s.packets, s.packets / seconds, (int)cmds.size(), cmds.size() / seconds,
+           s.navdata_sent);
+    for (int t = 0; t < AT_TYPES; t++)
+        if (count[t] > 0)
+            printf("  %-7s %7d  %8.1f/s\n", at_names[t], count[t], count[t] / seconds);
+
+    // sequence numbers must strictly increase, the drone drops the others
+    int gaps = 0, reordered = 0;
+    for (size_t i = 1; i < cmds.size(); i++) {
+        if (cmds[i].seq <= cmds[i - 1].seq)
+            reordered++;
+        else if (cmds[i].seq != cmds[i - 1].seq + 1)
+            gaps++;
+    }
+    printf("sequence: %d gaps, %d not increasing\n", gaps, reordered);
+
+    vector<double> interval;
+    double last = -1;
+    int watchdog = 0;
+    for (size_t i = 0; i < cmds.size(); i++) {
+        if (cmds[i].type != AT_PCMD)
+            continue;
+        if (last >= 0) {
+            interval.push_back(cmds[i].time_ms - last);
+            if (interval.back() > WATCHDOG_MS)
+                watchdog++;
+        }
+        last = cmds[i].time_ms;
+    }
+    if (!interval.empty()) {
+        double sum = 0, sq = 0;
+        for (size_t i = 0; i < interval.size(); i++) {
+            sum += interval[i];
+            sq += interval[i] * interval[i];
+        }
+        double mean = sum / interval.size();
+        double jitter = sqrt(max(0.0, sq / interval.size() - mean * mean));
+        sort(interval.begin(), interval.end());
+        printf("PCMD interval ms: mean %.3f jitter(stddev) %.3f min %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f, %d over %d ms\n",
+               mean, jitter, interval.front(), percentile(interval, 50), percentile(interval, 90),
+               percentile(interval, 99), interval.back(), watchdog, WATCHDOG_MS);
+    }
+
+    if (count[AT_PCMD] > 0) {
+        printf("axis      min       max      mean   active%%\n");
+        const char* axis[4] = { "roll", "pitch", "gaz", "yaw" };
+        for (int a = 0; a < 4; a++) {
+            double lo = 1e9, hi = -1e9, sum = 0;
+            int active = 0;
+            for (size_t i = 0; i < cmds.size(); i++) {
+                if (cmds[i].type != AT_PCMD)
+                    continue;
+                const float* v = &cmds[i].roll;
+                lo = min(lo, (double)v[a]);
+                hi = max(hi, (double)v[a]);
+                sum += v[a];
+                if ((cmds[i].flag & 1) && v[a] != 0)
+                    active++;
+            }
+            printf("%-6s %8.3f  %8.3f  %8.3f  %7.1f\n", axis[a], lo, hi, sum / count[AT_PCMD],
+                   100.0 * active / count[AT_PCMD]);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    CommandLineParser parser(argc, argv, keys);
+    if (parser.has("help")) {
+        parser.printMessage();
+        return EXIT_SUCCESS;
+    }
+    sim s;
+    pthread_mutex_init(&s.lock, NULL);
+    s.ip = parser.get<string>("ip");
+    s.version = parser.get<string>("version");
+    s.navdata_hz = parser.get<double>("navdata_hz");
+    double duration = parser.get<double>("duration");
+    if (s.navdata_hz <= 0 || duration < 0 || inet_addr(s.ip.c_str()) == INADDR_NONE) {
+        fprintf(stderr, "bad ip, navdata_hz or duration\n");
+        return EXIT_FAILURE;
+    }
+    s.control_fd = -1;
+    s.flying = s.emergency = s.ack = s.demo = false;
+    memset(&s.last_pcmd, 0, sizeof(s.last_pcmd));
+    s.last_ref = 0;
+    s.last_command_ms = 0;
+    s.theta = s.phi = s.psi = s.altitude = s.vx = s.vy = s.vz = 0;
+    s.packets = s.navdata_sent = 0;
+    s.commands.reserve(1 << 20);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // the service threads never see the signals, they poll quit
+    sigset_t block, old_mask;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &old_mask);
+    pthread_t threads[4];
+    void* (*routines[4])(void*) = { at_thread, navdata_thread, ftp_thread, control_thread };
+    for (int i = 0; i < 4; i++)
+        if (pthread_create(&threads[i], NULL, routines[i], &s) != 0)
+            exit(EXIT_FAILURE);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    printf("serving on %s (AT %d, navdata %d at %.0f Hz, ftp %d, control %d)\n", s.ip.c_str(),
+           AT_PORT, NAVDATA_PORT, s.navdata_hz, FTP_PORT, CONTROL_PORT);
+    s.start_ms = now_ms();
+    while (!quit) {
+        usleep(100000);
+        if (duration > 0 && now_ms() - s.start_ms >= duration * 1000)
+            quit = 1;
+    }
+    for (int i = 0; i < 4; i++)
+        pthread_join(threads[i], NULL);
+    double elapsed = now_ms() - s.start_ms;
+
+    report(s, elapsed);
+    if (parser.has("log")) {
+        FILE* f = fopen(parser.get<string>("log").c_str(), "w");
+        if (f == NULL) {
+            fprintf(stderr, "can not write %s\n", parser.get<string>("log").c_str());
+            return EXIT_FAILURE;
+        }
+        fprintf(f, "time_ms,seq,cmd,flag,roll,pitch,gaz,yaw\n");
+        for (size_t i = 0; i < s.commands.size(); i++) {
+            const at_command& c = s.commands[i];
+            fprintf(f, "%.3f,%u,%s,%d,%f,%f,%f,%f\n", c.time_ms - s.start_ms, c.seq,
+                    at_names[c.type], c.flag, c.roll, c.pitch, c.gaz, c.yaw);
+        }
+        fclose(f);
+    }
+    pthread_mutex_destroy(&s.lock);
+    return 0;
+}
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "h264_source.h"
+#include <Video/h264_ring.h>
+
+#ifdef HAVE_AVCODEC
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+}
+#endif
+
+using namespace std;
+
+// stamps of the frames in the decoder, by frame_number
+#define STAMP_SLOTS (64)
+
+struct h264_source {
+    h264_ring *ring;
+    int shmid;
+    uint64_t pos;               // next record to read
+    bool synced;                // an IDR frame was decoded since the last gap
+    uint32_t last_number;
+    vector<uint8_t> buf;        // payload and the padding libavcodec reads past it
+    int64_t stamps[STAMP_SLOTS];
+    h264_source_stats stats;
+#ifdef HAVE_AVCODEC
+    AVCodecContext *ctx;
+    AVPacket *pkt;
+    AVFrame *frame;
+#endif
+};
+
+void yuv_frame_init(yuv_frame& f)
+{
+    memset(&f, 0, sizeof(f));
+}
+
+static void clear_planes(yuv_frame& f)
+{
+#ifdef HAVE_AVCODEC
+    if (f.ref)
+        av_frame_unref((AVFrame *)f.ref);
+#endif
+    memset(f.planes, 0, sizeof(f.planes));
+    memset(f.steps, 0, sizeof(f.steps));
+    f.width = f.height = 0;
+}
+
+void yuv_frame_release(yuv_frame& f)
+{
+    clear_planes(f);
+#ifdef HAVE_AVCODEC
+    AVFrame *ref = (AVFrame *)f.ref;
+    av_frame_free(&ref);
+#endif
+    yuv_frame_init(f);
+}
+
+// src keeps the empty decoder frame of dst, nothing is allocated per frame
+void yuv_frame_move(yuv_frame& dst, yuv_frame& src)
+{
+    clear_planes(dst);
+    void *spare = dst.ref;
+    dst = src;
+    yuv_frame_init(src);
+    src.ref = spare;
+}
+
+const h264_source_stats& h264_source_get_stats(const h264_source *src)
+{
+    return src->stats;
+}
+
+#ifdef HAVE_AVCODEC
+
+h264_source *h264_source_open(int drone, int threads)
+{
+    const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    if (codec == NULL) {
+        fprintf(stderr, "libavcodec has no H.264 decoder\n");
+        return NULL;
+    }
+    h264_source *src = new h264_source();
+    src->ring = h264_ring_attach(drone_key(H264_RING_KEY, drone), &src->shmid);
+    if (src->ring == NULL) {
+        fprintf(stderr, "can not attach the encoded frame ring of drone %d\n", drone);
+        delete src;
+        return NULL;
+    }
+    src->ctx = avcodec_alloc_context3(codec);
+    // slice threads only : frame threads would hold every frame back by one frame per thread
+    src->ctx->thread_count = threads;
+    src->ctx->thread_type = FF_THREAD_SLICE;
+    src->ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    if (avcodec_open2(src->ctx, codec, NULL) < 0) {
+        fprintf(stderr, "can not open the H.264 decoder\n");
+        avcodec_free_context(&src->ctx);
+        frame_shm_release(src->ring, src->shmid);
+        delete src;
+        return NULL;
+    }
+    src->pkt = av_packet_alloc();
+    src->frame = av_frame_alloc();
+    src->buf.assign(H264_RING_MAX_PAYLOAD + AV_INPUT_BUFFER_PADDING_SIZE, 0);
+    // frames published from now on, the decoder starts at the next IDR frame
+    src->pos = ((volatile h264_ring *)src->ring)->head;
+    src->synced = false;
+    src->last_number = 0;
+    src->ring->reader_pid = getpid();
+    return src;
+}
+
+void h264_source_close(h264_source *src)
+{
+    if (src == NULL)
+        return;
+    if (src->ring->reader_pid == getpid())
+        src->ring->reader_pid = 0;
+    frame_shm_release(src->ring, src->shmid);
+    av_frame_free(&src->frame);
+    av_packet_free(&src->pkt);
+    avcodec_free_context(&src->ctx);
+    delete src;
+}
+
+// the stream has a hole, nothing decodes before the next IDR frame
+static void lose_sync(h264_source *src)
+{
+    src->stats.gaps++;
+    src->synced = false;
+    avcodec_flush_buffers(src->ctx);
+}
+
+int h264_source_next(h264_source *src, long timeout_ms, yuv_frame& out)
+{
+    int64_t deadline = frame_shm_now_ns() + timeout_ms * 1000000LL;
+
+    for (;;) {
+        int ret = avcodec_receive_frame(src->ctx, src->frame);
+        if (ret == 0) {
+            AVFrame *f = src->frame;
+            if (f->format != AV_PIX_FMT_YUV420P && f->format != AV_PIX_FMT_YUVJ420P) {
+                fprintf(stderr, "decoded frames are not YUV 4:2:0 (format %d)\n", f->format);
+                return -1;
+            }
+            clear_planes(out);
+            if (out.ref == NULL)
+                out.ref = av_frame_alloc();
+            av_frame_move_ref((AVFrame *)out.ref, f);
+            f = (AVFrame *)out.ref;
+            for (int i = 0; i < 3; i++) {
+                out.planes[i] = f->data[i];
+                out.steps[i] = f->linesize[i];
+            }
+            out.width = f->width;
+            out.height = f->height;
+            out.frame_number = (uint32_t)f->pts;
+            out.stamp_ns = src->stamps[out.frame_number % STAMP_SLOTS];
+            src->stats.frames++;
+            return 1;
+        }
+        if (ret != AVERROR(EAGAIN)) {
+            fprintf(stderr, "H.264 decoder failed (%d)\n", ret);
+            return -1;
+        }
+
+        uint32_t seq = *(volatile uint32_t *)&src->ring->head_seq;
+        h264_record rec;
+        int n = h264_ring_read(src->ring, &src->pos, &rec, &src->buf[0], H264_RING_MAX_PAYLOAD);
+        if (n < 0) {
+            lose_sync(src);
+            continue;
+        }
+        if (n == 0) {
+            int64_t left = deadline - frame_shm_now_ns();
+            if (left <= 0)
+                return 0;
+            h264_ring_wait(src->ring, seq, (long)left);
+            continue;
+        }
+        bool idr = (rec.flags & H264_RECORD_IDR) != 0;
+        // a P frame after a frame left out of the ring refers to it
+        if (src->synced && !idr && rec.frame_number != src->last_number + 1)
+            lose_sync(src);
+        if (!src->synced && !idr) {
+            src->stats.skipped++;
+            continue;
+        }
+        src->synced = true;
+        src->last_number = rec.frame_number;
+        src->stamps[rec.frame_number % STAMP_SLOTS] = rec.stamp_ns;
+        memset(&src->buf[n], 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        src->pkt->data = &src->buf[0];
+        src->pkt->size = n;
+        src->pkt->pts = rec.frame_number;
+        src->stats.packets++;
+        src->stats.bytes += n;
+        // a damaged access unit is a gap like a missing one
+        if (avcodec_send_packet(src->ctx, src->pkt) < 0)
+            lose_sync(src);
+    }
+}
+
+#else // HAVE_AVCODEC
+
+h264_source *h264_source_open(int, int)
+{
+    fprintf(stderr, "built without libavcodec, --decode is not available\n");
+    return NULL;
+}
+
+void h264_source_close(h264_source *src)
+{
+    delete src;
+}
+
+int h264_source_next(h264_source *, long, yuv_frame&)
+{
+    return -1;
+}
+
+#endif // HAVE_AVCODEC
@@ -0,0 +1,52 @@
+#ifndef H264_SOURCE_H_
+#define H264_SOURCE_H_
+
+#include <stdint.h>
+
+/**
+ * Frames of imageProcess --decode : the H.264 stream pre_stage publishes in
+ * the encoded frame ring (Video/h264_ring.h), decoded with libavcodec to
+ * YUV 4:2:0 for tracker_process_yuv420. Reading starts at the next IDR
+ * frame, and again after a gap (the reader was lapped or a frame was left
+ * out of the ring).
+ *
+ * Needs HAVE_AVCODEC, without it h264_source_open fails.
+ */
+
+// one decoded frame, the planes stay valid until it is released or moved
+struct yuv_frame {
+    const uint8_t *planes[3];
+    int steps[3];
+    int width, height;
+    uint32_t frame_number;      // PaVE frame_number
+    int64_t stamp_ns;           // when pre_stage got the frame, frame_shm_now_ns
+    void *ref;                  // the decoder frame holding the planes, NULL if empty
+};
+
+void yuv_frame_init(yuv_frame& f);
+void yuv_frame_release(yuv_frame& f);
+// dst releases its planes and takes those of src, src is left empty
+void yuv_frame_move(yuv_frame& dst, yuv_frame& src);
+
+struct h264_source;
+
+struct h264_source_stats {
+    uint64_t packets;           // access units given to the decoder
+    uint64_t frames;            // decoded
+    uint64_t gaps;              // times the reader was lapped or a frame was left out
+    uint64_t skipped;           // access units before an IDR frame, not decodable
+    uint64_t bytes;
+};
+
+// Attaches the ring of the drone and opens a decoder of threads slice
+// threads (0 : one per core). NULL after printing why on failure.
+h264_source *h264_source_open(int drone, int threads);
+void h264_source_close(h264_source *src);
+
+// Waits at most timeout_ms for the next frame and decodes it into out.
+// 1 : a new frame, 0 : none yet, -1 : the decoder failed (printed).
+int h264_source_next(h264_source *src, long timeout_ms, yuv_frame& out);
+
+const h264_source_stats& h264_source_get_stats(const h264_source *src);
+
+#endif // H264_SOURCE_H_
@@ -11,64 +11,60 @@
 #include <math.h>
 #include <sys/shm.h>
 #include <pthread.h>
+#include <signal.h>
 #include "semaphore.h"
+#include "tracker.h"
+#include "scale_governor.h"
+#include "timing.h"
+#include "h264_source.h"
+#include <Video/frame_shm.h>
+#include <Control/rt_profile.h>
+#include <Video/track_stats.h>
+#include <Video/trace_ring.h>
 
 #include <opencv2/opencv.hpp>
 using namespace cv;
 using namespace std;
 
 #include <iostream>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <algorithm>
 #include <ctype.h>
 
-#define RGB565_MASK_RED        0xF800
-#define RGB565_MASK_GREEN                         0x07E0
-#define RGB565_MASK_BLUE                         0x001F
-#define UpAlign4(v)     (((v) + 0x3) & 0xFFFFFFFC)
-
-struct tran_data {
-    int size;
-    int width;
-    int height;
-    int frame_id;
-};
-struct area_err {
-    float x_err;
-    float y_err;
-    float z_err;
-};
-static int ini_area = 150 * 150;
 static struct tran_data* shared_info;
 static struct area_err *err_info;
 static uint8_t *shared_data;
-static uint8_t *data = NULL;
-static uint8_t *realdata = NULL;
+// data and realdata of the original loop, sized for --max_size
+static frame_pool frames;
 static pthread_t ntid;
 static int sem_id;
 static int sem_id2;
 static int sem_id3;
 static int height;
 static int width;
+static int64_t frame_stamp_ns;
+static struct nav_state *nav_shared;
+static struct image_stats *stats;
+// --decode : the decoder and the frame the tracking thread works on
+static h264_source *h264;
+static yuv_frame decoded;
 
 int pre_frame_id = -1;
-
-static const key_t SHARE_KEY = 1333;
-static const key_t DATA_KEY = 1313;
-static const key_t SEM_KEY = 9999;
-static const key_t ERR_KEY = 1995;
-static const key_t SEM_KEY2 = 7777;
-static const key_t SEM_KEY3 = 6666;
-static const int DATA_SIZE = 1048576;
+static volatile sig_atomic_t quit = 0;
 
 // camshift global
 Mat image;
 
 bool backprojMode = false;
 bool selectObject = false;
-int trackObject = 0;
 bool showHist = true;
 Point origin;
 Rect selection;
-int vmin = 10, vmax = 256, smin = 30;
+static tracker trk;
+static scale_governor governor;
+static track_params params = { 10, 256, 30, 150 * 150 };
 
 static void onMouse( int event, int x, int y, int, void* )
 {
@@ -92,7 +88,7 @@ static void onMouse( int event, int x, int y, int, void* )
     case EVENT_LBUTTONUP:
         selectObject = false;
         if( selection.width > 0 && selection.height > 0 ) {
-            trackObject = -1;
+            tracker_select(trk, selection);
         }
         break;
     }
@@ -105,82 +101,346 @@ string hot_keys =
     "\tb - switch to/from backprojection view\n"
     "\th - show/hide object histogram\n"
     "\tp - pause video\n"
+    "\ts - save the target model now (--save_model)\n"
     "To initialize tracking, select the object with mouse\n";
 
 const char* keys =
 {
-    "{help h | | show help message}{@camera_number| 0 | camera number}"
+    "{help h     |   | show help message}"
+    "{headless   |   | track without any window, keyboard or mouse}"
+    "{config     |   | read options from a key = value file}"
+    "{vmin       |   | minimum value (default 10)}"
+    "{vmax       |   | maximum value (default 256)}"
+    "{smin       |   | minimum saturation (default 30)}"
+    "{ini_area   |   | target area in pixels (default 22500)}"
+    "{roi        |   | initial target as x,y,width,height}"
+    "{model      |   | load the target model from this file and search the frames for it}"
+    "{save_model |   | save the target model to this file on exit (and on s)}"
+    "{rt_profile |   | pin and prioritize the image_copy, image_track and image_strip threads (Control/rt_profile.h)}"
+    "{drones     |   | drone IDs to serve, e.g. 0,1,2 (default 0). Several IDs need --headless}"
+    "{workers    |   | tracking threads shared by the drones (default one per drone, at most one per core)}"
+    "{max_size   |   | largest stream size, the frame buffers are allocated for it (default 1280x720)}"
+    "{threads    |   | cores of the per-pixel pass of one drone (default all of them, 1 with several drones)}"
+    "{decode     |   | decode the H.264 stream of the control process instead of copying its frames, needs --headless}"
+    "{decode_threads | | slice threads of the H.264 decoder (default 0, one per core)}"
+    "{scale      |   | processing scale 1, 2 or 4, or auto to let the governor pick it (default auto)}"
+    "{budget_ms  |   | track time the governor keeps under (default half the measured frame period)}"
+    "{verbose    |   | print the errors of every tracked frame}"
+    "{hfov       |   | camera horizontal field of view in degrees, 0 ignores the navdata (default 92)}"
 };
 // camshift global
 
-void* create_shared_memory(key_t key, size_t size, int& shmid) {
-    void *shm = NULL;
+// options
+static bool headless = false;
+static bool has_roi = false;
+static Rect roi;
+static string model_file;
+static string save_model_file;
+static float hfov_deg = 92;
+static bool verbose = false;
+static vector<int> drone_ids(1, 0);
+static int workers = 0;
+static int strip_threads = 0;
+static bool decode = false;
+static int decode_threads = 0;
+static int fixed_scale = 0;
+static double budget_ms = 0;
+static Size max_frame_size(1280, 720);
+static rt_profile_t rt;
+
+static void on_signal(int)
+{
+    quit = 1;
+}
+
+// key = value per line, '#' starts a comment
+static void load_config(const string& path, map<string, string>& cfg)
+{
+    ifstream in(path.c_str());
+    if (!in) {
+        fprintf(stderr, "can not open config %s\n", path.c_str());
+        exit(EXIT_FAILURE);
+    }
+    string line;
+    while (getline(in, line)) {
+        size_t hash = line.find('#');
+        if (hash != string::npos)
+            line.erase(hash);
+        size_t eq = line.find('=');
+        if (eq == string::npos)
+            continue;
+        string key = line.substr(0, eq), value = line.substr(eq + 1);
+        key.erase(0, key.find_first_not_of(" \t"));
+        key.erase(key.find_last_not_of(" \t\r") + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t\r") + 1);
+        if (!key.empty())
+            cfg[key] = value;
+    }
+}
+
+// command line wins over the config file, the config file over the defaults
+static bool get_option(const CommandLineParser& parser, map<string, string>& cfg,
+                       const string& name, string& value)
+{
+    if (parser.has(name)) {
+        value = parser.get<string>(name);
+        return true;
+    }
+    if (cfg.count(name)) {
+        value = cfg[name];
+        return true;
+    }
+    return false;
+}
+
+static void parse_options(int argc, char** argv)
+{
+    CommandLineParser parser(argc, argv, keys);
+    if (parser.has("help")) {
+        parser.printMessage();
+        exit(EXIT_SUCCESS);
+    }
+    map<string, string> cfg;
+    if (parser.has("config"))
+        load_config(parser.get<string>("config"), cfg);
+
+    string value;
+    if (get_option(parser, cfg, "headless", value))
+        headless = (value != "false" && value != "0");
+    if (get_option(parser, cfg, "vmin", value))
+        params.vmin = atoi(value.c_str());
+    if (get_option(parser, cfg, "vmax", value))
+        params.vmax = atoi(value.c_str());
+    if (get_option(parser, cfg, "smin", value))
+        params.smin = atoi(value.c_str());
+    if (get_option(parser, cfg, "ini_area", value))
+        params.ini_area = atoi(value.c_str());
+    if (get_option(parser, cfg, "roi", value)) {
+        if (sscanf(value.c_str(), "%d,%d,%d,%d",
+                   &roi.x, &roi.y, &roi.width, &roi.height) != 4 ||
+            roi.width <= 0 || roi.height <= 0) {
+            fprintf(stderr, "bad roi %s, expected x,y,width,height\n", value.c_str());
+            exit(EXIT_FAILURE);
+        }
+        has_roi = true;
+    }
+    get_option(parser, cfg, "model", model_file);
+    get_option(parser, cfg, "save_model", save_model_file);
+    if (get_option(parser, cfg, "rt_profile", value) &&
+        rt_profile_load(&rt, value.c_str()) != 0) {
+        fprintf(stderr, "can not read rt profile %s\n", value.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (get_option(parser, cfg, "verbose", value))
+        verbose = (value != "false" && value != "0");
+    if (get_option(parser, cfg, "hfov", value))
+        hfov_deg = atof(value.c_str());
+    if (get_option(parser, cfg, "drones", value)) {
+        drone_ids.clear();
+        for (const char *p = value.c_str(); *p; ) {
+            char *end;
+            long id = strtol(p, &end, 10);
+            if (end == p || id < 0 || id >= MAX_DRONES ||
+                find(drone_ids.begin(), drone_ids.end(), (int)id) != drone_ids.end()) {
+                fprintf(stderr, "bad drone list %s, IDs from 0 to %d\n", value.c_str(), MAX_DRONES - 1);
+                exit(EXIT_FAILURE);
+            }
+            drone_ids.push_back((int)id);
+            p = (*end == ',') ? end + 1 : end;
+        }
+        if (drone_ids.empty()) {
+            fprintf(stderr, "empty drone list\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (get_option(parser, cfg, "workers", value))
+        workers = atoi(value.c_str());
+    if (get_option(parser, cfg, "threads", value))
+        strip_threads = atoi(value.c_str());
+    if (get_option(parser, cfg, "decode", value))
+        decode = (value != "false" && value != "0");
+    if (get_option(parser, cfg, "decode_threads", value))
+        decode_threads = atoi(value.c_str());
+    if (get_option(parser, cfg, "scale", value) && value != "auto") {
+        fixed_scale = atoi(value.c_str());
+        if (fixed_scale != 1 && fixed_scale != 2 && fixed_scale != 4) {
+            fprintf(stderr, "bad scale %s, expected 1, 2, 4 or auto\n", value.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (get_option(parser, cfg, "budget_ms", value)) {
+        budget_ms = atof(value.c_str());
+        if (budget_ms < 0) {
+            fprintf(stderr, "bad budget_ms %s\n", value.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (get_option(parser, cfg, "max_size", value)) {
+        if (sscanf(value.c_str(), "%dx%d", &max_frame_size.width, &max_frame_size.height) != 2 ||
+            max_frame_size.width <= 0 || max_frame_size.height <= 0 ||
+            rgb565_frame_size(max_frame_size.width, max_frame_size.height) > (size_t)DATA_SIZE) {
+            fprintf(stderr, "bad max_size %s, expected WIDTHxHEIGHT up to 1280x720\n", value.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (drone_ids.size() > 1 && !headless) {
+        fprintf(stderr, "several drones need --headless\n");
+        exit(EXIT_FAILURE);
+    }
+    if (decode && (!headless || drone_ids.size() > 1)) {
+        fprintf(stderr, "--decode needs --headless and a single drone\n");
+        exit(EXIT_FAILURE);
+    }
 
-    shmid = shmget((key_t)key, size, 0666|IPC_CREAT);
-    if (shmid == -1) {
-        fprintf(stderr, "shmget failed\n");
+    if (headless && !has_roi && model_file.empty()) {
+        fprintf(stderr, "headless mode needs --roi or --model\n");
         exit(EXIT_FAILURE);
     }
+}
+
+// a segment of an older layout is replaced, see frame_shm_attach
+void* create_shared_memory(key_t key, size_t size, int& shmid, int *fresh = NULL) {
+    int created;
+    void *shm = frame_shm_attach(key, size, &shmid, &created);
 
-    shm = shmat(shmid, 0, 0);
-    if (shm == (void*)-1) {
-        fprintf(stderr, "shmat failed\n");
+    if (shm == NULL) {
+        fprintf(stderr, "shmget/shmat failed\n");
         exit(EXIT_FAILURE);
     }
+    if (fresh)
+        *fresh = created;
     return shm;
 }
 
-static void rgb565_to_rgb888(const void * psrc, int w, int h, void * pdst)    
-{    
-    int srclinesize = UpAlign4(w * 2);    
-    int dstlinesize = UpAlign4(w * 3);    
-    
-    const unsigned char  * psrcline;    
-    const unsigned short * psrcdot;    
-    unsigned char  * pdstline;    
-    unsigned char  * pdstdot;    
-    
-    int i,j;    
-    
-    if (!psrc || !pdst || w <= 0 || h <= 0) {    
-        printf("rgb565_to_rgb888 : parameter error\n");    
-        return;    
-    }    
-    
-    psrcline = (const unsigned char *)psrc;    
-    pdstline = (unsigned char *)pdst;    
-    for (i=0; i<h; i++) {    
-        psrcdot = (const unsigned short *)psrcline;    
-        pdstdot = pdstline;    
-        for (j=0; j<w; j++) {    
-            //565 b|g|r -> 888 r|g|b    
-            *pdstdot++ = (unsigned char)(((*psrcdot) >> 0 ) << 3);    
-            *pdstdot++ = (unsigned char)(((*psrcdot) >> 5 ) << 2);    
-            *pdstdot++ = (unsigned char)(((*psrcdot) >> 11) << 3);    
-            psrcdot++;    
-        }    
-        psrcline += srclinesize;    
-        pdstline += dstlinesize;    
-    } 
+// Takes the imageProcess side of the channel of a drone, the control
+// process may be running since before us or start later
+static void claim_channel(tran_data *info, int shmid, int fresh, int drone)
+{
+    if (!fresh && info->image_pid != getpid() && frame_shm_peer_alive(info, 1)) {
+        fprintf(stderr, "drone %d is already served by imageProcess %d\n", drone, (int)info->image_pid);
+        exit(EXIT_FAILURE);
+    }
+    pid_t control = frame_shm_claim(info, shmid, fresh, 0);
+    if (control)
+        printf("drone %d: control process %d is running, reattached to it\n", drone, (int)control);
+}
+
+// the target of the imageProcess that ran before us on this channel
+static bool resume_target(tracker& t, track_params& p, const tran_data *info, int drone)
+{
+    track_resume saved;
+    if (track_resume_read(&info->resume, &saved) != 0 || !tracker_resume(t, p, saved))
+        return false;
+    printf("drone %d: resuming the target of the previous imageProcess\n", drone);
+    return true;
+}
+
+static void save_target(const tracker& t, const track_params& p, tran_data *info)
+{
+    track_resume saved;
+    if (tracker_checkpoint(t, p, saved))
+        track_resume_write(&info->resume, &saved);
+}
+
+// the scale of the next frame, published in the statistics page
+static void govern(scale_governor& g, tracker& t, const track_result& r, int64_t track_ns,
+                   int frame_id, int64_t stamp_ns, image_stats *st, int drone)
+{
+    bool switched = scale_governor_update(g, t, r, track_ns, frame_id, stamp_ns);
+    if (st) {
+        if (switched)
+            stat_add(&st->scale_switches, 1);
+        __atomic_store_n(&st->scale, (uint32_t)g.scale, __ATOMIC_RELAXED);
+        __atomic_store_n(&st->budget_us, (uint32_t)(scale_governor_budget(g) * 1000), __ATOMIC_RELAXED);
+    }
+    if (switched && verbose)
+        printf("drone %d: processing scale 1/%d, target %dx%d, track %.2f ms of %.2f ms\n",
+               drone, g.scale, t.window.width, t.window.height, g.cost_ms / (g.scale * g.scale),
+               scale_governor_budget(g));
+}
+
+// Removes the segment once we are the last one attached. Detaching is left
+// to exit, the copy thread may still be reading it.
+static void release_at_exit(int shmid)
+{
+    if (frame_shm_nattch(shmid) == 1)
+        shmctl(shmid, IPC_RMID, 0);
+}
+
+// short enough to notice quit, or a control process that went away
+static const long LOCK_TIMEOUT_MS = 100;
+
+// Motion of the scene in the image when the drone turns from prev to cur.
+// Yaw moves it sideways, pitch up and down, translations are ignored (no depth).
+static Point2f ego_shift(const nav_state& prev, const nav_state& cur, int w, int h)
+{
+    float f = (w / 2) / tan(hfov_deg * CV_PI / 360);
+    float dpsi = cur.psi - prev.psi, dtheta = cur.theta - prev.theta;
+    if (dpsi > 180)
+        dpsi -= 360;
+    else if (dpsi < -180)
+        dpsi += 360;
+    return Point2f(-f * tan(dpsi * CV_PI / 180), f * tan(dtheta * CV_PI / 180));
+}
+
+// helpers of the per-pixel pass, "image_strip" in the real-time profile
+static void strip_thread_init(int)
+{
+    rt_profile_apply(&rt, "image_strip");
+    TRACE_THREAD("image_strip");
 }
 
 void *copy_image_thread(void *arg) {
+    rt_profile_apply(&rt, "image_copy");
+    TRACE_THREAD("image_copy");
     printf("waiting frame\n");
-    for(;;) {
-        if (!semaphore_P(sem_id))
+    int seen_frame_id = -1;
+    Size rejected;
+    while (!quit) {
+        int64_t wait_start = frame_shm_now_ns();
+        TRACE_BEGIN(TRACE_COPY_WAIT, 0);
+        frame_shm_beat(shared_info, 0);
+        // the control process holds the frame : publishing, hung or restarting
+        int locked = semaphore_P_timed(sem_id, LOCK_TIMEOUT_MS);
+        if (locked == 0)
             exit(EXIT_FAILURE);
+        if (locked < 0) {
+            TRACE_END(TRACE_COPY_WAIT);
+            continue;
+        }
         if (!semaphore_P(sem_id2))
             exit(EXIT_FAILURE);
-        if (shared_info->frame_id != pre_frame_id) {
-            if (NULL == data)
-                data = (uint8_t*) malloc(sizeof(uint8_t)*shared_info->size);
-
-            width = shared_info->width;
-            height = shared_info->height;
-
-            memcpy(data, shared_data, shared_info->size);
+        TRACE_END(TRACE_COPY_WAIT);
+        int w = shared_info->width, h = shared_info->height;
+        bool fits = w > 0 && h > 0 && w <= frames.max_size.width && h <= frames.max_size.height &&
+                    shared_info->size >= (int)rgb565_frame_size(w, h) && shared_info->size <= DATA_SIZE;
+        if (shared_info->frame_id != seen_frame_id && !fits) {
+            // a resolution or codec switch, the next frames may fit again
+            if (rejected != Size(w, h))
+                fprintf(stderr, "%dx%d frame (%d bytes) does not fit the %dx%d buffers, dropped\n",
+                        w, h, shared_info->size, frames.max_size.width, frames.max_size.height);
+            rejected = Size(w, h);
+            seen_frame_id = shared_info->frame_id;
+        }
+        if (shared_info->frame_id != seen_frame_id) {
+            TRACE_BEGIN(TRACE_COPY, shared_info->frame_id);
+            int64_t copy_start = frame_shm_now_ns();
+            width = w;
+            height = h;
+            memcpy(&frames.raw[0], shared_data, rgb565_frame_size(w, h));
+            rejected = Size();
+            if (stats) {
+                stat_timer_add(&stats->copy_wait, copy_start - wait_start);
+                stat_timer_add(&stats->copy, frame_shm_now_ns() - copy_start);
+                stat_add(&stats->frames_copied, 1);
+                if (pre_frame_id >= 0 && shared_info->frame_id > pre_frame_id + 1)
+                    stat_add(&stats->frames_dropped, shared_info->frame_id - pre_frame_id - 1);
+            }
+            TRACE_END(TRACE_COPY);
 
-            pre_frame_id = shared_info->frame_id;
+            pre_frame_id = seen_frame_id = shared_info->frame_id;
+            frame_stamp_ns = shared_info->stamp_ns;
             //printf("get frame_id: %d size: %d\n", pre_frame_id, shared_info->size);
         }
         if (!semaphore_V(sem_id2))
@@ -191,97 +451,556 @@ void *copy_image_thread(void *arg) {
     return ((void*) 0);
 }
 
-int main() {
-    int info_shmid, data_shmid, err_shmid;
-    void *info_shm, *data_shm, *err_shm;
+// --decode : frames come from the H.264 stream of pre_stage instead of the
+// RGB565 copy of display_stage, and are handed to the tracking thread by
+// moving the decoded planes, nothing is copied
+void *decode_thread(void *arg) {
+    rt_profile_apply(&rt, "image_copy");
+    TRACE_THREAD("image_decode");
+    printf("waiting for an IDR frame\n");
+    yuv_frame fresh;
+    yuv_frame_init(fresh);
+    Size rejected;
+    while (!quit) {
+        frame_shm_beat(shared_info, 0);
+        int got = h264_source_next(h264, LOCK_TIMEOUT_MS, fresh);
+        if (got < 0)
+            exit(EXIT_FAILURE);
+        if (got == 0)
+            continue;
+        Size size(fresh.width, fresh.height);
+        if (size.width > frames.max_size.width || size.height > frames.max_size.height) {
+            if (rejected != size)
+                fprintf(stderr, "%dx%d frame does not fit the %dx%d buffers, dropped\n",
+                        size.width, size.height, frames.max_size.width, frames.max_size.height);
+            rejected = size;
+            continue;
+        }
+        rejected = Size();
+        TRACE_BEGIN(TRACE_COPY, fresh.frame_number);
+        if (!semaphore_P(sem_id2))
+            exit(EXIT_FAILURE);
+        // the frame the tracker did not get to is dropped
+        if (stats) {
+            stat_add(&stats->frames_copied, 1);
+            if (pre_frame_id >= 0 && (int)fresh.frame_number > pre_frame_id + 1)
+                stat_add(&stats->frames_dropped, fresh.frame_number - pre_frame_id - 1);
+        }
+        yuv_frame_move(decoded, fresh);
+        width = size.width;
+        height = size.height;
+        pre_frame_id = (int)decoded.frame_number;
+        frame_stamp_ns = decoded.stamp_ns;
+        if (!semaphore_V(sem_id2))
+            exit(EXIT_FAILURE);
+        TRACE_END(TRACE_COPY);
+    }
+    yuv_frame_release(fresh);
+    return ((void*) 0);
+}
+
+// --model may contain %d, replaced by the drone ID
+static string model_path(int drone)
+{
+    if (model_file.find("%d") == string::npos)
+        return model_file;
+    char buf[512];
+    snprintf(buf, sizeof(buf), model_file.c_str(), drone);
+    return buf;
+}
+
+// Fleet mode : one control process per drone, all served by a pool of
+// tracking threads. A drone has at most one frame in flight, its tracker
+// keeps state from frame to frame. Workers take the next drone with a new
+// frame after the last one served, so a busy drone can't starve the others.
+struct drone_channel {
+    int id;
+    tran_data *info;
+    uint8_t *shared;
+    area_err *err;
+    nav_state *nav;
+    int sem, sem3;
+    image_stats *stats;
+    tracker trk;
+    scale_governor governor;
+    track_params params;
+    frame_pool frames;
+    int last_frame_id;
+    bool busy;
+    bool offline;           // a semaphore operation failed, the control process is gone
+    int64_t offline_beat_ns;    // control_beat_ns when it went offline
+    int64_t retry_ns;           // next check for a control process back
+    nav_state prev_nav;
+    bool has_prev_nav;
+    rt_jitter_t latency;
+    uint64_t results;
+};
+
+struct fleet {
+    vector<drone_channel*> drones;
+    pthread_mutex_t lock;
+    size_t cursor;
+};
+
+// how often an offline drone is checked for a control process back
+static const int64_t OFFLINE_RETRY_NS = 1000000000LL;
+
+static void fleet_lost(drone_channel *d)
+{
+    d->offline_beat_ns = d->info->control_beat_ns;
+    d->retry_ns = frame_shm_now_ns() + OFFLINE_RETRY_NS;
+    fprintf(stderr, "drone %d: control process gone, no longer served\n", d->id);
+}
+
+// A control process running and beating again since the loss serves the
+// drone again. Its semaphores are opened again : the one that left may
+// have removed them, the new one uses the same keys.
+static void fleet_retry(drone_channel *d)
+{
+    int64_t now = frame_shm_now_ns();
+    if (now < d->retry_ns)
+        return;
+    d->retry_ns = now + OFFLINE_RETRY_NS;
+    const volatile tran_data *info = d->info;
+    if (!frame_shm_pid_alive(info->control_pid) || info->control_beat_ns == d->offline_beat_ns)
+        return;
+    int sem = open_semaphore(drone_key(SEM_KEY, d->id));
+    int sem3 = open_semaphore(drone_key(SEM_KEY3, d->id));
+    if (sem == -1 || sem3 == -1)
+        return;
+    d->sem = sem;
+    d->sem3 = sem3;
+    // the frames missed meanwhile are not drops, nor a turn of the drone
+    d->last_frame_id = -1;
+    d->has_prev_nav = false;
+    d->offline = false;
+    fprintf(stderr, "drone %d: control process back, served again\n", d->id);
+}
+
+static drone_channel *fleet_next(fleet& f)
+{
+    drone_channel *picked = NULL;
+    pthread_mutex_lock(&f.lock);
+    for (size_t k = 0; k < f.drones.size(); k++) {
+        size_t i = (f.cursor + k) % f.drones.size();
+        drone_channel *d = f.drones[i];
+        if (!d->busy && d->offline)
+            fleet_retry(d);
+        // frame_id is only a hint here, the copy reads it again under the semaphore
+        if (!d->busy && !d->offline && d->info->frame_id >= 0 &&
+            d->info->frame_id != d->last_frame_id) {
+            d->busy = true;
+            f.cursor = i + 1;
+            picked = d;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&f.lock);
+    return picked;
+}
+
+static void fleet_serve(drone_channel *d)
+{
+    int64_t wait_start = frame_shm_now_ns();
+    TRACE_BEGIN(TRACE_COPY, d->id);
+    frame_shm_beat(d->info, 0);
+    // the control process is hung or restarting, the frame is tried again later
+    int locked = semaphore_P_timed(d->sem, LOCK_TIMEOUT_MS);
+    if (locked <= 0) {
+        d->offline = locked == 0;
+        TRACE_END(TRACE_COPY);
+        return;
+    }
+    int64_t copy_start = frame_shm_now_ns();
+    int frame_id = d->info->frame_id, w = d->info->width, h = d->info->height;
+    int size = d->info->size;
+    int64_t stamp_ns = d->info->stamp_ns;
+    // a resolution or codec switch may publish a frame larger than the buffers
+    bool fits = w > 0 && h > 0 && w <= d->frames.max_size.width && h <= d->frames.max_size.height &&
+                size >= (int)rgb565_frame_size(w, h) && size <= DATA_SIZE;
+    if (fits)
+        memcpy(&d->frames.raw[0], d->shared, rgb565_frame_size(w, h));
+    if (!semaphore_V(d->sem)) {
+        d->offline = true;
+        TRACE_END(TRACE_COPY);
+        return;
+    }
+    TRACE_END(TRACE_COPY);
+    if (d->stats) {
+        stat_timer_add(&d->stats->copy_wait, copy_start - wait_start);
+        stat_timer_add(&d->stats->copy, frame_shm_now_ns() - copy_start);
+        stat_add(&d->stats->frames_copied, 1);
+        if (d->last_frame_id >= 0 && frame_id > d->last_frame_id + 1)
+            stat_add(&d->stats->frames_dropped, frame_id - d->last_frame_id - 1);
+    }
+    d->last_frame_id = frame_id;
+    if (!fits)
+        return;
+
+    if (d->frames.size != Size(w, h))
+        frame_pool_bind(d->frames, d->trk, Size(w, h));
+
+    nav_state nav;
+    if (hfov_deg > 0 && nav_state_read(d->nav, &nav) == 0) {
+        if (d->has_prev_nav)
+            tracker_shift(d->trk, ego_shift(d->prev_nav, nav, w, h), Size(w, h));
+        d->prev_nav = nav;
+        d->has_prev_nav = true;
+    }
+
+    track_result result;
+    int64_t track_start = frame_shm_now_ns();
+    TRACE_BEGIN(TRACE_TRACK, d->id);
+    // the drones already keep the cores busy, no strip pool here
+    bool tracked = tracker_process_rgb565(d->trk, &d->frames.raw[0], w, h, d->params, result);
+    TRACE_END(TRACE_TRACK);
+    int64_t track_ns = frame_shm_now_ns() - track_start;
+    if (d->stats) {
+        stat_timer_add(&d->stats->track, track_ns);
+        stat_add(&d->stats->frames_processed, 1);
+        stat_add(&d->stats->camshift_iterations, result.iterations);
+    }
+    if (!tracked)
+        return;
+    govern(d->governor, d->trk, result, track_ns, frame_id, stamp_ns, d->stats, d->id);
+    save_target(d->trk, d->params, d->info);
+
+    wait_start = frame_shm_now_ns();
+    TRACE_BEGIN(TRACE_RESULT, d->id);
+    // a control process that stopped reading drops the result
+    locked = semaphore_P_timed(d->sem3, LOCK_TIMEOUT_MS);
+    if (locked <= 0) {
+        d->offline = locked == 0;
+        TRACE_END(TRACE_RESULT);
+        return;
+    }
+    if (d->stats)
+        stat_timer_add(&d->stats->result_wait, frame_shm_now_ns() - wait_start);
+    d->err->x_err = result.x_err;
+    d->err->y_err = result.y_err;
+    d->err->z_err = result.z_err;
+    d->err->stamp_ns = stamp_ns;
+    if (!semaphore_V(d->sem3)) {
+        d->offline = true;
+        TRACE_END(TRACE_RESULT);
+        return;
+    }
+    area_err_publish(d->err);
+    TRACE_END(TRACE_RESULT);
+    d->results++;
+    if (d->stats)
+        stat_add(&d->stats->results, 1);
+    if (stamp_ns > 0)
+        rt_jitter_add(&d->latency, frame_shm_now_ns() - stamp_ns);
+    if (verbose)
+        printf("drone %d: %f %f %f\n", d->id, result.x_err, result.y_err, result.z_err);
+}
+
+// also how often idle workers beat and check quit and the offline drones
+static const long IDLE_WAIT_NS = LOCK_TIMEOUT_MS * 1000000L;
+
+static void *fleet_worker(void *arg)
+{
+    fleet& f = *(fleet*)arg;
+    rt_profile_apply(&rt, "image_track");
+    TRACE_THREAD("image_worker");
+    int n = (int)f.drones.size();
+    vector<tran_data*> infos(n);
+    vector<uint32_t> seqs(n);
+    for (int i = 0; i < n; i++)
+        infos[i] = f.drones[i]->info;
+    while (!quit) {
+        // taken before looking, a frame published in between ends the wait at once
+        for (int i = 0; i < n; i++)
+            seqs[i] = *(volatile uint32_t*)&infos[i]->frame_seq;
+        drone_channel *d = fleet_next(f);
+        if (d == NULL) {
+            // the served drones beat in fleet_serve, idle ones here
+            for (int i = 0; i < n; i++)
+                frame_shm_beat(infos[i], 0);
+            // older kernels : poll, less often than a frame period
+            if (frame_shm_wait_any(&infos[0], &seqs[0], n, IDLE_WAIT_NS) < 0)
+                usleep(2000);
+            continue;
+        }
+        bool was_offline = d->offline;
+        fleet_serve(d);
+        if (d->offline && !was_offline)
+            fleet_lost(d);
+        pthread_mutex_lock(&f.lock);
+        d->busy = false;
+        pthread_mutex_unlock(&f.lock);
+    }
+    return NULL;
+}
+
+static int serve_fleet()
+{
+    fleet f;
+    pthread_mutex_init(&f.lock, NULL);
+    f.cursor = 0;
+    TRACE_INIT(drone_key(TRACE_KEY_IMAGE, drone_ids[0]));
+
+    for (size_t i = 0; i < drone_ids.size(); i++) {
+        int id = drone_ids[i], shmid, fresh;
+        drone_channel *d = new drone_channel();
+        d->id = id;
+        d->info = (tran_data*)create_shared_memory(drone_key(SHARE_KEY, id), sizeof(tran_data), shmid, &fresh);
+        claim_channel(d->info, shmid, fresh, id);
+        d->shared = (uint8_t*)create_shared_memory(drone_key(DATA_KEY, id), DATA_SIZE, shmid);
+        d->err = (area_err*)create_shared_memory(drone_key(ERR_KEY, id), sizeof(area_err), shmid);
+        d->nav = (nav_state*)create_shared_memory(drone_key(NAV_KEY, id), sizeof(nav_state), shmid);
+        d->sem = open_semaphore(drone_key(SEM_KEY, id));
+        d->sem3 = open_semaphore(drone_key(SEM_KEY3, id));
+        if (d->sem == -1 || d->sem3 == -1) {
+            fprintf(stderr, "drone %d: semget failed\n", id);
+            exit(EXIT_FAILURE);
+        }
+        track_stats *page = track_stats_attach(drone_key(STATS_KEY, id), 0);
+        d->stats = page ? &page->image : NULL;
+        if (d->stats) {
+            memset(d->stats, 0, sizeof(*d->stats));
+            d->stats->pid = getpid();
+        }
+        d->params = params;
+        tracker_init(d->trk);
+        scale_governor_init(d->governor, fixed_scale, budget_ms);
+        d->trk.scale = d->governor.scale;
+        if (!model_file.empty()) {
+            string path = model_path(id);
+            if (!tracker_load_model(d->trk, d->params, path)) {
+                fprintf(stderr, "can not load model %s\n", path.c_str());
+                exit(EXIT_FAILURE);
+            }
+        }
+        else
+            tracker_select(d->trk, roi);
+        resume_target(d->trk, d->params, d->info, id);
+        frame_pool_init(d->frames, max_frame_size);
+        d->last_frame_id = -1;
+        d->busy = d->offline = false;
+        d->offline_beat_ns = d->retry_ns = 0;
+        d->has_prev_nav = false;
+        d->results = 0;
+        rt_jitter_init(&d->latency, "frame to result", 1 << 16);
+        f.drones.push_back(d);
+    }
+    rt_profile_lock_memory(&rt);
+
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int n = workers > 0 ? workers : min<int>((int)drone_ids.size(), max(cores, 1));
+    printf("serving %zu drones with %d workers\n", drone_ids.size(), n);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigset_t block, old_mask;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &old_mask);
+    vector<pthread_t> threads(n);
+    for (int i = 0; i < n; i++) {
+        if (pthread_create(&threads[i], NULL, fleet_worker, &f) != 0)
+            exit(EXIT_FAILURE);
+    }
+    // still blocked between the test and the wait, so no signal is lost there
+    while (!quit)
+        sigsuspend(&old_mask);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    // every wait of fleet_serve is bounded by LOCK_TIMEOUT_MS, the workers notice quit
+    for (int i = 0; i < n; i++)
+        pthread_join(threads[i], NULL);
+
+    for (size_t i = 0; i < f.drones.size(); i++) {
+        drone_channel *d = f.drones[i];
+        char label[64];
+        snprintf(label, sizeof(label), "drone %d, %llu results%s", d->id,
+                 (unsigned long long)d->results, d->offline ? ", offline" : "");
+        rt_jitter_report(&d->latency, label, stdout);
+        rt_jitter_close(&d->latency);
+        frame_shm_leave(d->info, 0);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    double start_time = now_ms();
+    double first_frame_time = -1, first_track_time = -1;
+    parse_options(argc, argv);
+    if (drone_ids.size() > 1)
+        return serve_fleet();
+    int drone = drone_ids[0];
+
+    int info_shmid, data_shmid, err_shmid, nav_shmid;
+    void *info_shm, *data_shm, *err_shm, *nav_shm;
 
     // shared memory
-    info_shm = create_shared_memory(SHARE_KEY, sizeof(tran_data), info_shmid);
-    data_shm = create_shared_memory(DATA_KEY, sizeof(uint8_t)*DATA_SIZE, data_shmid);
-    err_shm = create_shared_memory(ERR_KEY, sizeof(struct area_err), err_shmid);
+    int info_fresh;
+    info_shm = create_shared_memory(drone_key(SHARE_KEY, drone), sizeof(tran_data), info_shmid, &info_fresh);
+    claim_channel((tran_data*)info_shm, info_shmid, info_fresh, drone);
+    data_shm = create_shared_memory(drone_key(DATA_KEY, drone), sizeof(uint8_t)*DATA_SIZE, data_shmid);
+    err_shm = create_shared_memory(drone_key(ERR_KEY, drone), sizeof(struct area_err), err_shmid);
     shared_info = (struct tran_data*) info_shm;
     shared_data = (uint8_t*) data_shm;
     err_info = (struct area_err*) err_shm;
+    nav_shm = create_shared_memory(drone_key(NAV_KEY, drone), sizeof(struct nav_state), nav_shmid);
+    nav_shared = (struct nav_state*) nav_shm;
+    rt_prefault(shared_data, DATA_SIZE);
+    TRACE_INIT(drone_key(TRACE_KEY_IMAGE, drone));
+    TRACE_THREAD("image_track");
+    struct track_stats *stats_page = track_stats_attach(drone_key(STATS_KEY, drone), 0);
+    if (stats_page) {
+        stats = &stats_page->image;
+        memset(stats, 0, sizeof(*stats));
+        stats->pid = getpid();
+    }
+    rt_profile_lock_memory(&rt);
+    rt_jitter_t latency;
+    rt_jitter_init(&latency, "frame to result", 1 << 16);
 
-    // semaphore
-    sem_id = semget(SEM_KEY, 1, 0666 | IPC_CREAT);
-    sem_id2 = semget(SEM_KEY2, 1, 0666 | IPC_CREAT);
-    sem_id3 = semget(SEM_KEY3, 1, 0666 | IPC_CREAT);
-    if (!set_semvalue(sem_id2)) {
+    // semaphore, shared ones are not reset under a control process that may hold them
+    sem_id = open_semaphore(drone_key(SEM_KEY, drone));
+    sem_id2 = semget(drone_key(SEM_KEY2, drone), 1, 0666 | IPC_CREAT);
+    sem_id3 = open_semaphore(drone_key(SEM_KEY3, drone));
+    if (sem_id == -1 || sem_id3 == -1 || !set_semvalue(sem_id2)) {
             fprintf(stderr, "Failed to init semaphore\n");
             exit(EXIT_FAILURE);
     }
 
     // camshift
-    VideoCapture cap;
-    Rect trackWindow;
-    int hsize = 16;
-    float hranges[] = {0,180};
-    const float* phranges = hranges;
-
-    cout << hot_keys;
-    namedWindow( "CamShift Demo", WINDOW_AUTOSIZE );
-    namedWindow( "Histogram", 0 );
-    setMouseCallback( "CamShift Demo", onMouse, 0 );
-    createTrackbar( "Vmin", "CamShift Demo", &vmin, 256, 0 );
-    createTrackbar( "Vmax", "CamShift Demo", &vmax, 256, 0 );
-    createTrackbar( "Smin", "CamShift Demo", &smin, 256, 0 );
-    createTrackbar( "ini_area", "CamShift Demo", &ini_area, 80000, 0 );
-
-    Mat frame, hsv, hue, mask, hist, histimg = Mat::zeros(200, 320, CV_8UC3), backproj;
+    tracker_init(trk);
+    scale_governor_init(governor, fixed_scale, budget_ms);
+    trk.scale = governor.scale;
+    // every buffer is allocated and touched before the first frame
+    frame_pool_init(frames, max_frame_size);
+
+    if (!headless) {
+        cout << hot_keys;
+        namedWindow( "CamShift Demo", WINDOW_AUTOSIZE );
+        namedWindow( "Histogram", 0 );
+        setMouseCallback( "CamShift Demo", onMouse, 0 );
+        createTrackbar( "Vmin", "CamShift Demo", &params.vmin, 256, 0 );
+        createTrackbar( "Vmax", "CamShift Demo", &params.vmax, 256, 0 );
+        createTrackbar( "Smin", "CamShift Demo", &params.smin, 256, 0 );
+        createTrackbar( "ini_area", "CamShift Demo", &params.ini_area, 80000, 0 );
+    }
+
+    Mat histimg = Mat::zeros(200, 320, CV_8UC3);
     bool paused = false;
+    int processed_frame_id = -1;
+    nav_state nav, prev_nav;
+    bool has_prev_nav = false;
 
-    // thread to load data
-    int err = pthread_create(&ntid, NULL, copy_image_thread, NULL);
+    if (!model_file.empty()) {
+        string path = model_path(drone);
+        if (!tracker_load_model(trk, params, path)) {
+            fprintf(stderr, "can not load model %s\n", path.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (has_roi) {
+        tracker_select(trk, roi);
+    }
+    // a restart in flight goes on with the live target, not the initial one
+    resume_target(trk, params, shared_info, drone);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // thread to load data, signals are left to the tracking loop
+    sigset_t block, old_mask;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &old_mask);
+    if (decode) {
+        h264 = h264_source_open(drone, decode_threads);
+        if (h264 == NULL)
+            exit(EXIT_FAILURE);
+        yuv_frame_init(decoded);
+    }
+    int err = pthread_create(&ntid, NULL, decode ? decode_thread : copy_image_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
     if (err != 0)
         exit(EXIT_FAILURE);
+    // before the profile of the tracking thread, the helpers would inherit it
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    strip_pool *pool = strip_pool_create(strip_threads > 0 ? strip_threads : max(cores, 1), strip_thread_init);
+    trk.pool = pool;
+    // after pthread_create, the copy thread would inherit the settings
+    rt_profile_apply(&rt, "image_track");
 
-    IplImage *src = NULL;
-    IplImage *dst = NULL;
-    for(;;) {
-        if (!semaphore_P(sem_id2))
+    while (!quit) {
+        if (!semaphore_P(sem_id2)) {
+            if (quit)
+                break;
             exit(EXIT_FAILURE);
-        if (pre_frame_id == -1 || data == NULL) {
+        }
+        if (pre_frame_id == -1 ||
+            (headless && pre_frame_id == processed_frame_id)) {
             if (!semaphore_V(sem_id2))
                 exit(EXIT_FAILURE);
+            // without waitKey nothing paces the loop
+            if (headless)
+                usleep(1000);
             continue;
         }
-        if (NULL == realdata)
-            realdata = (uint8_t*)malloc(sizeof(uint8_t)*height*width*3);
-        rgb565_to_rgb888(data, width, height, realdata);
-
-        //printf("processing frame: %d\n", pre_frame_id);
-        if (src == NULL)
-            src = cvCreateImage(cvSize(width,height), IPL_DEPTH_8U, 3);
-        if (dst == NULL)
-            dst = cvCreateImage(cvSize(width,height), IPL_DEPTH_8U, 3);
-        src->imageData = (char*)realdata;
-        cvCvtColor(src, dst, CV_RGB2BGR);
-        image = cv::cvarrToMat(src);
+        processed_frame_id = pre_frame_id;
+        int64_t processed_stamp_ns = frame_stamp_ns;
+        if (first_frame_time < 0)
+            first_frame_time = now_ms();
+        // the copy thread only takes frames that fit
+        if (frames.size != Size(width, height))
+            frame_pool_bind(frames, trk, Size(width, height));
+        // headless, the tracker reads the RGB565 frame itself
+        if (!headless) {
+            int64_t convert_start = frame_shm_now_ns();
+            TRACE_BEGIN(TRACE_CONVERT, processed_frame_id);
+            rgb565_to_rgb888(&frames.raw[0], width, height, frames.bgr.data);
+            TRACE_END(TRACE_CONVERT);
+            if (stats)
+                stat_timer_add(&stats->convert, frame_shm_now_ns() - convert_start);
+
+            //printf("processing frame: %d\n", pre_frame_id);
+            image = frames.bgr;
+        }
 
         if( !paused )
         {
-            cvtColor(image, hsv, COLOR_BGR2HSV);
-            if( trackObject )
+            // nothing is published until the control process gets navdata
+            if (hfov_deg > 0 && nav_state_read(nav_shared, &nav) == 0) {
+                if (has_prev_nav)
+                    tracker_shift(trk, ego_shift(prev_nav, nav, width, height), Size(width, height));
+                prev_nav = nav;
+                has_prev_nav = true;
+            }
+            track_result result;
+            int64_t track_start = frame_shm_now_ns();
+            TRACE_BEGIN(TRACE_TRACK, processed_frame_id);
+            bool tracked = decode ?
+                tracker_process_yuv420(trk, decoded.planes, decoded.steps, width, height, params, result) :
+                headless ?
+                tracker_process_rgb565(trk, &frames.raw[0], width, height, params, result) :
+                tracker_process(trk, image, params, result);
+            TRACE_END(TRACE_TRACK);
+            int64_t track_ns = frame_shm_now_ns() - track_start;
+            if (stats) {
+                stat_timer_add(&stats->track, track_ns);
+                stat_add(&stats->frames_processed, 1);
+                stat_add(&stats->camshift_iterations, result.iterations);
+            }
+            if( tracked )
             {
-                //printf("tracking\n");
-                int _vmin = vmin, _vmax = vmax;
-
-                inRange(hsv, Scalar(0, smin, MIN(_vmin,_vmax)),
-                        Scalar(180, 256, MAX(_vmin, _vmax)), mask);
-                int ch[] = {0, 0};
-                hue.create(hsv.size(), hsv.depth());
-                mixChannels(&hsv, 1, &hue, 1, ch, 1);
-
-                if( trackObject < 0 )
+                govern(governor, trk, result, track_ns, processed_frame_id, processed_stamp_ns, stats, drone);
+                if( result.new_hist && !headless )
                 {
-                    Mat roi(hue, selection), maskroi(mask, selection);
-                    calcHist(&roi, 1, 0, maskroi, hist, 1, &hsize, &phranges);
-                    normalize(hist, hist, 0, 255, NORM_MINMAX);
-
-                    trackWindow = selection;
-                    trackObject = 1;
-
+                    int hsize = trk.hsize;
                     histimg = Scalar::all(0);
                     int binW = histimg.cols / hsize;
                     Mat buf(1, hsize, CV_8UC3);
@@ -291,109 +1010,147 @@ int main() {
 
                     for( int i = 0; i < hsize; i++ )
                     {
-                        int val = saturate_cast<int>(hist.at<float>(i)*histimg.rows/255);
+                        int val = saturate_cast<int>(trk.hist.at<float>(i)*histimg.rows/255);
                         rectangle( histimg, Point(i*binW,histimg.rows),
                                    Point((i+1)*binW,histimg.rows - val),
                                    Scalar(buf.at<Vec3b>(i)), -1, 8 );
                     }
                 }
 
-                calcBackProject(&hue, 1, 0, hist, backproj, &phranges);
-                backproj &= mask;
-                RotatedRect trackBox = CamShift(backproj, trackWindow,
-                                    TermCriteria( TermCriteria::EPS | TermCriteria::COUNT, 10, 1 ));
-                if( trackWindow.area() <= 1 )
+                int64_t wait_start = frame_shm_now_ns();
+                TRACE_BEGIN(TRACE_RESULT, processed_frame_id);
+                // a control process that stopped reading drops the result, not the tracker
+                int locked = semaphore_P_timed(sem_id3, LOCK_TIMEOUT_MS);
+                if (locked == 0) {
+                    if (quit) {
+                        semaphore_V(sem_id2);
+                        break;
+                    }
+                    exit(EXIT_FAILURE);
+                }
+                if (stats)
+                    stat_timer_add(&stats->result_wait, frame_shm_now_ns() - wait_start);
+                if (locked > 0) {
+                    err_info->x_err = result.x_err;
+                    err_info->y_err = result.y_err;
+                    err_info->z_err = result.z_err;
+                    err_info->stamp_ns = processed_stamp_ns;
+                    if (!semaphore_V(sem_id3))
+                        exit(EXIT_FAILURE);
+                    area_err_publish(err_info);
+                }
+                TRACE_END(TRACE_RESULT);
+                save_target(trk, params, shared_info);
+                if (stats && locked > 0)
+                    stat_add(&stats->results, 1);
+                if (processed_stamp_ns > 0)
+                    rt_jitter_add(&latency, frame_shm_now_ns() - processed_stamp_ns);
+                if (verbose)
+                    printf("%f %f %f \n", result.x_err, result.y_err, result.z_err);
+                if (first_track_time < 0) {
+                    first_track_time = now_ms();
+                    printf("time to first track: %.1f ms (first frame after %.1f ms)\n",
+                           first_track_time - start_time, first_frame_time - start_time);
+                }
+                if( !headless )
                 {
-                    int cols = backproj.cols, rows = backproj.rows, r = (MIN(cols, rows) + 5)/6;
-                    trackWindow = Rect(trackWindow.x - r, trackWindow.y - r,
-                                       trackWindow.x + r, trackWindow.y + r) &
-                                  Rect(0, 0, cols, rows);
+                    if( backprojMode )
+                    {
+                        // the back projection of a reduced scale, blown up to the frame
+                        Mat bp(trk.backproj, Rect(0, 0, width / result.scale, height / result.scale));
+                        if (result.scale > 1)
+                            resize(bp, bp, Size(width, height), 0, 0, INTER_NEAREST);
+                        cvtColor( bp, image, COLOR_GRAY2BGR );
+                    }
+                    ellipse( image, result.box, Scalar(0,0,255), 3, 16 );
                 }
-                Size rect_size = trackBox.size;
-                Point2f center = trackBox.center;
-                //printf("selectObject%d selection->width:%d, selection->height:%d\n", selectObject, rect_size.width, rect_size.height);
-                if (!semaphore_P(sem_id3))
-                    exit(EXIT_FAILURE);
-                err_info->x_err = (center.x - width / 2) / 320;
-                err_info->y_err = (center.y - height / 2) / 240;
-                int alpha = (ini_area > rect_size.width * rect_size.height) ? 1 : -1;
-                err_info->z_err = sqrt(abs((float)(ini_area - rect_size.width * rect_size.height)) / 640 / 480) * alpha * 0.3;
-                if (!semaphore_V(sem_id3))
-                    exit(EXIT_FAILURE);
-                printf("%f %f %f \n", err_info->x_err, err_info->y_err, err_info->z_err);
-                if( backprojMode )
-                    cvtColor( backproj, image, COLOR_GRAY2BGR );
-                ellipse( image, trackBox, Scalar(0,0,255), 3, 16 );
             }
         }
-        else if( trackObject < 0 )
+        else if( trk.state < 0 )
             paused = false;
 
-        if( selectObject && selection.width > 0 && selection.height > 0 )
+        if( !headless )
         {
-            Mat roi(image, selection);
-            bitwise_not(roi, roi);
-        }
-        imshow( "CamShift Demo", image );
-        imshow( "Histogram", histimg );
+            if( selectObject && selection.width > 0 && selection.height > 0 )
+            {
+                Mat roi(image, selection);
+                bitwise_not(roi, roi);
+            }
+            imshow( "CamShift Demo", image );
+            imshow( "Histogram", histimg );
 
-        char c = (char)waitKey(10);
-        if( c == 27 )
-            break;
-        switch(c)
-        {
-        case 'b':
-            backprojMode = !backprojMode;
-            break;
-        case 'c':
-            trackObject = 0;
-            histimg = Scalar::all(0);
-            break;
-        case 'h':
-            showHist = !showHist;
-            if( !showHist )
-                destroyWindow( "Histogram" );
-            else
-                namedWindow( "Histogram", 1 );
-            break;
-        case 'p':
-            paused = !paused;
-            break;
-        default:
-            ;
+            char c = (char)waitKey(10);
+            if( c == 27 )
+            {
+                semaphore_V(sem_id2);
+                break;
+            }
+            switch(c)
+            {
+            case 'b':
+                backprojMode = !backprojMode;
+                break;
+            case 'c':
+                tracker_reset(trk);
+                histimg = Scalar::all(0);
+                break;
+            case 'h':
+                showHist = !showHist;
+                if( !showHist )
+                    destroyWindow( "Histogram" );
+                else
+                    namedWindow( "Histogram", 1 );
+                break;
+            case 'p':
+                paused = !paused;
+                break;
+            case 's':
+                if (save_model_file.empty())
+                    printf("no --save_model file given\n");
+                else if (!tracker_save_model(trk, params, save_model_file))
+                    fprintf(stderr, "can not save model %s\n", save_model_file.c_str());
+                else
+                    printf("model saved to %s\n", save_model_file.c_str());
+                break;
+            default:
+                ;
+            }
         }
         //printf("end processing\n");
         if (!semaphore_V(sem_id2))
             exit(EXIT_FAILURE);
     }
-    void *trect;
-    pthread_join(ntid, &trect);
-    if (NULL != data) {
-        free(data);
-        data = NULL;
-    }
-    if (NULL != realdata) {
-        free(realdata);
-        realdata = NULL;
-    }
-    if (shmdt((void*)shared_info) == -1) {
-        fprintf(stderr, "shmdt failed\n");
-        exit(EXIT_FAILURE);
-    }
-
-    if (shmctl(info_shmid, IPC_RMID, 0) == -1) {
-        fprintf(stderr, "shmtcl(RMID) failed\n");
-        exit(EXIT_FAILURE);
-    }
-
-    if (shmdt((void*)shared_data) == -1) {
-        fprintf(stderr, "shmdt failed\n");
-        exit(EXIT_FAILURE);
+    quit = 1;
+    if (first_track_time < 0)
+        printf("no target was tracked after %.1f ms\n", now_ms() - start_time);
+    rt_jitter_report(&latency, rt.loaded ? "profile" : "default", stdout);
+    rt_jitter_close(&latency);
+    if (!save_model_file.empty() && !tracker_save_model(trk, params, save_model_file))
+        fprintf(stderr, "can not save model %s\n", save_model_file.c_str());
+    trk.pool = NULL;
+    strip_pool_destroy(pool);
+    // the copy or decoder thread waits LOCK_TIMEOUT_MS at most for a frame,
+    // sem_id2 is not held any more
+    pthread_join(ntid, NULL);
+    if (h264) {
+        const h264_source_stats& hs = h264_source_get_stats(h264);
+        printf("decoded %llu frames of %llu access units, %.1f kB each, %llu gaps, %llu skipped before an IDR frame\n",
+               (unsigned long long)hs.frames, (unsigned long long)hs.packets,
+               hs.packets ? hs.bytes / 1024.0 / hs.packets : 0.0,
+               (unsigned long long)hs.gaps, (unsigned long long)hs.skipped);
+        yuv_frame_release(decoded);
+        h264_source_close(h264);
     }
-
-    if (shmctl(data_shmid, IPC_RMID, 0) == -1) {
-        fprintf(stderr, "shmtcl(RMID) failed\n");
-        exit(EXIT_FAILURE);
+    bool control_alive = frame_shm_pid_alive(shared_info->control_pid);
+    frame_shm_leave(shared_info, 0);
+    release_at_exit(info_shmid);
+    release_at_exit(data_shmid);
+    release_at_exit(err_shmid);
+    release_at_exit(nav_shmid);
+    // a running control process keeps its locks for the next imageProcess
+    if (!control_alive) {
+        del_semaphore(sem_id);
+        del_semaphore(sem_id3);
     }
     del_semaphore(sem_id2);
     return 0;
@@ -0,0 +1,440 @@
+/**
+ * Serves a pre_stage -e recording as the AR.Drone 2 video stream.
+ *
+ * The H.264 elementary stream is split into access units, each one is
+ * wrapped in a PaVE header as the drone does and sent on the video TCP port
+ * (5555) to the control binary, which decodes, records and publishes the
+ * frames exactly as in flight. Frames are paced at the recording rate, a
+ * multiple of it, or sent as fast as the receiver reads them, so the whole
+ * decode, publish and track path can be measured on the ground.
+ *
+ * Run it next to drone_sim on the same address (-i of the control binary).
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+#include "timing.h"
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+using namespace std;
+
+const char* keys =
+{
+    "{help h     |         | show help message}"
+    "{@input     |         | H.264 stream recorded with -e}"
+    "{ip         |127.0.0.2| address to serve on}"
+    "{port       |5555     | video port}"
+    "{fps        |30       | rate of the recording}"
+    "{speed      |1        | pacing multiplier, 0 sends as fast as the receiver reads}"
+    "{loop       |         | restart from the first frame at the end}"
+    "{size       |         | WIDTHxHEIGHT, read from the SPS if not given}"
+};
+
+#define PAVE_VERSION        2
+#define PAVE_CODEC_H264     4
+#define FRAME_TYPE_IDR      1
+#define FRAME_TYPE_P        3
+
+#define NAL_SLICE           1
+#define NAL_IDR             5
+#define NAL_SPS             7
+#define NAL_PPS             8
+#define NAL_AUD             9
+
+// parrot_video_encapsulation_t of the SDK, 64 byte version
+#pragma pack(push, 1)
+struct pave_header {
+    uint8_t  signature[4];
+    uint8_t  version;
+    uint8_t  video_codec;
+    uint16_t header_size;
+    uint32_t payload_size;
+    uint16_t encoded_stream_width;
+    uint16_t encoded_stream_height;
+    uint16_t display_width;
+    uint16_t display_height;
+    uint32_t frame_number;
+    uint32_t timestamp;             // ms
+    uint8_t  total_chuncks;
+    uint8_t  chunck_index;
+    uint8_t  frame_type;
+    uint8_t  control;
+    uint32_t stream_bytes_position_lw;
+    uint32_t stream_bytes_position_uw;
+    uint16_t stream_id;
+    uint8_t  total_slices;
+    uint8_t  slice_index;
+    uint8_t  header1_size;          // SPS of an IDR frame
+    uint8_t  header2_size;          // PPS of an IDR frame
+    uint8_t  reserved2[2];
+    uint32_t advertised_size;
+    uint8_t  reserved3[12];
+};
+#pragma pack(pop)
+
+struct access_unit {
+    size_t offset;
+    size_t size;
+    bool idr;
+    size_t sps_nal;         // SPS without its start code
+    size_t sps_nal_size;
+    int sps_size;
+    int pps_size;
+};
+
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal(int)
+{
+    quit = 1;
+}
+
+// next start code at or after pos, returns its offset and length
+static bool find_start_code(const uint8_t* p, size_t size, size_t pos, size_t& at, int& len)
+{
+    for (size_t i = pos; i + 3 <= size; i++) {
+        if (p[i] != 0 || p[i + 1] != 0)
+            continue;
+        if (p[i + 2] == 1) {
+            // a leading zero belongs to a 4 byte start code
+            if (i > pos && p[i - 1] == 0) {
+                at = i - 1;
+                len = 4;
+            }
+            else {
+                at = i;
+                len = 3;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// splits the stream into access units: a new one starts at an AUD, an SPS,
+// or a slice with first_mb_in_slice == 0 following a slice
+static void split_stream(const uint8_t* p, size_t size, vector<access_unit>& units)
+{
+    size_t at;
+    int len;
+    if (!find_start_code(p, size, 0, at, len))
+        return;
+    access_unit cur = { at, 0, false, 0, 0, 0, 0 };
+    bool has_slice = false;
+    while (true) {
+        size_t nal = at + len;
+        size_t next;
+        int next_len;
+        bool more = find_start_code(p, size, nal, next, next_len);
+        size_t end = more ? next : size;
+        if (nal >= end)
+            break;
+        int type = p[nal] & 0x1F;
+        bool first_slice = (type == NAL_SLICE || type == NAL_IDR) && nal + 1 < end && (p[nal + 1] & 0x80);
+        if (has_slice && (type == NAL_AUD || type == NAL_SPS || type == NAL_PPS || first_slice)) {
+            cur.size = at - cur.offset;
+            units.push_back(cur);
+            access_unit next_unit = { at, 0, false, 0, 0, 0, 0 };
+            cur = next_unit;
+            has_slice = false;
+        }
+        if (type == NAL_SPS) {
+            cur.sps_nal = nal;
+            cur.sps_nal_size = end - nal;
+            cur.sps_size = (int)(end - at);
+        }
+        else if (type == NAL_PPS)
+            cur.pps_size = (int)(end - at);
+        else if (type == NAL_IDR)
+            cur.idr = true;
+        if (type == NAL_SLICE || type == NAL_IDR)
+            has_slice = true;
+        if (!more)
+            break;
+        at = next;
+        len = next_len;
+    }
+    if (has_slice) {
+        cur.size = size - cur.offset;
+        units.push_back(cur);
+    }
+}
+
+// exp-Golomb reader over an SPS without its emulation prevention bytes
+struct bit_reader {
+    vector<uint8_t> data;
+    size_t bit;
+};
+
+static unsigned read_bits(bit_reader& r, int n)
+{
+    unsigned v = 0;
+    for (int i = 0; i < n; i++, r.bit++) {
+        size_t byte = r.bit / 8;
+        int b = byte < r.data.size() ? (r.data[byte] >> (7 - r.bit % 8)) & 1 : 0;
+        v = (v << 1) | b;
+    }
+    return v;
+}
+
+static unsigned read_ue(bit_reader& r)
+{
+    int zeros = 0;
+    while (read_bits(r, 1) == 0 && zeros < 32)
+        zeros++;
+    return (1u << zeros) - 1 + read_bits(r, zeros);
+}
+
+static int read_se(bit_reader& r)
+{
+    unsigned v = read_ue(r);
+    return (v & 1) ? (int)((v + 1) / 2) : -(int)(v / 2);
+}
+
+// coded and cropped picture size from the SPS NAL (after the start code)
+static bool parse_sps(const uint8_t* nal, size_t size, int& coded_w, int& coded_h, int& width, int& height)
+{
+    bit_reader r;
+    r.bit = 8;      // NAL header
+    for (size_t i = 0; i < size; i++) {
+        if (i >= 2 && nal[i] == 3 && nal[i - 1] == 0 && nal[i - 2] == 0)
+            continue;
+        r.data.push_back(nal[i]);
+    }
+    unsigned profile = read_bits(r, 8);
+    read_bits(r, 16);       // constraints, level
+    read_ue(r);             // sps id
+    unsigned chroma = 1;
+    if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 ||
+        profile == 83 || profile == 86 || profile == 118 || profile == 128) {
+        chroma = read_ue(r);
+        if (chroma == 3)
+            read_bits(r, 1);
+        read_ue(r);
+        read_ue(r);
+        read_bits(r, 1);
+        if (read_bits(r, 1))
+            return false;   // scaling matrices, not produced by the drone
+    }
+    read_ue(r);             // log2_max_frame_num
+    unsigned poc_type = read_ue(r);
+    if (poc_type == 0)
+        read_ue(r);
+    else if (poc_type == 1) {
+        read_bits(r, 1);
+        read_se(r);
+        read_se(r);
+        unsigned n = read_ue(r);
+        for (unsigned i = 0; i < n && i < 256; i++)
+            read_se(r);
+    }
+    read_ue(r);             // num_ref_frames
+    read_bits(r, 1);
+    unsigned mbs_w = read_ue(r) + 1;
+    unsigned map_h = read_ue(r) + 1;
+    unsigned frame_mbs_only = read_bits(r, 1);
+    if (!frame_mbs_only)
+        read_bits(r, 1);
+    read_bits(r, 1);        // direct_8x8_inference
+    coded_w = mbs_w * 16;
+    coded_h = map_h * 16 * (2 - frame_mbs_only);
+    width = coded_w;
+    height = coded_h;
+    if (read_bits(r, 1)) {
+        unsigned left = read_ue(r), right = read_ue(r), top = read_ue(r), bottom = read_ue(r);
+        int unit_x = chroma == 1 || chroma == 2 ? 2 : 1;
+        int unit_y = (chroma == 1 ? 2 : 1) * (2 - frame_mbs_only);
+        width -= (left + right) * unit_x;
+        height -= (top + bottom) * unit_y;
+    }
+    return width > 0 && height > 0 && width <= 4096 && height <= 4096;
+}
+
+static bool send_all(int fd, struct iovec* iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR && !quit)
+                continue;
+            return false;
+        }
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    CommandLineParser parser(argc, argv, keys);
+    if (parser.has("help") || !parser.has("@input")) {
+        parser.printMessage();
+        return parser.has("help") ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    string input = parser.get<string>("@input");
+    string ip = parser.get<string>("ip");
+    int port = parser.get<int>("port");
+    double fps = parser.get<double>("fps");
+    double speed = parser.get<double>("speed");
+    bool loop = parser.has("loop");
+    if (fps <= 0 || speed < 0) {
+        fprintf(stderr, "bad fps or speed\n");
+        return EXIT_FAILURE;
+    }
+
+    int fd = open(input.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+        fprintf(stderr, "can not open %s\n", input.c_str());
+        return EXIT_FAILURE;
+    }
+    const uint8_t* stream = (const uint8_t*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (stream == MAP_FAILED) {
+        fprintf(stderr, "can not map %s\n", input.c_str());
+        return EXIT_FAILURE;
+    }
+    vector<access_unit> units;
+    split_stream(stream, st.st_size, units);
+    // the decoder can not start before an IDR frame
+    size_t first = 0;
+    while (first < units.size() && !units[first].idr)
+        first++;
+    if (first == units.size()) {
+        fprintf(stderr, "no IDR frame in %s\n", input.c_str());
+        return EXIT_FAILURE;
+    }
+
+    int coded_w = 0, coded_h = 0, width = 0, height = 0;
+    if (parser.has("size")) {
+        if (sscanf(parser.get<string>("size").c_str(), "%dx%d", &width, &height) != 2 ||
+            width <= 0 || height <= 0) {
+            fprintf(stderr, "bad size, expected WIDTHxHEIGHT\n");
+            return EXIT_FAILURE;
+        }
+        coded_w = (width + 15) & ~15;
+        coded_h = (height + 15) & ~15;
+    }
+    else {
+        const access_unit& u = units[first];
+        if (u.sps_size == 0 ||
+            !parse_sps(stream + u.sps_nal, u.sps_nal_size, coded_w, coded_h, width, height)) {
+            fprintf(stderr, "can not read the picture size, use --size\n");
+            return EXIT_FAILURE;
+        }
+    }
+    printf("%s: %d frames from the first IDR, %dx%d (coded %dx%d)\n", input.c_str(),
+           (int)(units.size() - first), width, height, coded_w, coded_h);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr(ip.c_str());
+    if (bind(server, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(server, 1) < 0) {
+        fprintf(stderr, "can not listen on %s:%d: %s\n", ip.c_str(), port, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    while (!quit) {
+        printf("waiting for the control binary on %s:%d\n", ip.c_str(), port);
+        int conn = accept(server, NULL, NULL);
+        if (conn < 0)
+            continue;
+        setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        double start = now_ms();
+        double blocked = 0;
+        uint64_t position = 0;
+        int sent = 0;
+        size_t i = first;
+        while (!quit) {
+            if (i == units.size()) {
+                if (!loop)
+                    break;
+                i = first;
+            }
+            const access_unit& u = units[i++];
+            double time_ms = sent * 1000.0 / fps;
+            if (speed > 0)
+                sleep_until_ms(start + time_ms / speed);
+
+            pave_header h;
+            memset(&h, 0, sizeof(h));
+            memcpy(h.signature, "PaVE", 4);
+            h.version = PAVE_VERSION;
+            h.video_codec = PAVE_CODEC_H264;
+            h.header_size = sizeof(h);
+            h.payload_size = u.size;
+            h.encoded_stream_width = coded_w;
+            h.encoded_stream_height = coded_h;
+            h.display_width = width;
+            h.display_height = height;
+            h.frame_number = sent + 1;
+            h.timestamp = (uint32_t)time_ms;
+            h.total_chuncks = 1;
+            h.frame_type = u.idr ? FRAME_TYPE_IDR : FRAME_TYPE_P;
+            h.stream_bytes_position_lw = (uint32_t)position;
+            h.stream_bytes_position_uw = (uint32_t)(position >> 32);
+            h.total_slices = 1;
+            h.header1_size = u.idr ? u.sps_size : 0;
+            h.header2_size = u.idr ? u.pps_size : 0;
+            h.advertised_size = u.size;
+
+            struct iovec iov[2];
+            iov[0].iov_base = &h;
+            iov[0].iov_len = sizeof(h);
+            iov[1].iov_base = (void*)(stream + u.offset);
+            iov[1].iov_len = u.size;
+            // the socket only blocks when the receiver does not keep up
+            double t0 = now_ms();
+            if (!send_all(conn, iov, 2))
+                break;
+            blocked += now_ms() - t0;
+            position += u.size;
+            sent++;
+        }
+        close(conn);
+
+        double elapsed = now_ms() - start;
+        printf("frames: %d time: %.1f ms fps: %.1f (recorded %.1f) %.2f Mbit/s blocked in send: %.1f ms\n",
+               sent, elapsed, sent * 1000.0 / elapsed, fps, position * 8 / elapsed / 1000, blocked);
+        if (!loop)
+            break;
+    }
+    close(server);
+    munmap((void*)stream, st.st_size);
+    return 0;
+}
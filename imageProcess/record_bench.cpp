@@ -0,0 +1,145 @@
+/**
+ * Compression benchmark for frame records.
+ *
+ * Every frame of the given recordings is decoded to raw pixels, then encoded
+ * and decoded again with each codec of frame_codec.h the same way the
+ * recording stage does it (a key frame every FRAME_CODEC_KEY_INTERVAL frames
+ * for the delta codec). The compression ratio, the encode and decode
+ * throughput and how much faster than the recording rate a reader decodes
+ * are reported.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "recording.h"
+#include "timing.h"
+
+using namespace std;
+
+struct codec_stats {
+    uint64_t raw_bytes;
+    uint64_t encoded_bytes;
+    double encode_ms;
+    double decode_ms;
+    int key_frames;
+    int errors;
+};
+
+static const char* codec_name(int codec)
+{
+    switch (codec) {
+    case FRAME_CODEC_RAW: return "raw";
+    case FRAME_CODEC_LZ4: return "lz4";
+    case FRAME_CODEC_LZ4_DELTA: return "lz4-delta";
+    }
+    return "?";
+}
+
+static void bench_codec(const recording& rec, int codec, codec_stats& st)
+{
+    recording_decoder dec;
+    recording_decoder_init(dec);
+    vector<uint8_t> prev, tmp, encoded, decoded;
+    int since_key = 0;
+
+    memset(&st, 0, sizeof(st));
+    for (uint32_t i = 0; i < rec.count; i++) {
+        const frame_record_frame_header_t *hdr = recording_frame(rec, i);
+        const uint8_t *raw = recording_decode(rec, i, dec);
+        if (hdr == NULL || raw == NULL) {
+            st.errors++;
+            continue;
+        }
+        size_t raw_size = recording_raw_size(rec, hdr);
+        // same rule as the writer: key frames at an interval and on size changes
+        int c = codec;
+        if (c == FRAME_CODEC_LZ4_DELTA && (since_key == 0 || prev.size() != raw_size))
+            c = FRAME_CODEC_LZ4;
+        if (c == FRAME_CODEC_LZ4)
+            st.key_frames++;
+        since_key = (since_key + 1) % FRAME_CODEC_KEY_INTERVAL;
+
+        encoded.resize(frame_codec_bound(raw_size));
+        tmp.resize(raw_size);
+        decoded.resize(raw_size);
+
+        double t0 = now_ms();
+        size_t size = frame_codec_encode(c, raw, prev.empty() ? NULL : &prev[0], raw_size,
+                                         &tmp[0], &encoded[0], encoded.size());
+        double t1 = now_ms();
+        int res = size == 0 ? -1 :
+                  frame_codec_decode(c, &encoded[0], size, prev.empty() ? NULL : &prev[0],
+                                     &decoded[0], raw_size);
+        double t2 = now_ms();
+        if (res != 0 || memcmp(&decoded[0], raw, raw_size) != 0) {
+            st.errors++;
+            prev.clear();
+            since_key = 0;
+            continue;
+        }
+        st.raw_bytes += raw_size;
+        st.encoded_bytes += size;
+        st.encode_ms += t1 - t0;
+        st.decode_ms += t2 - t1;
+        prev.assign(decoded.begin(), decoded.end());
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s recording...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    static const int codecs[] = { FRAME_CODEC_RAW, FRAME_CODEC_LZ4, FRAME_CODEC_LZ4_DELTA };
+    int failed = 0;
+
+    printf("%-24s %-10s %7s %9s %8s %10s %10s %9s\n", "recording", "codec", "frames",
+           "raw MB", "ratio", "enc MB/s", "dec MB/s", "realtime");
+    for (int a = 1; a < argc; a++) {
+        recording rec;
+        if (!recording_open(rec, argv[a])) {
+            fprintf(stderr, "can not open %s\n", argv[a]);
+            failed++;
+            continue;
+        }
+        // recording rate from the capture timestamps
+        double duration_ms = 0;
+        if (rec.count > 1) {
+            const frame_record_frame_header_t *first = recording_frame(rec, 0);
+            const frame_record_frame_header_t *last = recording_frame(rec, rec.count - 1);
+            if (first != NULL && last != NULL)
+                duration_ms = (last->capture_us - first->capture_us) / 1000.0;
+        }
+        string name(argv[a]);
+        if (name.size() > 24)
+            name = "..." + name.substr(name.size() - 21);
+
+        for (size_t c = 0; c < sizeof(codecs) / sizeof(codecs[0]); c++) {
+            if (!frame_codec_available(codecs[c])) {
+                printf("%-24s %-10s not built in\n", name.c_str(), codec_name(codecs[c]));
+                continue;
+            }
+            codec_stats st;
+            bench_codec(rec, codecs[c], st);
+            double mb = st.raw_bytes / (1024.0 * 1024.0);
+            double enc = st.encode_ms > 0 ? mb * 1000 / st.encode_ms : 0;
+            double dec = st.decode_ms > 0 ? mb * 1000 / st.decode_ms : 0;
+            // how many times faster than the recording a reader decodes
+            double realtime = st.decode_ms > 0 && duration_ms > 0 ? duration_ms / st.decode_ms : 0;
+            printf("%-24s %-10s %7u %9.1f %8.2f %10.1f %10.1f %8.1fx\n", name.c_str(),
+                   codec_name(codecs[c]), rec.count, mb,
+                   st.encoded_bytes > 0 ? (double)st.raw_bytes / st.encoded_bytes : 0,
+                   enc, dec, realtime);
+            if (st.errors > 0) {
+                fprintf(stderr, "%s: %d frames failed with %s\n", argv[a], st.errors,
+                        codec_name(codecs[c]));
+                failed++;
+            }
+        }
+        recording_close(rec);
+    }
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,154 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "recording.h"
+
+using namespace std;
+
+static bool frame_fits(const recording& rec, uint64_t offset)
+{
+    if (offset + sizeof(frame_record_frame_header_t) > rec.size)
+        return false;
+    const frame_record_frame_header_t *hdr =
+        (const frame_record_frame_header_t*)(rec.map + offset);
+    return hdr->magic == FRAME_RECORD_FRAME_MAGIC &&
+           offset + sizeof(frame_record_frame_header_t) + hdr->size <= rec.size;
+}
+
+bool recording_open(recording& rec, const string& path)
+{
+    rec.map = NULL;
+    rec.size = 0;
+    rec.header = NULL;
+    rec.index = NULL;
+    rec.count = 0;
+    rec.scanned.clear();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(frame_record_file_header_t)) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    rec.map = (const uint8_t*)map;
+    rec.size = st.st_size;
+    rec.header = (const frame_record_file_header_t*)rec.map;
+
+    if (rec.header->magic != FRAME_RECORD_MAGIC ||
+        rec.header->version < 1 || rec.header->version > FRAME_RECORD_VERSION ||
+        rec.header->frame_header_size != sizeof(frame_record_frame_header_t)) {
+        recording_close(rec);
+        return false;
+    }
+
+    uint64_t index_offset = rec.header->index_offset;
+    if (index_offset != 0 &&
+        index_offset + (uint64_t)rec.header->frame_count * sizeof(uint64_t) <= rec.size) {
+        rec.index = (const uint64_t*)(rec.map + index_offset);
+        rec.count = rec.header->frame_count;
+        return true;
+    }
+
+    // not closed, walk the frame headers up to the first damaged one
+    uint64_t offset = rec.header->header_size;
+    while (frame_fits(rec, offset)) {
+        const frame_record_frame_header_t *hdr =
+            (const frame_record_frame_header_t*)(rec.map + offset);
+        rec.scanned.push_back(offset);
+        offset = FRAME_RECORD_ALIGNED(offset + sizeof(frame_record_frame_header_t) + hdr->size);
+    }
+    rec.index = rec.scanned.empty() ? NULL : &rec.scanned[0];
+    rec.count = (uint32_t)rec.scanned.size();
+    return true;
+}
+
+void recording_close(recording& rec)
+{
+    if (rec.map != NULL)
+        munmap((void*)rec.map, rec.size);
+    rec.map = NULL;
+    rec.header = NULL;
+    rec.index = NULL;
+    rec.count = 0;
+    rec.scanned.clear();
+}
+
+const frame_record_frame_header_t* recording_frame(const recording& rec, uint32_t i)
+{
+    if (i >= rec.count || !frame_fits(rec, rec.index[i]))
+        return NULL;
+    return (const frame_record_frame_header_t*)(rec.map + rec.index[i]);
+}
+
+void recording_decoder_init(recording_decoder& dec)
+{
+    dec.cur = 0;
+    dec.prev = NULL;
+    dec.last = -1;
+}
+
+static bool is_key(const recording& rec, const frame_record_frame_header_t* hdr)
+{
+    return rec.header->version < 2 || hdr->codec != FRAME_CODEC_LZ4_DELTA ||
+           (hdr->flags & FRAME_FLAG_KEY);
+}
+
+static bool decode_one(const recording& rec, uint32_t i, recording_decoder& dec)
+{
+    const frame_record_frame_header_t *hdr = recording_frame(rec, i);
+    if (hdr == NULL)
+        return false;
+    if (rec.header->version < 2 || hdr->codec == FRAME_CODEC_RAW) {
+        dec.prev = recording_pixels(hdr);
+        dec.last = i;
+        return true;
+    }
+    const uint8_t *prev = NULL;
+    if (!is_key(rec, hdr)) {
+        if (dec.last != (int64_t)i - 1 || dec.prev == NULL)
+            return false;
+        prev = dec.prev;
+    }
+    // never decode on top of the frame used as reference
+    vector<uint8_t>& out = dec.buf[dec.cur ^ 1];
+    if (out.size() < hdr->raw_size)
+        out.resize(hdr->raw_size);
+    if (frame_codec_decode(hdr->codec, recording_pixels(hdr), hdr->size, prev,
+                           &out[0], hdr->raw_size) != 0)
+        return false;
+    dec.cur ^= 1;
+    dec.prev = &out[0];
+    dec.last = i;
+    return true;
+}
+
+const uint8_t* recording_decode(const recording& rec, uint32_t i, recording_decoder& dec)
+{
+    if (dec.last == (int64_t)i)
+        return dec.prev;
+    const frame_record_frame_header_t *hdr = recording_frame(rec, i);
+    if (hdr == NULL)
+        return NULL;
+    if (!is_key(rec, hdr) && dec.last != (int64_t)i - 1) {
+        uint32_t key = i;
+        while (key > 0) {
+            const frame_record_frame_header_t *k = recording_frame(rec, --key);
+            if (k == NULL)
+                return NULL;
+            if (is_key(rec, k))
+                break;
+        }
+        for (uint32_t j = key; j < i; j++)
+            if (!decode_one(rec, j, dec))
+                return NULL;
+    }
+    return decode_one(rec, i, dec) ? dec.prev : NULL;
+}
@@ -0,0 +1,53 @@
+#ifndef RECORDING_H_
+#define RECORDING_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <Video/frame_record.h>
+#include <Video/frame_codec.h>
+
+// read only view of a frame_record file written by post_stage
+struct recording {
+    const uint8_t *map;
+    size_t size;
+    const frame_record_file_header_t *header;
+    const uint64_t *index;
+    uint32_t count;
+    // frame offsets found by walking a recording that was never closed
+    std::vector<uint64_t> scanned;
+};
+
+// false if the file can not be mapped or is not a frame record
+bool recording_open(recording& rec, const std::string& path);
+void recording_close(recording& rec);
+
+// O(1) access to frame i, NULL if out of range or damaged
+const frame_record_frame_header_t* recording_frame(const recording& rec, uint32_t i);
+
+static inline const uint8_t* recording_pixels(const frame_record_frame_header_t* hdr)
+{
+    return (const uint8_t*)hdr + sizeof(frame_record_frame_header_t);
+}
+
+// decoded size of a frame, version 1 recordings are never compressed
+static inline uint32_t recording_raw_size(const recording& rec, const frame_record_frame_header_t* hdr)
+{
+    return rec.header->version < 2 ? hdr->size : hdr->raw_size;
+}
+
+// holds the last decoded frame, delta frames are decoded on top of it
+struct recording_decoder {
+    std::vector<uint8_t> buf[2];
+    int cur;
+    const uint8_t *prev;        // last decoded frame, in the mapping or in buf[cur]
+    int64_t last;               // its index, -1 if none
+};
+
+void recording_decoder_init(recording_decoder& dec);
+
+// raw pixels of frame i, NULL on error. Uncompressed frames point into the
+// mapping, a delta frame out of sequence is decoded from its key frame.
+const uint8_t* recording_decode(const recording& rec, uint32_t i, recording_decoder& dec);
+
+#endif // RECORDING_H_
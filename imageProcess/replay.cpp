@@ -0,0 +1,583 @@
+/**
+ * Offline replay of a recorded flight through the imageProcess tracking path.
+ *
+ * Input is a frame record written by post_stage (-r), a headerless RGB565
+ * dump, or the H.264 elementary stream written by pre_stage (-e, file name
+ * ending in .h264). Every frame is copied, converted and tracked exactly like
+ * a frame taken from shared memory, as fast as possible or paced at the
+ * recording frame rate. fps, the per-frame latency distribution and the
+ * trajectory of the box are reported.
+ *
+ * Given a directory, every recording in it is replayed as fast as possible,
+ * --jobs at once with a tracker each, into a per-frame track and a line of
+ * summary.csv (fps, latency, frames tracked, losses) in --output.
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "tracker.h"
+#include "recording.h"
+#include "timing.h"
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+using namespace std;
+
+const char* keys =
+{
+    "{help h     |       | show help message}"
+    "{@input     |       | frame record, raw RGB565 dump or .h264 stream}"
+    "{size       |640x360| frame size of a headerless raw dump}"
+    "{fps        |0      | pace at this rate, 0 replays as fast as possible}"
+    "{realtime   |       | pace at the rate of the recording}"
+    "{roi        |       | initial target as x,y,width,height}"
+    "{model      |       | load the target model from this file and search the frames for it}"
+    "{vmin       |10     | minimum value}"
+    "{vmax       |256    | maximum value}"
+    "{smin       |30     | minimum saturation}"
+    "{ini_area   |22500  | target area in pixels}"
+    "{trajectory |       | write the per-frame box to this csv file}"
+    "{check_camshift |   | compare every frame tracked at full scale with cv::CamShift, fails on a difference}"
+    "{jobs       |0      | recordings replayed at once when @input is a directory, 0 : one per core}"
+    "{output     |replay_out | directory of the per-recording tracks and summary.csv of a directory}"
+};
+
+struct frame_source {
+    // frame record written by post_stage
+    recording rec;
+    recording_decoder dec;
+    bool is_record;
+    // raw dump, mapped read only
+    const uint8_t *map;
+    size_t map_size;
+    // h264 stream, decoded then packed back to RGB565
+    VideoCapture cap;
+    Mat decoded, packed;
+
+    int width;
+    int height;
+    int frame_size;
+    int count;          // -1 when unknown
+    double fps;         // rate of the recording
+};
+
+struct source_frame {
+    const uint8_t *pixels;      // RGB565
+    int width;
+    int height;
+    double time_ms;             // position in the recording
+};
+
+static bool ends_with(const string& s, const string& suffix)
+{
+    return s.size() >= suffix.size() &&
+           s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool source_open(frame_source& src, const string& path, int width, int height)
+{
+    src.map = NULL;
+    src.map_size = 0;
+    src.fps = 30;
+    src.is_record = false;
+    if (recording_open(src.rec, path)) {
+        src.is_record = true;
+        recording_decoder_init(src.dec);
+        src.count = src.rec.count;
+        const frame_record_frame_header_t *first = recording_frame(src.rec, 0);
+        src.width = first != NULL ? first->width : 0;
+        src.height = first != NULL ? first->height : 0;
+        src.frame_size = first != NULL ? recording_raw_size(src.rec, first) : 0;
+        return true;
+    }
+    if (ends_with(path, ".h264") || ends_with(path, ".264")) {
+        if (!src.cap.open(path))
+            return false;
+        src.width = (int)src.cap.get(CAP_PROP_FRAME_WIDTH);
+        src.height = (int)src.cap.get(CAP_PROP_FRAME_HEIGHT);
+        src.frame_size = src.width * src.height * 2;
+        src.count = -1;
+        double fps = src.cap.get(CAP_PROP_FPS);
+        if (fps > 0)
+            src.fps = fps;
+        return true;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    src.map = (const uint8_t*)map;
+    src.map_size = st.st_size;
+    src.width = width;
+    src.height = height;
+    src.frame_size = width * height * 2;
+    src.count = (int)(st.st_size / src.frame_size);
+    return true;
+}
+
+// fills the next frame, false at the end
+static bool source_read(frame_source& src, int index, source_frame& f)
+{
+    f.width = src.width;
+    f.height = src.height;
+    f.time_ms = index * 1000.0 / src.fps;
+    if (src.is_record) {
+        const frame_record_frame_header_t *hdr = recording_frame(src.rec, index);
+        const frame_record_frame_header_t *first = recording_frame(src.rec, 0);
+        if (hdr == NULL)
+            return false;
+        if (hdr->pix_fmt != FRAME_PIX_RGB565 || hdr->width == 0 ||
+            recording_raw_size(src.rec, hdr) < (uint32_t)hdr->width * hdr->height * 2) {
+            fprintf(stderr, "frame %d: only RGB565 frames can be replayed\n", index);
+            return false;
+        }
+        f.pixels = recording_decode(src.rec, index, src.dec);
+        if (f.pixels == NULL) {
+            fprintf(stderr, "frame %d: can not decode codec %d\n", index, hdr->codec);
+            return false;
+        }
+        f.width = hdr->width;
+        f.height = hdr->height;
+        f.time_ms = (hdr->capture_us - first->capture_us) / 1000.0;
+        return true;
+    }
+    if (src.map != NULL) {
+        if (index >= src.count)
+            return false;
+        f.pixels = src.map + (size_t)index * src.frame_size;
+        return true;
+    }
+    if (!src.cap.read(src.decoded) || src.decoded.empty())
+        return false;
+    cvtColor(src.decoded, src.packed, COLOR_BGR2BGR565);
+    f.pixels = src.packed.data;
+    return true;
+}
+
+static void source_close(frame_source& src)
+{
+    if (src.is_record)
+        recording_close(src.rec);
+    if (src.map != NULL)
+        munmap((void*)src.map, src.map_size);
+    src.map = NULL;
+    src.cap.release();
+}
+
+static double percentile(const vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t i = (size_t)(p / 100 * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+// how the target is given, the same for every recording of a batch
+struct replay_target {
+    track_params params;
+    string model;
+    Rect roi;
+};
+
+struct replay_result {
+    int frames;
+    int tracked;
+    int first_tracked;          // -1 if the target was never found
+    int losses;                 // tracked frames followed by a lost one
+    int longest_loss;           // frames in a row without the target, after the first lock
+    double elapsed_ms;
+    vector<double> latency;
+    // --check_camshift : frames compared, frames where the window differs
+    // and the largest centre, size and angle differences seen
+    int camshift_checked;
+    int camshift_window_diffs;
+    float camshift_max_center, camshift_max_size, camshift_max_angle;
+};
+
+static bool target_init(tracker& trk, track_params& params, const replay_target& target)
+{
+    tracker_init(trk);
+    params = target.params;
+    if (!target.model.empty())
+        return tracker_load_model(trk, params, target.model);
+    tracker_select(trk, target.roi);
+    return true;
+}
+
+static void trajectory_header(FILE *traj)
+{
+    fprintf(traj, "frame,cx,cy,w,h,angle,x_err,y_err,z_err,latency_ms\n");
+}
+
+// Runs cv::CamShift on the back projection the tracker just used, from
+// the window it started from, and compares it with the tracker's own copy
+static void check_camshift(const tracker& trk, const Rect& start, const track_result& r, replay_result& res)
+{
+    Rect window = start;
+    RotatedRect ref = CamShift(trk.backproj, window, TermCriteria(TermCriteria::EPS | TermCriteria::COUNT, 10, 1));
+    res.camshift_checked++;
+    if (window != trk.window)
+        res.camshift_window_diffs++;
+    float angle = fabs(ref.angle - r.box.angle);
+    res.camshift_max_center = max(res.camshift_max_center,
+                                  max(fabs(ref.center.x - r.box.center.x), fabs(ref.center.y - r.box.center.y)));
+    res.camshift_max_size = max(res.camshift_max_size,
+                                max(fabs(ref.size.width - r.box.size.width), fabs(ref.size.height - r.box.size.height)));
+    res.camshift_max_angle = max(res.camshift_max_angle, min(angle, 180 - angle));
+}
+
+// Tracks every frame of src, paced at fps or at the recording rate
+// (realtime), as fast as possible otherwise. Tracked frames go to traj,
+// check compares every frame with cv::CamShift (check_camshift).
+static void replay_source(frame_source& src, tracker& trk, const track_params& params,
+                          double fps, bool realtime, bool check, FILE *traj, replay_result& res)
+{
+    // same buffers as the live path: copy out of the producer, then convert
+    frame_pool frames;
+    frame_pool_init(frames, Size(1280, 720));
+    res.frames = res.tracked = res.losses = res.longest_loss = 0;
+    res.first_tracked = -1;
+    res.latency.clear();
+    res.camshift_checked = res.camshift_window_diffs = 0;
+    res.camshift_max_center = res.camshift_max_size = res.camshift_max_angle = 0;
+    int lost_run = 0;
+
+    double start = now_ms();
+    int index = 0;
+    for (;; index++) {
+        source_frame f;
+        if (!source_read(src, index, f))
+            break;
+        if (realtime)
+            sleep_until_ms(start + f.time_ms);
+        else if (fps > 0)
+            sleep_until_ms(start + index * 1000.0 / fps);
+        if (frames.size != Size(f.width, f.height) &&
+            !frame_pool_bind(frames, trk, Size(f.width, f.height))) {
+            fprintf(stderr, "frame %d: %dx%d is larger than 1280x720, skipped\n", index, f.width, f.height);
+            continue;
+        }
+
+        double t0 = now_ms();
+        memcpy(&frames.raw[0], f.pixels, (size_t)f.width * f.height * 2);
+        rgb565_to_rgb888(&frames.raw[0], f.width, f.height, frames.bgr.data);
+        // only frames tracked at full scale from the window kept since the last one compare
+        Rect start = trk.window;
+        bool comparable = check && trk.state == 1 && trk.scale == 1 && trk.frame_size == Size(f.width, f.height);
+        track_result result;
+        bool ok = tracker_process(trk, frames.bgr, params, result);
+        double t1 = now_ms();
+        if (comparable && ok && result.scale == 1 && !result.new_hist && trk.window.area() > 1)
+            check_camshift(trk, start, result, res);
+
+        res.latency.push_back(t1 - t0);
+        if (!ok) {
+            if (res.first_tracked >= 0 && lost_run++ == 0)
+                res.losses++;
+            res.longest_loss = max(res.longest_loss, lost_run);
+            continue;
+        }
+        lost_run = 0;
+        if (res.first_tracked < 0)
+            res.first_tracked = index;
+        res.tracked++;
+        if (traj != NULL)
+            fprintf(traj, "%d,%.2f,%.2f,%.2f,%.2f,%.2f,%f,%f,%f,%.3f\n", index,
+                    result.box.center.x, result.box.center.y,
+                    result.box.size.width, result.box.size.height, result.box.angle,
+                    result.x_err, result.y_err, result.z_err, t1 - t0);
+    }
+    res.frames = index;
+    res.elapsed_ms = now_ms() - start;
+}
+
+// recordings of a batch : frame records whatever their name, .h264 streams and .raw dumps
+static bool batch_candidate(const string& path)
+{
+    if (ends_with(path, ".h264") || ends_with(path, ".264") || ends_with(path, ".raw"))
+        return true;
+    recording rec;
+    if (!recording_open(rec, path))
+        return false;
+    recording_close(rec);
+    return true;
+}
+
+struct batch {
+    vector<string> inputs;
+    string output;
+    replay_target target;
+    int width, height;          // of the raw dumps
+    int next;                   // next recording to take
+    vector<replay_result> results;
+    vector<string> errors;      // why a recording failed, empty if it did not
+};
+
+static string base_name(const string& path)
+{
+    size_t slash = path.rfind('/');
+    return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+// One recording at a time until there is none left, each with its own
+// tracker, buffers and decoder
+static void *batch_worker(void *arg)
+{
+    batch& b = *(batch*)arg;
+    for (;;) {
+        int i = __sync_fetch_and_add(&b.next, 1);
+        if (i >= (int)b.inputs.size())
+            break;
+        const string& input = b.inputs[i];
+        tracker trk;
+        track_params params;
+        if (!target_init(trk, params, b.target)) {
+            b.errors[i] = "can not load the model";
+            continue;
+        }
+        frame_source src;
+        if (!source_open(src, input, b.width, b.height)) {
+            b.errors[i] = "can not open";
+            continue;
+        }
+        string track_path = b.output + "/" + base_name(input) + ".csv";
+        FILE *traj = fopen(track_path.c_str(), "w");
+        if (traj == NULL) {
+            source_close(src);
+            b.errors[i] = "can not write " + track_path;
+            continue;
+        }
+        trajectory_header(traj);
+        replay_source(src, trk, params, 0, false, false, traj, b.results[i]);
+        source_close(src);
+        fclose(traj);
+        const replay_result& r = b.results[i];
+        printf("%s: %d frames, %d tracked, %.1f fps\n", input.c_str(), r.frames, r.tracked,
+               r.elapsed_ms > 0 ? r.frames * 1000.0 / r.elapsed_ms : 0.0);
+    }
+    return NULL;
+}
+
+// Replays every recording of dir on jobs threads, a per-frame track
+// <output>/<recording>.csv each and one line per recording in
+// <output>/summary.csv
+static int run_batch(const string& dir, batch& b, int jobs)
+{
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL) {
+        fprintf(stderr, "can not read %s\n", dir.c_str());
+        return EXIT_FAILURE;
+    }
+    for (struct dirent *e; (e = readdir(d)) != NULL; ) {
+        string path = dir + "/" + e->d_name;
+        struct stat st;
+        if (e->d_name[0] != '.' && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+            batch_candidate(path))
+            b.inputs.push_back(path);
+    }
+    closedir(d);
+    sort(b.inputs.begin(), b.inputs.end());
+    if (b.inputs.empty()) {
+        fprintf(stderr, "no recording in %s\n", dir.c_str());
+        return EXIT_FAILURE;
+    }
+    if (mkdir(b.output.c_str(), 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "can not create %s\n", b.output.c_str());
+        return EXIT_FAILURE;
+    }
+
+    b.next = 0;
+    b.results.assign(b.inputs.size(), replay_result());
+    b.errors.assign(b.inputs.size(), string());
+    jobs = min(jobs, (int)b.inputs.size());
+    // one recording per core, the OpenCV calls of a worker stay on it
+    setNumThreads(1);
+    printf("replaying %zu recordings of %s on %d threads\n", b.inputs.size(), dir.c_str(), jobs);
+    double start = now_ms();
+    vector<pthread_t> threads(jobs);
+    for (int i = 0; i < jobs; i++) {
+        if (pthread_create(&threads[i], NULL, batch_worker, &b) != 0) {
+            fprintf(stderr, "can not start worker %d\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+    for (int i = 0; i < jobs; i++)
+        pthread_join(threads[i], NULL);
+    double elapsed = now_ms() - start;
+
+    string summary_path = b.output + "/summary.csv";
+    FILE *summary = fopen(summary_path.c_str(), "w");
+    if (summary == NULL) {
+        fprintf(stderr, "can not write %s\n", summary_path.c_str());
+        return EXIT_FAILURE;
+    }
+    fprintf(summary, "recording,status,frames,tracked,first_tracked,losses,longest_loss,"
+                     "fps,latency_mean_ms,latency_p50_ms,latency_p90_ms,latency_p99_ms,latency_max_ms\n");
+    long long frames = 0, tracked = 0;
+    int failed = 0;
+    for (size_t i = 0; i < b.inputs.size(); i++) {
+        const replay_result& r = b.results[i];
+        if (!b.errors[i].empty() || r.latency.empty()) {
+            const string& why = b.errors[i].empty() ? string("no frame") : b.errors[i];
+            fprintf(stderr, "%s: %s\n", b.inputs[i].c_str(), why.c_str());
+            fprintf(summary, "%s,\"%s\",,,,,,,,,,,\n", base_name(b.inputs[i]).c_str(), why.c_str());
+            failed++;
+            continue;
+        }
+        vector<double> sorted(r.latency);
+        sort(sorted.begin(), sorted.end());
+        double sum = 0;
+        for (size_t k = 0; k < sorted.size(); k++)
+            sum += sorted[k];
+        fprintf(summary, "%s,ok,%d,%d,%d,%d,%d,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                base_name(b.inputs[i]).c_str(), r.frames, r.tracked, r.first_tracked, r.losses,
+                r.longest_loss, r.elapsed_ms > 0 ? r.frames * 1000.0 / r.elapsed_ms : 0.0,
+                sum / sorted.size(), percentile(sorted, 50), percentile(sorted, 90),
+                percentile(sorted, 99), sorted.back());
+        frames += r.frames;
+        tracked += r.tracked;
+    }
+    fclose(summary);
+
+    printf("recordings: %zu failed: %d frames: %lld tracked: %lld time: %.1f s fps: %.1f\n",
+           b.inputs.size(), failed, frames, tracked, elapsed / 1000, frames * 1000.0 / elapsed);
+    printf("summary written to %s\n", summary_path.c_str());
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+    CommandLineParser parser(argc, argv, keys);
+    if (parser.has("help") || !parser.has("@input")) {
+        parser.printMessage();
+        return parser.has("help") ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    string input = parser.get<string>("@input");
+    int width = 0, height = 0;
+    if (sscanf(parser.get<string>("size").c_str(), "%dx%d", &width, &height) != 2 ||
+        width <= 0 || height <= 0) {
+        fprintf(stderr, "bad size, expected WIDTHxHEIGHT\n");
+        return EXIT_FAILURE;
+    }
+
+    replay_target target;
+    target.params.vmin = parser.get<int>("vmin");
+    target.params.vmax = parser.get<int>("vmax");
+    target.params.smin = parser.get<int>("smin");
+    target.params.ini_area = parser.get<int>("ini_area");
+    if (parser.has("model")) {
+        target.model = parser.get<string>("model");
+    }
+    else if (parser.has("roi")) {
+        Rect& roi = target.roi;
+        if (sscanf(parser.get<string>("roi").c_str(), "%d,%d,%d,%d",
+                   &roi.x, &roi.y, &roi.width, &roi.height) != 4) {
+            fprintf(stderr, "bad roi, expected x,y,width,height\n");
+            return EXIT_FAILURE;
+        }
+    }
+    else {
+        fprintf(stderr, "replay needs --roi or --model\n");
+        return EXIT_FAILURE;
+    }
+    double fps = parser.get<double>("fps");
+    bool realtime = parser.has("realtime");
+
+    struct stat st;
+    if (stat(input.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        if (realtime || fps > 0 || parser.has("trajectory")) {
+            fprintf(stderr, "a directory is replayed as fast as possible into --output, "
+                            "without --fps, --realtime or --trajectory\n");
+            return EXIT_FAILURE;
+        }
+        batch b;
+        b.target = target;
+        b.width = width;
+        b.height = height;
+        b.output = parser.get<string>("output");
+        int jobs = parser.get<int>("jobs");
+        if (jobs <= 0)
+            jobs = max((int)sysconf(_SC_NPROCESSORS_ONLN), 1);
+        return run_batch(input, b, jobs);
+    }
+
+    tracker trk;
+    track_params params;
+    if (!target_init(trk, params, target)) {
+        fprintf(stderr, "can not load model %s\n", target.model.c_str());
+        return EXIT_FAILURE;
+    }
+
+    frame_source src;
+    if (!source_open(src, input, width, height)) {
+        fprintf(stderr, "can not open %s\n", input.c_str());
+        return EXIT_FAILURE;
+    }
+
+    FILE *traj = NULL;
+    if (parser.has("trajectory")) {
+        traj = fopen(parser.get<string>("trajectory").c_str(), "w");
+        if (traj == NULL) {
+            fprintf(stderr, "can not write %s\n", parser.get<string>("trajectory").c_str());
+            return EXIT_FAILURE;
+        }
+        trajectory_header(traj);
+    }
+
+    printf("replaying %s %dx%d at %s\n", input.c_str(), src.width, src.height,
+           realtime ? "recording pace" :
+           fps > 0 ? format("%.1f fps", fps).c_str() : "max speed");
+    replay_result res;
+    replay_source(src, trk, params, fps, realtime, parser.has("check_camshift"), traj, res);
+    source_close(src);
+    if (traj != NULL)
+        fclose(traj);
+
+    const vector<double>& latency = res.latency;
+    if (latency.empty()) {
+        fprintf(stderr, "no frame in %s\n", input.c_str());
+        return EXIT_FAILURE;
+    }
+    double sum = 0;
+    for (size_t i = 0; i < latency.size(); i++)
+        sum += latency[i];
+    vector<double> sorted(latency);
+    sort(sorted.begin(), sorted.end());
+
+    printf("frames: %d tracked: %d time: %.1f ms fps: %.1f\n",
+           res.frames, res.tracked, res.elapsed_ms, res.frames * 1000.0 / res.elapsed_ms);
+    if (res.first_tracked >= 0)
+        printf("first tracked frame: %d, lost %d times, longest loss %d frames\n",
+               res.first_tracked, res.losses, res.longest_loss);
+    printf("latency ms: min %.3f mean %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+           sorted.front(), sum / sorted.size(), percentile(sorted, 50),
+           percentile(sorted, 90), percentile(sorted, 99), sorted.back());
+    if (parser.has("check_camshift")) {
+        printf("camshift against cv::CamShift: %d frames, %d windows differ, max difference centre %.3f px "
+               "size %.3f px angle %.3f deg\n", res.camshift_checked, res.camshift_window_diffs,
+               res.camshift_max_center, res.camshift_max_size, res.camshift_max_angle);
+        if (res.camshift_window_diffs > 0 || res.camshift_max_center > 0.01f)
+            return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -0,0 +1,124 @@
+/**
+ * Wake-up jitter of a periodic thread, with and without a real-time profile.
+ *
+ * Runs a loop at the control rate that sleeps until each tick and records how
+ * late it wakes up, first with the default scheduling and then with the
+ * settings of --thread in the --profile file (Control/rt_profile.h). --load
+ * starts busy threads on every core during both runs, standing in for the
+ * video decoding and whatever else the laptop is doing. The two
+ * distributions are printed one above the other.
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "timing.h"
+#include <Control/rt_profile.h>
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+using namespace std;
+
+const char* keys =
+{
+    "{help h     |             | show help message}"
+    "{profile    |             | real-time profile file}"
+    "{thread     |auto_control | thread of the profile the loop runs as}"
+    "{rate       |100          | loop rate in Hz}"
+    "{duration   |10           | seconds per run}"
+    "{load       |0            | busy threads started during the runs}"
+};
+
+struct run_args {
+    const rt_profile_t *profile;
+    const char *thread;
+    double period_ms;
+    int ticks;
+    rt_jitter_t jitter;
+    int failures;
+};
+
+static volatile bool stop_load = false;
+
+static void *busy_thread(void *)
+{
+    volatile double x = 1;
+    while (!stop_load)
+        x = x * 1.0000001 + 1e-9;
+    return NULL;
+}
+
+static void *periodic_thread(void *arg)
+{
+    run_args *a = (run_args *)arg;
+    a->failures = rt_profile_apply(a->profile, a->thread);
+    double next = now_ms() + a->period_ms;
+    for (int i = 0; i < a->ticks; i++) {
+        sleep_until_ms(next);
+        rt_jitter_add(&a->jitter, (int64_t)((now_ms() - next) * 1e6));
+        next += a->period_ms;
+    }
+    return NULL;
+}
+
+static void run(run_args& a, const char *label)
+{
+    pthread_t t;
+    rt_jitter_init(&a.jitter, "wakeup latency", a.ticks);
+    pthread_create(&t, NULL, periodic_thread, &a);
+    pthread_join(t, NULL);
+    rt_jitter_report(&a.jitter, label, stdout);
+    rt_jitter_close(&a.jitter);
+}
+
+int main(int argc, char** argv)
+{
+    CommandLineParser parser(argc, argv, keys);
+    if (parser.has("help")) {
+        parser.printMessage();
+        return EXIT_SUCCESS;
+    }
+    string thread = parser.get<string>("thread");
+    double rate = parser.get<double>("rate"), duration = parser.get<double>("duration");
+    int load = parser.get<int>("load");
+    if (rate <= 0 || duration <= 0 || load < 0) {
+        fprintf(stderr, "bad rate, duration or load\n");
+        return EXIT_FAILURE;
+    }
+
+    rt_profile_t profile;
+    bool has_profile = parser.has("profile");
+    if (has_profile && rt_profile_load(&profile, parser.get<string>("profile").c_str()) != 0) {
+        fprintf(stderr, "can not read profile %s\n", parser.get<string>("profile").c_str());
+        return EXIT_FAILURE;
+    }
+
+    vector<pthread_t> busy(load);
+    for (int i = 0; i < load; i++)
+        pthread_create(&busy[i], NULL, busy_thread, NULL);
+
+    run_args a;
+    a.thread = thread.c_str();
+    a.period_ms = 1000 / rate;
+    a.ticks = (int)(duration * rate);
+    printf("%d ticks at %.0f Hz, %d busy threads\n", a.ticks, rate, load);
+
+    a.profile = NULL;
+    run(a, "default");
+    if (has_profile) {
+        // the memory stays locked after this run, so it goes last
+        a.profile = &profile;
+        int failures = rt_profile_lock_memory(&profile) != 0;
+        run(a, "profile");
+        failures += a.failures;
+        if (failures)
+            printf("%d profile settings could not be applied, see above\n", failures);
+    }
+
+    stop_load = true;
+    for (int i = 0; i < load; i++)
+        pthread_join(busy[i], NULL);
+    return EXIT_SUCCESS;
+}
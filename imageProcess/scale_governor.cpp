@@ -0,0 +1,91 @@
+#include "scale_governor.h"
+
+using namespace cv;
+
+// what the tracking leaves of the frame period to the copy, the result
+// and the jitter of the other stages
+static const double BUDGET_SHARE = 0.5;
+// weight of the last frame in the averages
+static const double AVERAGE_WEIGHT = 0.1;
+static const int COARSER_FRAMES = 3;
+static const int FINER_FRAMES = 15;
+// margins a finer scale must keep, against switching back and forth
+static const double FINER_BUDGET = 0.6;
+static const double FINER_SIDE = 0.75;
+// a gap longer than this is a pause, not the frame period
+static const double MAX_PERIOD_MS = 500;
+
+void scale_governor_init(scale_governor& g, int fixed, double budget_ms)
+{
+    g.fixed = fixed;
+    g.budget_ms = budget_ms;
+    g.scale = fixed ? fixed : 1;
+    g.cost_ms = 0;
+    g.period_ms = 0;
+    g.last_frame_id = -1;
+    g.last_stamp_ns = 0;
+    g.coarser_frames = 0;
+    g.finer_frames = 0;
+    g.switches = 0;
+}
+
+double scale_governor_budget(const scale_governor& g)
+{
+    return g.budget_ms > 0 ? g.budget_ms : g.period_ms * BUDGET_SHARE;
+}
+
+static void average(double& avg, double value)
+{
+    avg = avg > 0 ? avg + AVERAGE_WEIGHT * (value - avg) : value;
+}
+
+// the larger of the finest scale predicted under budget_ms and of the
+// coarsest one keeping min_side pixels of a target of side pixels
+static int wanted_scale(double cost_ms, double budget_ms, int side, double min_side)
+{
+    int by_time = 1;
+    if (budget_ms > 0) {
+        while (by_time < SCALE_MAX && cost_ms / (by_time * by_time) > budget_ms)
+            by_time *= 2;
+    }
+    int by_size = SCALE_MAX;
+    while (by_size > 1 && side < min_side * by_size)
+        by_size /= 2;
+    return MAX(by_time, by_size);
+}
+
+bool scale_governor_update(scale_governor& g, tracker& t, const track_result& r,
+                           int64_t track_ns, int frame_id, int64_t stamp_ns)
+{
+    average(g.cost_ms, track_ns / 1e6 * r.scale * r.scale);
+    // frames dropped in between count in the period
+    if (stamp_ns > 0 && g.last_stamp_ns > 0 && frame_id > g.last_frame_id) {
+        double period = (stamp_ns - g.last_stamp_ns) / 1e6 / (frame_id - g.last_frame_id);
+        if (period > 0 && period < MAX_PERIOD_MS)
+            average(g.period_ms, period);
+    }
+    g.last_frame_id = frame_id;
+    g.last_stamp_ns = stamp_ns;
+
+    int scale = g.scale;
+    if (!g.fixed) {
+        double budget = scale_governor_budget(g);
+        // lost or not tracking yet : the whole frame is searched, only the time counts
+        int side = t.state == 1 ? MIN(t.window.width, t.window.height) : 0;
+        int coarser = wanted_scale(g.cost_ms, budget, side, SCALE_MIN_TARGET_SIDE);
+        int finer = wanted_scale(g.cost_ms, budget * FINER_BUDGET, side, SCALE_MIN_TARGET_SIDE * FINER_SIDE);
+        g.coarser_frames = coarser > g.scale ? g.coarser_frames + 1 : 0;
+        g.finer_frames = finer < g.scale ? g.finer_frames + 1 : 0;
+        if (g.coarser_frames >= COARSER_FRAMES)
+            scale = coarser;
+        else if (g.finer_frames >= FINER_FRAMES)
+            scale = g.scale / 2;
+    }
+    t.scale = scale;
+    if (scale == g.scale)
+        return false;
+    g.scale = scale;
+    g.coarser_frames = g.finer_frames = 0;
+    g.switches++;
+    return true;
+}
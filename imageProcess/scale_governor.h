@@ -0,0 +1,51 @@
+#ifndef SCALE_GOVERNOR_H_
+#define SCALE_GOVERNOR_H_
+
+#include <stdint.h>
+#include "tracker.h"
+
+/**
+ * Picks the scale a tracker processes the next frame at (tracker.scale) :
+ * 1, 1/2 or 1/4 of the frame pixels and rows.
+ *
+ * Two things push towards a coarser scale : a target large enough to keep
+ * SCALE_MIN_TARGET_SIDE pixels on its short side there (the full
+ * resolution of a target filling the frame is wasted), and a track time
+ * over the budget. The budget is a share of the frame period measured from
+ * the publish stamps, or a fixed one. The track time is kept as an average
+ * brought back to the full scale (times scale squared), which predicts the
+ * time at the other scales.
+ *
+ * Hysteresis : the scale gets coarser after a few frames asking for it, and
+ * finer one step at a time after many frames where the finer scale would
+ * fit well under the budget and still see the target well above the limit.
+ */
+
+#define SCALE_MAX (4)
+#define SCALE_MIN_TARGET_SIDE (40)
+
+struct scale_governor {
+    int fixed;                  // 1, 2 or 4 : no governor, 0 : governed
+    double budget_ms;           // 0 : a share of the measured frame period
+    int scale;
+    double cost_ms;             // average track time at full scale, 0 before the first frame
+    double period_ms;           // average time between published frames, 0 until known
+    int last_frame_id;
+    int64_t last_stamp_ns;
+    int coarser_frames;         // in a row asking for a coarser scale
+    int finer_frames;
+    uint64_t switches;
+};
+
+void scale_governor_init(scale_governor& g, int fixed, double budget_ms);
+
+// the budget the track time is held under, 0 while it is unknown
+double scale_governor_budget(const scale_governor& g);
+
+// After a tracked frame : r and the time tracker_process took, the
+// frame_id and the publish stamp (0 if unknown) of the frame. Sets
+// t.scale for the next frame, true if it changed.
+bool scale_governor_update(scale_governor& g, tracker& t, const track_result& r,
+                           int64_t track_ns, int frame_id, int64_t stamp_ns);
+
+#endif // SCALE_GOVERNOR_H_
@@ -0,0 +1,456 @@
+/**
+ * Synthetic scene generator for repeatable load and accuracy tests.
+ *
+ * Renders RGB565 frames at one of the stream sizes: a red target moving and
+ * changing scale over a drifting cluttered background, distractor blobs of
+ * other hues and a gray occluder. The motion is either the built-in
+ * Lissajous path or a keyframe script, and every frame only depends on its
+ * index, the rate and the seed, so two runs produce the same frames.
+ *
+ * Frames are published into the display_stage shared memory (imageProcess
+ * runs unchanged, paced at --fps) and/or written to a frame record for
+ * replay. The ground-truth box of every frame goes to --truth.
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <math.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <vector>
+#include "semaphore.h"
+#include "timing.h"
+#include <Video/frame_shm.h>
+#include <Video/frame_record.h>
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+using namespace std;
+
+const char* keys =
+{
+    "{help h     |       | show help message}"
+    "{size       |640x360| 176x144, 320x240, 640x360 or 1280x720}"
+    "{fps        |30     | frame rate}"
+    "{frames     |900    | frames to generate, 0 runs until interrupted (shm only)}"
+    "{seed       |1      | seed of the background and the distractors}"
+    "{script     |       | keyframes, one 'time_s cx cy scale occlusion' per line}"
+    "{clutter    |6      | number of distractor blobs}"
+    "{shm        |       | publish into the display_stage shared memory}"
+    "{drone      |0      | drone ID of the shared memory channels}"
+    "{record     |       | write a frame record to this file}"
+    "{codec      |raw    | record codec: raw, lz4 or lz4-delta}"
+    "{truth      |       | write the ground-truth box of every frame to this csv file}"
+    "{preload    |       | render every frame before publishing}"
+};
+
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal(int)
+{
+    quit = 1;
+}
+
+// target state, positions relative to the frame size
+struct keyframe {
+    double t;
+    double cx, cy;
+    double scale;
+    double occlusion;       // part of the box hidden by the occluder, 0 to 1
+};
+
+struct distractor {
+    Point2d pos, vel;       // pixels, pixels per second
+    int radius;
+    Scalar color;
+};
+
+struct scene {
+    Size size;
+    double fps;
+    vector<keyframe> script;    // empty: built-in path
+    Mat background;             // twice the frame size, scrolled
+    vector<distractor> blobs;
+    Mat canvas;
+};
+
+struct truth {
+    Rect box;
+    double occlusion;
+};
+
+static bool load_script(const string& path, vector<keyframe>& script)
+{
+    FILE *f = fopen(path.c_str(), "r");
+    if (f == NULL)
+        return false;
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        keyframe k;
+        if (line[0] == '#')
+            continue;
+        int n = sscanf(line, "%lf %lf %lf %lf %lf", &k.t, &k.cx, &k.cy, &k.scale, &k.occlusion);
+        if (n < 4)
+            continue;
+        if (n == 4)
+            k.occlusion = 0;
+        if (!script.empty() && k.t <= script.back().t) {
+            fprintf(stderr, "%s: keyframe times must increase\n", path.c_str());
+            fclose(f);
+            return false;
+        }
+        script.push_back(k);
+    }
+    fclose(f);
+    return !script.empty();
+}
+
+static Scalar hsv_color(int hue, int sat, int val)
+{
+    Mat hsv(1, 1, CV_8UC3, Scalar(hue, sat, val)), bgr;
+    cvtColor(hsv, bgr, COLOR_HSV2BGR);
+    Vec3b c = bgr.at<Vec3b>(0, 0);
+    return Scalar(c[0], c[1], c[2]);
+}
+
+static void scene_init(scene& s, Size size, double fps, uint64_t seed, int clutter)
+{
+    RNG rng(seed);
+    s.size = size;
+    s.fps = fps;
+    s.canvas.create(size, CV_8UC3);
+
+    // textured, mostly unsaturated background with a few colored patches
+    s.background.create(size.height * 2, size.width * 2, CV_8UC3);
+    rng.fill(s.background, RNG::UNIFORM, Scalar::all(60), Scalar::all(180));
+    GaussianBlur(s.background, s.background, Size(7, 7), 0);
+    for (int i = 0; i < 40; i++) {
+        Point p(rng.uniform(0, s.background.cols), rng.uniform(0, s.background.rows));
+        Size half(rng.uniform(4, size.height / 8), rng.uniform(4, size.height / 8));
+        rectangle(s.background, p - Point(half.width, half.height), p + Point(half.width, half.height),
+                  hsv_color(rng.uniform(20, 160), rng.uniform(20, 120), rng.uniform(80, 220)), FILLED);
+    }
+
+    // distractors keep away from the red hues of the target
+    s.blobs.resize(clutter);
+    for (int i = 0; i < clutter; i++) {
+        distractor& d = s.blobs[i];
+        d.pos = Point2d(rng.uniform(0.0, (double)size.width), rng.uniform(0.0, (double)size.height));
+        double speed = rng.uniform(0.05, 0.3) * size.width;
+        double angle = rng.uniform(0.0, 2 * CV_PI);
+        d.vel = Point2d(speed * cos(angle), speed * sin(angle));
+        d.radius = rng.uniform(size.height / 40 + 2, size.height / 12 + 3);
+        d.color = hsv_color(rng.uniform(25, 155), rng.uniform(150, 256), rng.uniform(120, 256));
+    }
+}
+
+// bounce inside [0, limit)
+static double reflect(double x, double limit)
+{
+    double period = 2 * limit;
+    x = fmod(x, period);
+    if (x < 0)
+        x += period;
+    return x < limit ? x : period - x;
+}
+
+static keyframe target_at(const scene& s, double t)
+{
+    keyframe k;
+    k.t = t;
+    if (s.script.empty()) {
+        k.cx = 0.5 + 0.3 * sin(2 * CV_PI * t / 6);
+        k.cy = 0.5 + 0.2 * sin(2 * CV_PI * t / 4 + 0.5);
+        k.scale = 1 + 0.4 * sin(2 * CV_PI * t / 9);
+        k.occlusion = -1;       // moving occluder bar
+        return k;
+    }
+    const vector<keyframe>& sc = s.script;
+    if (t <= sc.front().t)
+        return sc.front();
+    if (t >= sc.back().t)
+        return sc.back();
+    size_t i = 1;
+    while (sc[i].t < t)
+        i++;
+    const keyframe& a = sc[i - 1];
+    const keyframe& b = sc[i];
+    double w = (t - a.t) / (b.t - a.t);
+    k.cx = a.cx + (b.cx - a.cx) * w;
+    k.cy = a.cy + (b.cy - a.cy) * w;
+    k.scale = a.scale + (b.scale - a.scale) * w;
+    k.occlusion = a.occlusion + (b.occlusion - a.occlusion) * w;
+    return k;
+}
+
+// renders frame index into rgb565 (width * height * 2 bytes)
+static truth scene_render(scene& s, int index, uint8_t *rgb565)
+{
+    double t = index / s.fps;
+    int w = s.size.width, h = s.size.height;
+
+    // slow camera drift over the background
+    Point off((int)reflect(t * w * 0.05, w), (int)reflect(t * h * 0.03, h));
+    s.background(Rect(off, s.size)).copyTo(s.canvas);
+
+    for (size_t i = 0; i < s.blobs.size(); i++) {
+        const distractor& d = s.blobs[i];
+        Point p((int)reflect(d.pos.x + d.vel.x * t, w), (int)reflect(d.pos.y + d.vel.y * t, h));
+        circle(s.canvas, p, d.radius, d.color, FILLED, LINE_AA);
+    }
+
+    keyframe k = target_at(s, t);
+    Size axes(max(2, (int)(h / 8 * k.scale)), max(2, (int)(h / 10 * k.scale)));
+    Point c((int)(k.cx * w), (int)(k.cy * h));
+    ellipse(s.canvas, c, axes, 0, 0, 360, Scalar(40, 40, 220), FILLED, LINE_AA);
+
+    truth tr;
+    tr.box = Rect(c.x - axes.width, c.y - axes.height, axes.width * 2, axes.height * 2);
+    Rect occluder;
+    if (k.occlusion < 0) {
+        // vertical bar sweeping the frame every 10 s
+        int bar = w / 8;
+        occluder = Rect((int)(fmod(t, 10.0) / 10 * (w + bar)) - bar, 0, bar, h);
+    }
+    else {
+        occluder = Rect(tr.box.x, tr.box.y, (int)(tr.box.width * k.occlusion), tr.box.height);
+    }
+    rectangle(s.canvas, occluder, Scalar(128, 128, 128), FILLED);
+
+    Rect frame(0, 0, w, h);
+    Rect visible = tr.box & frame;
+    tr.box = visible;
+    tr.occlusion = visible.area() > 0 ? (double)(visible & occluder).area() / visible.area() : 1;
+
+    Mat out(h, w, CV_8UC2, rgb565);
+    cvtColor(s.canvas, out, COLOR_BGR2BGR565);
+    return tr;
+}
+
+// the display_stage side of the shared memory
+struct shm_publisher {
+    int info_shmid, data_shmid, err_shmid;
+    struct tran_data *info;
+    uint8_t *data;
+    struct area_err *err;
+    int sem_id, sem_id3;
+};
+
+static void* attach(key_t key, size_t size, int& shmid, int *fresh = NULL)
+{
+    int created;
+    void *shm = frame_shm_attach(key, size, &shmid, &created);
+    if (shm == NULL) {
+        fprintf(stderr, "shmget/shmat failed\n");
+        exit(EXIT_FAILURE);
+    }
+    if (fresh)
+        *fresh = created;
+    return shm;
+}
+
+static void publisher_open(shm_publisher& p, int drone)
+{
+    int fresh;
+    p.info = (struct tran_data*)attach(drone_key(SHARE_KEY, drone), sizeof(struct tran_data), p.info_shmid, &fresh);
+    // frame_id goes on from the previous publisher, a running imageProcess keeps tracking
+    pid_t image = frame_shm_claim(p.info, p.info_shmid, fresh, 1);
+    if (image)
+        printf("imageProcess %d is running, reattached to it\n", (int)image);
+    p.data = (uint8_t*)attach(drone_key(DATA_KEY, drone), DATA_SIZE, p.data_shmid);
+    p.err = (struct area_err*)attach(drone_key(ERR_KEY, drone), sizeof(struct area_err), p.err_shmid);
+    p.sem_id = open_semaphore(drone_key(SEM_KEY, drone));
+    p.sem_id3 = open_semaphore(drone_key(SEM_KEY3, drone));
+    if (p.sem_id == -1 || p.sem_id3 == -1) {
+        fprintf(stderr, "Failed to init semaphore\n");
+        exit(EXIT_FAILURE);
+    }
+    // seq is left alone, imageProcess may be waiting on it
+    p.err->x_err = p.err->y_err = p.err->z_err = 0;
+    p.err->stamp_ns = 0;
+}
+
+static void publisher_send(shm_publisher& p, const uint8_t *frame, Size size)
+{
+    frame_shm_beat(p.info, 1);
+    if (!semaphore_P(p.sem_id))
+        exit(EXIT_FAILURE);
+    p.info->width = size.width;
+    p.info->height = size.height;
+    p.info->size = size.area() * 2;
+    p.info->frame_id += 1;
+    p.info->stamp_ns = frame_shm_now_ns();
+    memcpy(p.data, frame, size.area() * 2);
+    if (!semaphore_V(p.sem_id))
+        exit(EXIT_FAILURE);
+}
+
+static void publisher_close(shm_publisher& p)
+{
+    // the last one attached removes the segments, the semaphores stay
+    frame_shm_leave(p.info, 1);
+    frame_shm_release(p.info, p.info_shmid);
+    frame_shm_release(p.data, p.data_shmid);
+    frame_shm_release(p.err, p.err_shmid);
+}
+
+static int parse_codec(const string& name)
+{
+    if (name == "raw")
+        return FRAME_CODEC_RAW;
+    if (name == "lz4")
+        return FRAME_CODEC_LZ4;
+    if (name == "lz4-delta")
+        return FRAME_CODEC_LZ4_DELTA;
+    return -1;
+}
+
+int main(int argc, char** argv)
+{
+    CommandLineParser parser(argc, argv, keys);
+    if (parser.has("help")) {
+        parser.printMessage();
+        return EXIT_SUCCESS;
+    }
+    int width = 0, height = 0;
+    uint16_t check_w = 0, check_h = 0;
+    if (sscanf(parser.get<string>("size").c_str(), "%dx%d", &width, &height) != 2 ||
+        width <= 0 || height <= 0 || width * height * 2 > DATA_SIZE) {
+        fprintf(stderr, "bad size, expected WIDTHxHEIGHT\n");
+        return EXIT_FAILURE;
+    }
+    // imageProcess and the records only know the stream sizes
+    frame_record_picture_size(width * height * 2, 2, &check_w, &check_h);
+    if (check_w != width || check_h != height) {
+        fprintf(stderr, "%dx%d is not a stream size\n", width, height);
+        return EXIT_FAILURE;
+    }
+    double fps = parser.get<double>("fps");
+    int frames = parser.get<int>("frames");
+    int clutter = parser.get<int>("clutter");
+    uint64_t seed = (uint64_t)parser.get<double>("seed");
+    bool use_shm = parser.has("shm");
+    int drone = parser.get<int>("drone");
+    bool preload = parser.has("preload");
+    int codec = parse_codec(parser.get<string>("codec"));
+    if (fps <= 0 || frames < 0 || clutter < 0 || codec < 0 || drone < 0 || drone >= MAX_DRONES) {
+        fprintf(stderr, "bad fps, frames, clutter, codec or drone\n");
+        return EXIT_FAILURE;
+    }
+    if (!use_shm && !parser.has("record")) {
+        fprintf(stderr, "nothing to do, use --shm and/or --record\n");
+        return EXIT_FAILURE;
+    }
+    if (frames == 0 && (parser.has("record") || preload)) {
+        fprintf(stderr, "--record and --preload need a frame count\n");
+        return EXIT_FAILURE;
+    }
+
+    scene s;
+    scene_init(s, Size(width, height), fps, seed, clutter);
+    if (parser.has("script") && !load_script(parser.get<string>("script"), s.script)) {
+        fprintf(stderr, "can not load script %s\n", parser.get<string>("script").c_str());
+        return EXIT_FAILURE;
+    }
+
+    FILE *truth_file = NULL;
+    if (parser.has("truth")) {
+        truth_file = fopen(parser.get<string>("truth").c_str(), "w");
+        if (truth_file == NULL) {
+            fprintf(stderr, "can not write %s\n", parser.get<string>("truth").c_str());
+            return EXIT_FAILURE;
+        }
+        fprintf(truth_file, "frame,time_ms,x,y,w,h,occlusion\n");
+    }
+
+    frame_record_writer_t record;
+    bool recording = parser.has("record");
+    if (recording && frame_record_open(&record, parser.get<string>("record").c_str(), 0, codec) != 0) {
+        fprintf(stderr, "can not write %s\n", parser.get<string>("record").c_str());
+        return EXIT_FAILURE;
+    }
+    shm_publisher pub;
+    if (use_shm)
+        publisher_open(pub, drone);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    size_t frame_size = (size_t)width * height * 2;
+    vector<uint8_t> frame(frame_size);
+    vector<uint8_t> rendered;
+    vector<truth> truths;
+    if (preload) {
+        rendered.resize(frame_size * frames);
+        truths.resize(frames);
+        for (int i = 0; i < frames && !quit; i++)
+            truths[i] = scene_render(s, i, &rendered[frame_size * i]);
+    }
+
+    printf("generating %dx%d at %.1f fps%s%s\n", width, height, fps,
+           use_shm ? ", publishing to shared memory" : "", recording ? ", recording" : "");
+    double start = now_ms();
+    double render_ms = 0;
+    int late = 0;
+    int index = 0;
+    for (; (frames == 0 || index < frames) && !quit; index++) {
+        const uint8_t *pixels;
+        truth tr;
+        if (preload) {
+            pixels = &rendered[frame_size * index];
+            tr = truths[index];
+        }
+        else {
+            double t0 = now_ms();
+            tr = scene_render(s, index, &frame[0]);
+            render_ms += now_ms() - t0;
+            pixels = &frame[0];
+        }
+        double time_ms = index * 1000.0 / fps;
+
+        if (use_shm) {
+            // a frame published a whole period late means the load can not be sustained
+            if (now_ms() > start + time_ms + 1000.0 / fps)
+                late++;
+            sleep_until_ms(start + time_ms);
+            publisher_send(pub, pixels, s.size);
+        }
+        if (recording) {
+            frame_record_frame_header_t hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.frame_id = index;
+            hdr.timestamp = (uint32_t)time_ms;
+            hdr.width = width;
+            hdr.height = height;
+            hdr.pix_fmt = FRAME_PIX_RGB565;
+            hdr.size = frame_size;
+            hdr.capture_us = (uint64_t)(time_ms * 1000);
+            // not a live stream, wait for the writer instead of dropping
+            while (frame_record_write(&record, &hdr, pixels) != 0)
+                usleep(1000);
+        }
+        if (truth_file != NULL)
+            fprintf(truth_file, "%d,%.3f,%d,%d,%d,%d,%.3f\n", index, time_ms,
+                    tr.box.x, tr.box.y, tr.box.width, tr.box.height, tr.occlusion);
+    }
+    double elapsed = now_ms() - start;
+
+    if (recording)
+        frame_record_close(&record);
+    if (use_shm)
+        publisher_close(pub);
+    if (truth_file != NULL)
+        fclose(truth_file);
+
+    printf("frames: %d time: %.1f ms fps: %.1f late: %d", index, elapsed,
+           index * 1000.0 / elapsed, late);
+    if (!preload && index > 0)
+        printf(" render ms: %.3f", render_ms / index);
+    printf("\n");
+    return 0;
+}
@@ -8,6 +8,9 @@
 #include <stdlib.h>  
 #include <stdio.h>  
 #include <string.h>  
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/sem.h>
 
 
@@ -65,4 +68,43 @@ int semaphore_V(int sem_id) {
     }
     return 1;
 }
+
+// 与semaphore_P相同，但最多等待timeout_ms毫秒，超时返回-1，
+// 避免卡在临界区里的对方进程把调用者永远阻塞。C代码中semtimedop需要_GNU_SOURCE。
+int semaphore_P_timed(int sem_id, long timeout_ms) {
+    struct sembuf sem_b;
+    struct timespec timeout;
+    sem_b.sem_num = 0;
+    sem_b.sem_op = -1;
+    sem_b.sem_flg = SEM_UNDO;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+
+    if (semtimedop(sem_id, &sem_b, 1, &timeout) == -1) {
+        if (errno == EAGAIN || errno == EINTR)
+            return -1;
+        fprintf(stderr, "semaphore_P fail\n");
+        return 0;
+    }
+    return 1;
+}
+
+// 打开key对应的信号量。新建的初始化为1；已存在的（另一个进程还在用，或者
+// 上次异常退出留下的）不重新初始化，只在值异常时修复：大于1说明在被持有时
+// 又被初始化过，为0且最后操作它的进程已经退出说明锁无人释放。返回-1表示失败。
+int open_semaphore(key_t key) {
+    int semid = semget(key, 1, 0666 | IPC_CREAT | IPC_EXCL);
+    if (semid != -1)
+        return set_semvalue(semid) ? semid : -1;
+    if (errno != EEXIST || (semid = semget(key, 1, 0666)) == -1)
+        return -1;
+    int value = semctl(semid, 0, GETVAL);
+    int last = semctl(semid, 0, GETPID);
+    if (value > 1 || (value == 0 && last > 0 && kill(last, 0) == -1 && errno == ESRCH)) {
+        fprintf(stderr, "semaphore %d left at %d by process %d, reset\n", (int)key, value, last);
+        if (!set_semvalue(semid))
+            return -1;
+    }
+    return semid;
+}
 #endif
\ No newline at end of file
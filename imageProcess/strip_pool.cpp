@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <vector>
+#include "strip_pool.h"
+
+using namespace std;
+
+// the strips left to a worker, begin in the low half and end in the high
+// half so that the owner and a thief race on a single compare and swap
+struct strip_queue {
+    uint64_t range;
+    char pad[64 - sizeof(uint64_t)];
+};
+
+struct helper_arg {
+    strip_pool *pool;
+    int worker;
+};
+
+struct strip_pool {
+    int threads;
+    vector<pthread_t> tids;
+    vector<helper_arg> args;
+    strip_queue *queues;
+    void (*init)(int worker);
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;    // bumped by every strip_pool_run
+    int running;            // helpers still on the current generation
+    bool quit;
+    strip_fn fn;
+    void *ctx;
+};
+
+static inline uint64_t pack(uint32_t begin, uint32_t end)
+{
+    return (uint64_t)end << 32 | begin;
+}
+
+// front of the own queue
+static int pop_strip(strip_queue *q)
+{
+    uint64_t r = __atomic_load_n(&q->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t begin = (uint32_t)r, end = (uint32_t)(r >> 32);
+        if (begin >= end)
+            return -1;
+        if (__atomic_compare_exchange_n(&q->range, &r, pack(begin + 1, end), false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return (int)begin;
+    }
+}
+
+// back half of a victim queue, the first stolen strip is returned and the
+// rest moved to the own (empty) queue
+static int steal_strips(strip_pool *pool, int worker)
+{
+    for (int k = 1; k < pool->threads; k++) {
+        strip_queue *victim = &pool->queues[(worker + k) % pool->threads];
+        uint64_t r = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+        for (;;) {
+            uint32_t begin = (uint32_t)r, end = (uint32_t)(r >> 32);
+            if (begin >= end)
+                break;
+            uint32_t mid = end - (end - begin + 1) / 2;
+            if (__atomic_compare_exchange_n(&victim->range, &r, pack(begin, mid), false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __atomic_store_n(&pool->queues[worker].range, pack(mid + 1, end), __ATOMIC_RELEASE);
+                return (int)mid;
+            }
+        }
+    }
+    return -1;
+}
+
+static void work(strip_pool *pool, int worker)
+{
+    for (;;) {
+        int strip = pop_strip(&pool->queues[worker]);
+        if (strip < 0)
+            strip = steal_strips(pool, worker);
+        if (strip < 0)
+            return;
+        pool->fn(pool->ctx, strip, worker);
+    }
+}
+
+static void *helper_thread(void *arg)
+{
+    helper_arg *a = (helper_arg*)arg;
+    strip_pool *pool = a->pool;
+    uint64_t seen = 0;
+
+    if (pool->init)
+        pool->init(a->worker);
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->quit && pool->generation == seen)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->quit)
+            break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        work(pool, a->worker);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+strip_pool *strip_pool_create(int threads, void (*init)(int worker))
+{
+    if (threads < 1)
+        threads = 1;
+    if (threads > STRIP_POOL_MAX_THREADS)
+        threads = STRIP_POOL_MAX_THREADS;
+    strip_pool *pool = new strip_pool();
+    pool->threads = threads;
+    pool->init = init;
+    if (posix_memalign((void**)&pool->queues, 64, threads * sizeof(strip_queue)) != 0) {
+        delete pool;
+        return NULL;
+    }
+    for (int i = 0; i < threads; i++)
+        pool->queues[i].range = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->generation = 0;
+    pool->running = 0;
+    pool->quit = false;
+
+    pool->args.resize(threads);
+    pool->tids.resize(threads);
+    for (int i = 1; i < threads; i++) {
+        pool->args[i].pool = pool;
+        pool->args[i].worker = i;
+        if (pthread_create(&pool->tids[i], NULL, helper_thread, &pool->args[i]) != 0) {
+            fprintf(stderr, "strip pool: can not start thread %d\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return pool;
+}
+
+void strip_pool_destroy(strip_pool *pool)
+{
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 1; i < pool->threads; i++)
+        pthread_join(pool->tids[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->queues);
+    delete pool;
+}
+
+int strip_pool_threads(const strip_pool *pool)
+{
+    return pool ? pool->threads : 1;
+}
+
+void strip_pool_run(strip_pool *pool, int strips, strip_fn fn, void *ctx)
+{
+    if (pool == NULL || pool->threads == 1 || strips <= 1) {
+        for (int i = 0; i < strips; i++)
+            fn(ctx, i, 0);
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->ctx = ctx;
+    for (int i = 0; i < pool->threads; i++) {
+        uint32_t begin = (uint32_t)((int64_t)strips * i / pool->threads);
+        uint32_t end = (uint32_t)((int64_t)strips * (i + 1) / pool->threads);
+        pool->queues[i].range = pack(begin, end);
+    }
+    pool->running = pool->threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    work(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,34 @@
+#ifndef STRIP_POOL_H_
+#define STRIP_POOL_H_
+
+/**
+ * Work-stealing pool for the per-pixel loops of the tracker.
+ *
+ * A frame is cut into row strips small enough to stay in L2 while every
+ * per-pixel step runs on them. strip_pool_run hands each worker a
+ * contiguous share of the strips; a worker that runs out steals half of
+ * what is left in the share of another one, so a core slowed down by an
+ * interrupt or a busier strip does not hold the frame back. The calling
+ * thread is worker 0 and returns once every strip is done.
+ */
+
+#define STRIP_POOL_MAX_THREADS (64)
+
+// worker is in [0, strip_pool_threads), for per-worker partial results
+typedef void (*strip_fn)(void *ctx, int strip, int worker);
+
+struct strip_pool;
+
+// threads counts the caller, threads - 1 helpers are started (at most
+// STRIP_POOL_MAX_THREADS). init, if not NULL, runs first in every helper with
+// its worker index.
+strip_pool *strip_pool_create(int threads, void (*init)(int worker));
+void strip_pool_destroy(strip_pool *pool);
+
+// 1 for a NULL pool
+int strip_pool_threads(const strip_pool *pool);
+
+// runs fn on every strip of [0, strips), serially in the caller for a NULL pool
+void strip_pool_run(strip_pool *pool, int strips, strip_fn fn, void *ctx);
+
+#endif // STRIP_POOL_H_
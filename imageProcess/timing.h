@@ -0,0 +1,24 @@
+#ifndef TIMING_H_
+#define TIMING_H_
+
+#include <time.h>
+#include <stdint.h>
+
+static inline double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// sleep until an absolute CLOCK_MONOTONIC time given in ms
+static inline void sleep_until_ms(double t)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)(t / 1000);
+    ts.tv_nsec = (long)((t - ts.tv_sec * 1000.0) * 1000000);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        ;
+}
+
+#endif // TIMING_H_
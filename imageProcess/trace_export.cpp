@@ -0,0 +1,167 @@
+/**
+ * Merges the trace rings of the control process and imageProcess into one
+ * Chrome trace (chrome://tracing, ui.perfetto.dev).
+ *
+ * Both processes must be built with TRACE_ENABLED (cmake -DTRACE=ON, and the
+ * TRACE line of control/Build/Makefile). The segments stay readable after
+ * the processes exit, until the next run clears them, so the tool can be run
+ * during a flight or after it. Each ring holds the last TRACE_RING_SIZE
+ * events of its thread.
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <Video/frame_shm.h>
+#include <Video/trace_ring.h>
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+using namespace std;
+
+const char* keys =
+{
+    "{help h     |           | show help message}"
+    "{output o   |trace.json | Chrome trace file to write}"
+    "{drone      |0          | drone ID, see --drones of imageProcess}"
+};
+
+struct event {
+    int64_t stamp_ns;
+    int pid;
+    int tid;
+    trace_record rec;
+};
+
+static bool by_time(const event& a, const event& b)
+{
+    return a.stamp_ns < b.stamp_ns;
+}
+
+// JSON string, the names are ours but the thread names come from the segment
+static string quoted(const char *s)
+{
+    string out = "\"";
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            out += '\\';
+        if ((unsigned char)*s >= 0x20)
+            out += *s;
+    }
+    return out + "\"";
+}
+
+// Returns the number of threads found, -1 without a segment
+static int read_segment(key_t key, const char *process, vector<event>& events, vector<string>& meta)
+{
+    int shmid = shmget(key, sizeof(trace_segment), 0444);
+    if (shmid == -1)
+        return -1;
+    const trace_segment *seg = (const trace_segment*)shmat(shmid, 0, SHM_RDONLY);
+    if (seg == (void*)-1)
+        return -1;
+    if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != TRACE_MAGIC) {
+        shmdt((const void*)seg);
+        return -1;
+    }
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":%s}}",
+             seg->pid, quoted(process).c_str());
+    meta.push_back(buf);
+
+    int threads = min<int>(__atomic_load_n(&seg->threads, __ATOMIC_ACQUIRE), TRACE_MAX_THREADS);
+    for (int t = 0; t < threads; t++) {
+        const trace_thread_ring& r = seg->rings[t];
+        char name[sizeof(r.name) + 1] = {0};
+        memcpy(name, r.name, sizeof(r.name));
+        snprintf(buf, sizeof(buf), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":%s}}",
+                 seg->pid, r.tid, quoted(name).c_str());
+        meta.push_back(buf);
+
+        uint64_t head = __atomic_load_n(&r.head, __ATOMIC_ACQUIRE);
+        uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        vector<trace_record> copy;
+        for (uint64_t i = first; i < head; i++)
+            copy.push_back(r.records[i & (TRACE_RING_SIZE - 1)]);
+        // records the writer overwrote while we were copying
+        uint64_t after = __atomic_load_n(&r.head, __ATOMIC_ACQUIRE);
+        uint64_t valid = after > TRACE_RING_SIZE ? after - TRACE_RING_SIZE : 0;
+
+        // an end whose begin was overwritten would close nothing
+        vector<int> open(TRACE_EVENT_COUNT, 0);
+        for (uint64_t i = max(first, valid); i < head; i++) {
+            const trace_record& rec = copy[i - first];
+            if (rec.event >= TRACE_EVENT_COUNT)
+                continue;
+            if (rec.phase == TRACE_PHASE_BEGIN)
+                open[rec.event]++;
+            else if (rec.phase == TRACE_PHASE_END) {
+                if (open[rec.event] == 0)
+                    continue;
+                open[rec.event]--;
+            }
+            event e = { rec.stamp_ns, seg->pid, r.tid, rec };
+            events.push_back(e);
+        }
+    }
+    shmdt((const void*)seg);
+    return threads;
+}
+
+int main(int argc, char** argv)
+{
+    CommandLineParser parser(argc, argv, keys);
+    if (parser.has("help")) {
+        parser.printMessage();
+        return EXIT_SUCCESS;
+    }
+    string output = parser.get<string>("output");
+    int drone = parser.get<int>("drone");
+    if (drone < 0 || drone >= MAX_DRONES) {
+        fprintf(stderr, "bad drone ID\n");
+        return EXIT_FAILURE;
+    }
+
+    vector<event> events;
+    vector<string> meta;
+    int control = read_segment(drone_key(TRACE_KEY_CONTROL, drone), "control", events, meta);
+    int image = read_segment(drone_key(TRACE_KEY_IMAGE, drone), "imageProcess", events, meta);
+    if (control < 0 && image < 0) {
+        fprintf(stderr, "no trace segment, build with TRACE_ENABLED and run the processes first\n");
+        return EXIT_FAILURE;
+    }
+    sort(events.begin(), events.end(), by_time);
+
+    FILE *f = fopen(output.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "can not write %s\n", output.c_str());
+        return EXIT_FAILURE;
+    }
+    int64_t origin = events.empty() ? 0 : events[0].stamp_ns;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (size_t i = 0; i < meta.size(); i++, first = false)
+        fprintf(f, "%s%s", first ? "" : ",\n", meta[i].c_str());
+    for (size_t i = 0; i < events.size(); i++, first = false) {
+        const event& e = events[i];
+        fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+                first ? "" : ",\n", trace_event_names[e.rec.event], e.rec.phase,
+                (e.stamp_ns - origin) / 1000.0, e.pid, e.tid);
+        if (e.rec.phase == TRACE_PHASE_INSTANT)
+            fprintf(f, ",\"s\":\"t\"");
+        if (e.rec.phase != TRACE_PHASE_END)
+            fprintf(f, ",\"args\":{\"arg\":%u}", e.rec.arg);
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    printf("%zu events (control: %d threads, imageProcess: %d threads) written to %s\n",
+           events.size(), max(control, 0), max(image, 0), output.c_str());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,995 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "tracker.h"
+
+using namespace cv;
+using namespace std;
+
+// The stream only comes in the sizes of getPicSizeFromBufferSize. The
+// per-pixel kernels are instantiated for each of them with the width, the
+// height and the row steps as constants : the inner loops get a known trip
+// count and the compiler unrolls and vectorizes them for it. W = H = 0 is
+// the runtime sized instance, for any other size.
+static const int stream_sizes[][2] = { {176, 144}, {320, 240}, {640, 360}, {1280, 720} };
+
+static bool fixed_kernels = true;
+
+void tracker_fixed_kernels(bool on)
+{
+    fixed_kernels = on;
+}
+
+// index in stream_sizes, -1 for the runtime sized kernels
+static int stream_size_index(int w, int h)
+{
+    for (int i = 0; fixed_kernels && i < (int)(sizeof(stream_sizes) / sizeof(stream_sizes[0])); i++) {
+        if (stream_sizes[i][0] == w && stream_sizes[i][1] == h)
+            return i;
+    }
+    return -1;
+}
+
+// all the stream widths are multiples of 16, so are the row starts of a
+// 16 byte aligned plane
+static inline bool aligned16(const void *p)
+{
+    return ((uintptr_t)p & 15) == 0;
+}
+
+template <int W, int H>
+static void rgb565_convert(const uchar *src, int w, int h, uchar *dst)
+{
+    const int width = W ? W : w, height = H ? H : h;
+    const size_t srclinesize = UpAlign4(width * 2);
+    const size_t dstlinesize = UpAlign4(width * 3);
+
+    for (int i = 0; i < height; i++) {
+        const unsigned short *psrcdot = (const unsigned short *)(src + i * srclinesize);
+        uchar *pdstdot = dst + i * dstlinesize;
+        for (int j = 0; j < width; j++) {
+            //565 b|g|r -> 888 r|g|b
+            unsigned v = psrcdot[j];
+            pdstdot[3 * j] = (uchar)(v << 3);
+            pdstdot[3 * j + 1] = (uchar)((v >> 5) << 2);
+            pdstdot[3 * j + 2] = (uchar)((v >> 11) << 3);
+        }
+    }
+}
+
+void rgb565_to_rgb888(const void * psrc, int w, int h, void * pdst)
+{
+    if (!psrc || !pdst || w <= 0 || h <= 0) {
+        printf("rgb565_to_rgb888 : parameter error\n");
+        return;
+    }
+
+    const uchar *src = (const uchar *)psrc;
+    uchar *dst = (uchar *)pdst;
+    switch (stream_size_index(w, h)) {
+    case 0: rgb565_convert<176, 144>(src, w, h, dst); break;
+    case 1: rgb565_convert<320, 240>(src, w, h, dst); break;
+    case 2: rgb565_convert<640, 360>(src, w, h, dst); break;
+    case 3: rgb565_convert<1280, 720>(src, w, h, dst); break;
+    default: rgb565_convert<0, 0>(src, w, h, dst); break;
+    }
+}
+
+size_t rgb565_frame_size(int w, int h)
+{
+    return (size_t)UpAlign4(w * 2) * h;
+}
+
+void frame_pool_init(frame_pool& fp, const Size& max_size)
+{
+    size_t pixels = (size_t)max_size.width * max_size.height;
+    fp.max_size = max_size;
+    fp.raw.assign(rgb565_frame_size(max_size.width, max_size.height), 0);
+    fp.bgr_store.assign((size_t)UpAlign4(max_size.width * 3) * max_size.height, 0);
+    fp.hue_store.assign(pixels, 0);
+    fp.mask_store.assign(pixels, 0);
+    fp.backproj_store.assign(pixels, 0);
+    fp.size = Size();
+    fp.bgr.release();
+}
+
+bool frame_pool_bind(frame_pool& fp, tracker& t, const Size& size)
+{
+    if (size.width <= 0 || size.height <= 0 ||
+        size.width > fp.max_size.width || size.height > fp.max_size.height)
+        return false;
+    // the views do not own the memory, create() on the same size keeps them
+    fp.size = size;
+    fp.bgr = Mat(size, CV_8UC3, &fp.bgr_store[0], UpAlign4(size.width * 3));
+    t.hue = Mat(size, CV_8UC1, &fp.hue_store[0]);
+    t.mask = Mat(size, CV_8UC1, &fp.mask_store[0]);
+    t.backproj = Mat(size, CV_8UC1, &fp.backproj_store[0]);
+    return true;
+}
+
+void tracker_init(tracker& t)
+{
+    t.hsize = 16;
+    t.hranges[0] = 0;
+    t.hranges[1] = 180;
+    t.state = 0;
+    t.scale = 1;
+    t.pool = NULL;
+    t.frame_size = Size();
+    t.ref_size = Size();
+    t.target_size = t.model_frame = Size();
+    t.target_score = 0;
+    t.patch.release();
+    t.search_hits = 0;
+}
+
+void tracker_select(tracker& t, const Rect& selection)
+{
+    t.selection = selection;
+    t.state = -1;
+}
+
+void tracker_reset(tracker& t)
+{
+    t.state = 0;
+}
+
+// Model file : a model_header, hsize floats of histogram, then the patch
+// of patch_size x patch_size BGR pixels. Host byte order, the models stay
+// on the ground station that wrote them.
+#define MODEL_MAGIC (0x4C444D54)        // "TMDL"
+#define MODEL_VERSION (1)
+
+struct model_header {
+    uint32_t magic;
+    uint32_t version;
+    int32_t hsize;
+    int32_t vmin, vmax, smin;
+    int32_t frame_width, frame_height;  // model_frame
+    int32_t target_width, target_height;
+    float target_score;
+    int32_t patch_size;                 // TARGET_PATCH, 0 without a patch
+};
+
+// the models written before the binary format
+static bool load_yaml_model(tracker& t, track_params& p, const string& path)
+{
+    FileStorage fs(path, FileStorage::READ);
+    if (!fs.isOpened())
+        return false;
+    fs["hsize"] >> t.hsize;
+    fs["vmin"] >> p.vmin;
+    fs["vmax"] >> p.vmax;
+    fs["smin"] >> p.smin;
+    fs["hist"] >> t.hist;
+    t.target_size = t.model_frame = Size();
+    t.target_score = 0;
+    t.patch.release();
+    return !t.hist.empty();
+}
+
+bool tracker_load_model(tracker& t, track_params& p, const string& path)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == NULL)
+        return false;
+    model_header h;
+    bool binary = fread(&h, sizeof(h), 1, f) == 1 && h.magic == MODEL_MAGIC;
+    bool ok = binary && h.version == MODEL_VERSION && h.hsize > 0 && h.hsize <= 256 &&
+              (h.patch_size == 0 || h.patch_size == TARGET_PATCH);
+    if (ok) {
+        Mat hist(h.hsize, 1, CV_32F), patch;
+        ok = fread(hist.data, sizeof(float), h.hsize, f) == (size_t)h.hsize;
+        if (ok && h.patch_size) {
+            patch.create(TARGET_PATCH, TARGET_PATCH, CV_8UC3);
+            ok = fread(patch.data, 3, TARGET_PATCH * TARGET_PATCH, f) == TARGET_PATCH * TARGET_PATCH;
+        }
+        if (ok) {
+            t.hsize = h.hsize;
+            t.hist = hist;
+            p.vmin = h.vmin;
+            p.vmax = h.vmax;
+            p.smin = h.smin;
+            t.model_frame = Size(h.frame_width, h.frame_height);
+            t.target_size = Size(h.target_width, h.target_height);
+            t.target_score = h.target_score;
+            t.patch = patch;
+        }
+    }
+    fclose(f);
+    if (!binary)
+        ok = load_yaml_model(t, p, path);
+    if (!ok)
+        return false;
+    // searched in the whole frame from the first one on
+    t.state = 2;
+    t.search_hits = 0;
+    return true;
+}
+
+bool tracker_save_model(const tracker& t, const track_params& p, const string& path)
+{
+    if (t.hist.empty() || !t.hist.isContinuous() || (int)t.hist.total() != t.hsize)
+        return false;
+    model_header h;
+    memset(&h, 0, sizeof(h));
+    h.magic = MODEL_MAGIC;
+    h.version = MODEL_VERSION;
+    h.hsize = t.hsize;
+    h.vmin = p.vmin;
+    h.vmax = p.vmax;
+    h.smin = p.smin;
+    h.frame_width = t.model_frame.width;
+    h.frame_height = t.model_frame.height;
+    h.target_width = t.target_size.width;
+    h.target_height = t.target_size.height;
+    h.target_score = t.target_score;
+    bool has_patch = t.patch.rows == TARGET_PATCH && t.patch.cols == TARGET_PATCH &&
+                     t.patch.type() == CV_8UC3 && t.patch.isContinuous();
+    h.patch_size = has_patch ? TARGET_PATCH : 0;
+
+    // written aside and renamed, a crash never leaves half a model
+    string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (f == NULL)
+        return false;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+              fwrite(t.hist.data, sizeof(float), t.hsize, f) == (size_t)t.hsize &&
+              (!has_patch || fwrite(t.patch.data, 3, TARGET_PATCH * TARGET_PATCH, f) == TARGET_PATCH * TARGET_PATCH);
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool tracker_checkpoint(const tracker& t, const track_params& p, track_resume& out)
+{
+    if (t.state != 1 || t.hist.empty() || t.hsize > TRACK_RESUME_BINS || (int)t.hist.total() != t.hsize)
+        return false;
+    memset(&out, 0, sizeof(out));
+    out.hsize = t.hsize;
+    for (int i = 0; i < t.hsize; i++)
+        out.hist[i] = t.hist.at<float>(i);
+    out.vmin = p.vmin;
+    out.vmax = p.vmax;
+    out.smin = p.smin;
+    out.x = t.window.x;
+    out.y = t.window.y;
+    out.width = t.window.width;
+    out.height = t.window.height;
+    out.frame_width = t.frame_size.width;
+    out.frame_height = t.frame_size.height;
+    out.ref_width = t.ref_size.width;
+    out.ref_height = t.ref_size.height;
+    return true;
+}
+
+bool tracker_resume(tracker& t, track_params& p, const track_resume& in)
+{
+    if (in.hsize <= 0 || in.hsize > TRACK_RESUME_BINS || in.width <= 0 || in.height <= 0 ||
+        in.frame_width <= 0 || in.frame_height <= 0)
+        return false;
+    t.hsize = in.hsize;
+    t.hist.create(in.hsize, 1, CV_32F);
+    for (int i = 0; i < in.hsize; i++)
+        t.hist.at<float>(i) = in.hist[i];
+    p.vmin = in.vmin;
+    p.vmax = in.vmax;
+    p.smin = in.smin;
+    // process() rescales the window if the stream size changed meanwhile
+    t.window = Rect(in.x, in.y, in.width, in.height);
+    t.frame_size = Size(in.frame_width, in.frame_height);
+    t.ref_size = Size(in.ref_width, in.ref_height);
+    t.state = 1;
+    return true;
+}
+
+// The per-pixel steps (RGB565 unpacking, RGB to HSV, inRange, hue
+// extraction, back projection and the mask AND) run fused, STRIP_ROWS rows
+// at a time : a strip of a 720p frame and its outputs stay in L2 instead
+// of each step streaming the whole frame from memory.
+static const int STRIP_ROWS = 16;
+
+// windows smaller than this are not worth waking the pool for
+static const int PARALLEL_MOMENTS_AREA = 1 << 15;
+
+// the integer RGB to HSV of cvtColor, the fused pass gives the same hue and mask
+static const int HSV_SHIFT = 12;
+
+struct hsv_tables {
+    int sdiv[256];
+    int hdiv[256];
+    hsv_tables()
+    {
+        sdiv[0] = hdiv[0] = 0;
+        for (int i = 1; i < 256; i++) {
+            sdiv[i] = saturate_cast<int>((255 << HSV_SHIFT) / (1. * i));
+            hdiv[i] = saturate_cast<int>((180 << HSV_SHIFT) / (6. * i));
+        }
+    }
+};
+
+static const hsv_tables hsv_tab;
+
+struct pixel_pass {
+    const uchar *src;
+    size_t src_step;
+    const uchar *u, *v;     // chroma planes of yuv420_pixels
+    size_t uv_step;
+    int width, height;      // of the planes written, the source divided by scale
+    int scale;              // the source is sampled every scale pixels and rows
+    int smin, vlo, vhi;     // inRange bounds, saturated to 8 bits like inRange does
+    uchar lut[256];         // hue to back projection
+    Mat *hue, *mask, *backproj;
+};
+
+// A reader of one row of the source. step() is the row step of a packed
+// format, a constant for a fixed width.
+struct bgr888_pixels {
+    const uchar *row;
+    inline bgr888_pixels(const uchar *src, size_t src_step, const pixel_pass&, int y)
+        : row(src + y * src_step) {}
+    // row step of a continuous Mat
+    static inline size_t step(size_t, int w)
+    {
+        return (size_t)w * 3;
+    }
+    inline void get(int x, int& b, int& g, int& r) const
+    {
+        const uchar *px = row + 3 * x;
+        b = px[0];
+        g = px[1];
+        r = px[2];
+    }
+};
+
+// as rgb565_to_rgb888
+struct rgb565_pixels {
+    const unsigned short *row;
+    inline rgb565_pixels(const uchar *src, size_t src_step, const pixel_pass&, int y)
+        : row((const unsigned short *)(src + y * src_step)) {}
+    static inline size_t step(size_t, int w)
+    {
+        return UpAlign4(w * 2);
+    }
+    inline void get(int x, int& b, int& g, int& r) const
+    {
+        unsigned v = row[x];
+        b = (uchar)(v << 3);
+        g = (uchar)((v >> 5) << 2);
+        r = (uchar)((v >> 11) << 3);
+    }
+};
+
+static inline int clip8(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// The 4:2:0 planes libavcodec decodes the drone stream to, BT.601 video
+// range. Each pixel is converted in registers, no RGB frame is written.
+// The rows come from the decoder, their step stays a run time value.
+struct yuv420_pixels {
+    const uchar *y, *u, *v;
+    inline yuv420_pixels(const uchar *src, size_t src_step, const pixel_pass& ps, int row)
+        : y(src + row * src_step), u(ps.u + (row >> 1) * ps.uv_step), v(ps.v + (row >> 1) * ps.uv_step) {}
+    static inline size_t step(size_t src_step, int)
+    {
+        return src_step;
+    }
+    inline void get(int x, int& b, int& g, int& r) const
+    {
+        int c = 298 * (y[x] - 16) + 128, d = u[x >> 1] - 128, e = v[x >> 1] - 128;
+        r = clip8((c + 409 * e) >> 8);
+        g = clip8((c - 100 * d - 208 * e) >> 8);
+        b = clip8((c + 516 * d) >> 8);
+    }
+};
+
+// row y of a plane, at a constant step and 16 byte aligned for a fixed width
+template <int W>
+static inline uchar *plane_row(const Mat *m, int y)
+{
+    if (!W)
+        return m->data + y * m->step;
+    return (uchar *)__builtin_assume_aligned(m->data + (size_t)y * W, 16);
+}
+
+// Build writes hue and mask for the histogram, otherwise only the back projection
+template <class Pixels, bool Build, int W, int H>
+static void pixel_strip(void *ctx, int strip, int)
+{
+    const pixel_pass& ps = *(const pixel_pass *)ctx;
+    const int width = W ? W : ps.width, height = H ? H : ps.height;
+    const size_t src_step = W ? Pixels::step(ps.src_step, W) : ps.src_step;
+    const int scale = W ? 1 : ps.scale;
+    int y1 = MIN((strip + 1) * STRIP_ROWS, height);
+
+    for (int y = strip * STRIP_ROWS; y < y1; y++) {
+        const Pixels px(ps.src, src_step, ps, y * scale);
+        uchar *hue = Build ? plane_row<W>(ps.hue, y) : NULL;
+        uchar *mask = Build ? plane_row<W>(ps.mask, y) : NULL;
+        uchar *bp = Build ? NULL : plane_row<W>(ps.backproj, y);
+        for (int x = 0; x < width; x++) {
+            int b, g, r;
+            px.get(x * scale, b, g, r);
+            int v = MAX(MAX(b, g), r), diff = v - MIN(MIN(b, g), r);
+            int vr = v == r ? -1 : 0, vg = v == g ? -1 : 0;
+            int s = (diff * hsv_tab.sdiv[v] + (1 << (HSV_SHIFT - 1))) >> HSV_SHIFT;
+            int h = (vr & (g - b)) + (~vr & ((vg & (b - r + 2 * diff)) + ((~vg) & (r - g + 4 * diff))));
+            h = (h * hsv_tab.hdiv[diff] + (1 << (HSV_SHIFT - 1))) >> HSV_SHIFT;
+            h += h < 0 ? 180 : 0;
+            bool in = s >= ps.smin && v >= ps.vlo && v <= ps.vhi;
+            if (Build) {
+                hue[x] = (uchar)h;
+                mask[x] = in ? 255 : 0;
+            }
+            else
+                bp[x] = in ? ps.lut[h] : 0;
+        }
+    }
+}
+
+// a fixed instance assumes the planes it writes packed and aligned, and
+// the source at the step of its pixel format
+static bool fixed_layout(const pixel_pass& ps, size_t src_step, bool build)
+{
+    const Mat *planes[2] = { build ? ps.hue : ps.backproj, build ? ps.mask : ps.backproj };
+    for (int i = 0; i < 2; i++) {
+        if (planes[i]->step != (size_t)ps.width || !aligned16(planes[i]->data))
+            return false;
+    }
+    return ps.src_step == src_step && aligned16(ps.src);
+}
+
+// the strip kernel of the frame in ps, the runtime sized one as fallback
+// and for a reduced scale
+template <class Pixels, bool Build>
+static strip_fn pixel_kernel(const pixel_pass& ps)
+{
+    int fixed = ps.scale == 1 ? stream_size_index(ps.width, ps.height) : -1;
+    if (fixed >= 0 && !fixed_layout(ps, Pixels::step(ps.src_step, ps.width), Build))
+        fixed = -1;
+    switch (fixed) {
+    case 0: return pixel_strip<Pixels, Build, 176, 144>;
+    case 1: return pixel_strip<Pixels, Build, 320, 240>;
+    case 2: return pixel_strip<Pixels, Build, 640, 360>;
+    case 3: return pixel_strip<Pixels, Build, 1280, 720>;
+    default: return pixel_strip<Pixels, Build, 0, 0>;
+    }
+}
+
+// calcBackProject of a uniform 1D histogram, as a table of the 256 hue values
+static void back_project_lut(const tracker& t, uchar lut[256])
+{
+    double a = t.hsize / (double)(t.hranges[1] - t.hranges[0]), b = -a * t.hranges[0];
+    for (int j = 0; j < 256; j++) {
+        int idx = cvFloor(j * a + b);
+        lut[j] = (idx >= 0 && idx < t.hsize) ? saturate_cast<uchar>(t.hist.at<float>(idx)) : 0;
+    }
+}
+
+// the moments camshift needs, relative to the window corner like cv::moments
+struct window_moments {
+    double m00, m10, m01;
+    double mu20, mu11, mu02;
+};
+
+// exact integer sums of one worker, a cache line each
+struct moment_sums {
+    int64_t m00, m10, m01, m20, m11, m02;
+    int64_t pad[2];
+};
+
+struct moment_pass {
+    const Mat *prob;
+    Rect rect;
+    bool central;           // also the second order sums
+    moment_sums *sums;
+};
+
+static void moment_strip(void *ctx, int strip, int worker)
+{
+    const moment_pass& mp = *(const moment_pass *)ctx;
+    moment_sums& acc = mp.sums[worker];
+    int y1 = MIN((strip + 1) * STRIP_ROWS, mp.rect.height);
+
+    for (int y = strip * STRIP_ROWS; y < y1; y++) {
+        const uchar *row = mp.prob->ptr<uchar>(mp.rect.y + y) + mp.rect.x;
+        int64_t s0 = 0, s1 = 0, s2 = 0;
+        if (mp.central) {
+            for (int x = 0; x < mp.rect.width; x++) {
+                int v = row[x];
+                s0 += v;
+                s1 += x * v;
+                s2 += (int64_t)x * x * v;
+            }
+        }
+        else {
+            for (int x = 0; x < mp.rect.width; x++) {
+                int v = row[x];
+                s0 += v;
+                s1 += x * v;
+            }
+        }
+        acc.m00 += s0;
+        acc.m10 += s1;
+        acc.m01 += y * s0;
+        acc.m20 += s2;
+        acc.m11 += y * s1;
+        acc.m02 += (int64_t)y * y * s0;
+    }
+}
+
+// strips of the window run on the pool, the per-worker sums are added at the end
+static void compute_moments(strip_pool *pool, const Mat& prob, const Rect& rect, bool central,
+                            window_moments& m)
+{
+    moment_sums sums[STRIP_POOL_MAX_THREADS];
+    int threads = rect.area() >= PARALLEL_MOMENTS_AREA ? strip_pool_threads(pool) : 1;
+    memset(sums, 0, threads * sizeof(sums[0]));
+
+    moment_pass mp;
+    mp.prob = &prob;
+    mp.rect = rect;
+    mp.central = central;
+    mp.sums = sums;
+    strip_pool_run(threads > 1 ? pool : NULL, (rect.height + STRIP_ROWS - 1) / STRIP_ROWS,
+                   moment_strip, &mp);
+
+    moment_sums total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < threads; i++) {
+        total.m00 += sums[i].m00;
+        total.m10 += sums[i].m10;
+        total.m01 += sums[i].m01;
+        total.m20 += sums[i].m20;
+        total.m11 += sums[i].m11;
+        total.m02 += sums[i].m02;
+    }
+    m.m00 = (double)total.m00;
+    m.m10 = (double)total.m10;
+    m.m01 = (double)total.m01;
+    m.mu20 = m.mu11 = m.mu02 = 0;
+    if (central && total.m00 != 0) {
+        double cx = m.m10 / m.m00, cy = m.m01 / m.m00;
+        m.mu20 = (double)total.m20 - cx * m.m10;
+        m.mu11 = (double)total.m11 - cx * m.m01;
+        m.mu02 = (double)total.m02 - cy * m.m01;
+    }
+}
+
+// cv::meanShift on compute_moments, returns the iterations it ran
+static int mean_shift(strip_pool *pool, const Mat& prob, Rect& window, TermCriteria criteria)
+{
+    Size size = prob.size();
+    Rect cur_rect = window;
+    int niters = (criteria.type & TermCriteria::COUNT) ? MAX(MIN(criteria.maxCount, 100), 1) : 100;
+    double eps = (criteria.type & TermCriteria::EPS) ? MAX(criteria.epsilon, 0.) : 1.;
+    eps = cvRound(eps * eps);
+
+    int i;
+    for (i = 0; i < niters; i++) {
+        cur_rect = cur_rect & Rect(0, 0, size.width, size.height);
+        if (cur_rect == Rect()) {
+            cur_rect.x = size.width / 2;
+            cur_rect.y = size.height / 2;
+        }
+        cur_rect.width = MAX(cur_rect.width, 1);
+        cur_rect.height = MAX(cur_rect.height, 1);
+
+        window_moments m;
+        compute_moments(pool, prob, cur_rect, false, m);
+        if (fabs(m.m00) < DBL_EPSILON)
+            break;
+
+        int dx = cvRound(m.m10 / m.m00 - window.width * 0.5);
+        int dy = cvRound(m.m01 / m.m00 - window.height * 0.5);
+        int nx = MIN(MAX(cur_rect.x + dx, 0), size.width - cur_rect.width);
+        int ny = MIN(MAX(cur_rect.y + dy, 0), size.height - cur_rect.height);
+        dx = nx - cur_rect.x;
+        dy = ny - cur_rect.y;
+        cur_rect.x = nx;
+        cur_rect.y = ny;
+        if (dx * dx + dy * dy < eps)
+            break;
+    }
+    window = cur_rect;
+    return i;
+}
+
+// cv::CamShift, which does not report how many mean shift iterations it ran
+static RotatedRect camshift(strip_pool *pool, const Mat& prob, Rect& window, TermCriteria criteria,
+                            int& iterations)
+{
+    const int TOLERANCE = 10;
+    Size size = prob.size();
+
+    iterations = mean_shift(pool, prob, window, criteria);
+
+    window.x -= TOLERANCE;
+    if( window.x < 0 )
+        window.x = 0;
+    window.y -= TOLERANCE;
+    if( window.y < 0 )
+        window.y = 0;
+    window.width += 2 * TOLERANCE;
+    if( window.x + window.width > size.width )
+        window.width = size.width - window.x;
+    window.height += 2 * TOLERANCE;
+    if( window.y + window.height > size.height )
+        window.height = size.height - window.y;
+
+    window_moments m;
+    compute_moments(pool, prob, window, true, m);
+    if( fabs(m.m00) < DBL_EPSILON )
+        return RotatedRect();
+
+    double inv_m00 = 1. / m.m00;
+    int xc = cvRound( m.m10 * inv_m00 + window.x );
+    int yc = cvRound( m.m01 * inv_m00 + window.y );
+    double a = m.mu20 * inv_m00, b = m.mu11 * inv_m00, c = m.mu02 * inv_m00;
+
+    double square = sqrt( 4 * b * b + (a - c) * (a - c) );
+    double theta = atan2( 2 * b, a - c + square );
+    double cs = cos( theta ), sn = sin( theta );
+    double rotate_a = cs * cs * m.mu20 + 2 * cs * sn * m.mu11 + sn * sn * m.mu02;
+    double rotate_c = sn * sn * m.mu20 - 2 * cs * sn * m.mu11 + cs * cs * m.mu02;
+    // rounding can make them slightly negative
+    rotate_a = MAX( 0.0, rotate_a );
+    rotate_c = MAX( 0.0, rotate_c );
+    double length = sqrt( rotate_a * inv_m00 ) * 4;
+    double width = sqrt( rotate_c * inv_m00 ) * 4;
+    if( length < width )
+    {
+        swap( length, width );
+        swap( cs, sn );
+        theta = CV_PI*0.5 - theta;
+    }
+
+    int t0 = cvRound( fabs( length * cs ));
+    int t1 = cvRound( fabs( width * sn ));
+    t0 = MAX( t0, t1 ) + 2;
+    window.width = MIN( t0, (size.width - xc) * 2 );
+    t0 = cvRound( fabs( length * sn ));
+    t1 = cvRound( fabs( width * cs ));
+    t0 = MAX( t0, t1 ) + 2;
+    window.height = MIN( t0, (size.height - yc) * 2 );
+    window.x = MAX( 0, xc - window.width / 2 );
+    window.y = MAX( 0, yc - window.height / 2 );
+    window.width = MIN( size.width - window.x, window.width );
+    window.height = MIN( size.height - window.y, window.height );
+
+    RotatedRect box;
+    box.size.height = (float)length;
+    box.size.width = (float)width;
+    box.angle = (float)((CV_PI*0.5+theta)*180./CV_PI);
+    while( box.angle < 0 )
+        box.angle += 360;
+    while( box.angle >= 360 )
+        box.angle -= 360;
+    if( box.angle >= 180 )
+        box.angle -= 180;
+    // the centre of the updated window, as cv::CamShift returns it
+    box.center = Point2f( window.x + window.width * 0.5f, window.y + window.height * 0.5f );
+    return box;
+}
+
+// The global search runs on the back projection at this scale, the target
+// only needs a few samples there
+static const int SEARCH_SCALE = 4;
+// a candidate needs this share of the mean back projection of the model
+// (or this mean for a model without one), this correlation with the patch,
+// and to be found in this many frames in a row
+static const float SEARCH_MIN_SCORE = 0.5f;
+static const float SEARCH_MIN_MEAN = 64;
+static const double SEARCH_MIN_NCC = 0.4;
+static const int SEARCH_CONFIRM = 2;
+
+// rect of the source in ps scaled down to a TARGET_PATCH x TARGET_PATCH BGR patch
+template <class Pixels>
+static void sample_patch(const pixel_pass& ps, const Rect& rect, uchar *patch)
+{
+    for (int i = 0; i < TARGET_PATCH; i++) {
+        const Pixels px(ps.src, ps.src_step, ps, rect.y + (2 * i + 1) * rect.height / (2 * TARGET_PATCH));
+        for (int j = 0; j < TARGET_PATCH; j++) {
+            int b, g, r;
+            px.get(rect.x + (2 * j + 1) * rect.width / (2 * TARGET_PATCH), b, g, r);
+            uchar *out = patch + 3 * (i * TARGET_PATCH + j);
+            out[0] = (uchar)b;
+            out[1] = (uchar)g;
+            out[2] = (uchar)r;
+        }
+    }
+}
+
+// normalized cross correlation of two patches, all channels together
+static double patch_ncc(const uchar *a, const uchar *b)
+{
+    const int n = TARGET_PATCH * TARGET_PATCH * 3;
+    int64_t sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+    for (int i = 0; i < n; i++) {
+        sa += a[i];
+        sb += b[i];
+        saa += a[i] * a[i];
+        sbb += b[i] * b[i];
+        sab += a[i] * b[i];
+    }
+    double va = (double)saa - (double)sa * sa / n, vb = (double)sbb - (double)sb * sb / n;
+    if (va <= 0 || vb <= 0)
+        return 0;
+    return ((double)sab - (double)sa * sb / n) / sqrt(va * vb);
+}
+
+// sum of the integral image over [x0, x1) x [y0, y1)
+static inline int box_sum(const Mat& sum, int x0, int y0, int x1, int y1)
+{
+    const int *r0 = sum.ptr<int>(y0), *r1 = sum.ptr<int>(y1);
+    return r1[x1] - r1[x0] - r0[x1] + r0[x0];
+}
+
+// Looks for the target in the whole frame : the back projection at
+// SEARCH_SCALE, then on its integral image the window of the target size
+// (half and twice it too, the distance is unknown) whose mean stands out
+// most from a margin of half its size around it. True once the candidate
+// is confirmed, t.window is set and ps holds the scaled back projection.
+template <class Pixels>
+static bool search(tracker& t, pixel_pass& ps, const track_params& p, int width, int height)
+{
+    int scale = SEARCH_SCALE;
+    while (scale > 1 && (width / scale < 32 || height / scale < 32))
+        scale /= 2;
+    ps.scale = scale;
+    ps.width = width / scale;
+    ps.height = height / scale;
+    back_project_lut(t, ps.lut);
+    strip_pool_run(t.pool, (ps.height + STRIP_ROWS - 1) / STRIP_ROWS, pixel_kernel<Pixels, false>(ps), &ps);
+
+    const int cols = ps.width, rows = ps.height;
+    Mat prob(t.backproj, Rect(0, 0, cols, rows));
+    // create() keeps the buffer while the frame size does not change
+    integral(prob, t.search_sum, CV_32S);
+
+    Size2f target;
+    if (t.target_size.area() > 0 && t.model_frame.area() > 0) {
+        target = Size2f(t.target_size.width * (float)width / t.model_frame.width,
+                        t.target_size.height * (float)height / t.model_frame.height);
+    }
+    else {
+        // a model without a target size : a square of ini_area
+        Size ref = t.ref_size.area() > 0 ? t.ref_size : Size(width, height);
+        float side = sqrt((float)p.ini_area * width * height / ref.area());
+        target = Size2f(side, side);
+    }
+
+    const float factors[] = { 0.5f, 1, 2 };
+    double best = 0, best_mean = 0;
+    Rect best_rect;
+    for (int k = 0; k < 3; k++) {
+        int ww = MIN(MAX(cvRound(target.width * factors[k] / scale), 2), cols);
+        int wh = MIN(MAX(cvRound(target.height * factors[k] / scale), 2), rows);
+        int mx = ww / 2, my = wh / 2;
+        for (int y = 0; y + wh <= rows; y++) {
+            int y0 = MAX(y - my, 0), y1 = MIN(y + wh + my, rows);
+            for (int x = 0; x + ww <= cols; x++) {
+                int x0 = MAX(x - mx, 0), x1 = MIN(x + ww + mx, cols);
+                int inner = box_sum(t.search_sum, x, y, x + ww, y + wh);
+                int ring = box_sum(t.search_sum, x0, y0, x1, y1) - inner;
+                int ring_area = (x1 - x0) * (y1 - y0) - ww * wh;
+                double mean = (double)inner / (ww * wh);
+                double score = mean - (ring_area > 0 ? (double)ring / ring_area : 0);
+                if (score > best) {
+                    best = score;
+                    best_mean = mean;
+                    best_rect = Rect(x, y, ww, wh);
+                }
+            }
+        }
+    }
+
+    Rect found = Rect(best_rect.x * scale, best_rect.y * scale, best_rect.width * scale,
+                      best_rect.height * scale) & Rect(0, 0, width, height);
+    bool hit = best > 0 && found.area() > 0 &&
+               best_mean >= (t.target_score > 0 ? t.target_score * SEARCH_MIN_SCORE : SEARCH_MIN_MEAN);
+    if (hit && !t.patch.empty()) {
+        uchar patch[TARGET_PATCH * TARGET_PATCH * 3];
+        sample_patch<Pixels>(ps, found, patch);
+        hit = patch_ncc(t.patch.data, patch) >= SEARCH_MIN_NCC;
+    }
+    if (!hit) {
+        t.search_hits = 0;
+        return false;
+    }
+    // the same candidate as on the last frame : centres within half its size
+    Point d = (found.tl() + found.br()) - (t.search_last.tl() + t.search_last.br());
+    if (t.search_hits > 0 && abs(d.x) <= found.width && abs(d.y) <= found.height)
+        t.search_hits++;
+    else
+        t.search_hits = 1;
+    t.search_last = found;
+    if (t.search_hits < SEARCH_CONFIRM)
+        return false;
+    t.search_hits = 0;
+    t.window = found;
+    return true;
+}
+
+void tracker_shift(tracker& t, const Point2f& shift, const Size& frame)
+{
+    if (t.state != 1 || t.window.area() <= 0)
+        return;
+    // keep the window size, only clamp it inside the frame
+    int x = cvRound(t.window.x + shift.x), y = cvRound(t.window.y + shift.y);
+    x = MAX(0, MIN(x, frame.width - t.window.width));
+    y = MAX(0, MIN(y, frame.height - t.window.height));
+    t.window.x = x;
+    t.window.y = y;
+}
+
+// src is a BGR, an RGB565 or the Y plane of a YUV 4:2:0 frame of width x
+// height, u and v its chroma planes
+template <class Pixels>
+static bool process(tracker& t, const uchar *src, size_t src_step, int width, int height,
+                    const track_params& p, track_result& r,
+                    const uchar *u = NULL, const uchar *v = NULL, size_t uv_step = 0)
+{
+    const float* phranges = t.hranges;
+
+    r.new_hist = false;
+    r.iterations = 0;
+    r.scale = 1;
+    if (t.state == 0)
+        return false;
+
+    // the stream changed resolution, keep the window on the same part of the scene
+    Size size(width, height);
+    if (t.frame_size != size) {
+        if (t.state == 1 && t.frame_size.area() > 0) {
+            double sx = (double)width / t.frame_size.width, sy = (double)height / t.frame_size.height;
+            t.window = Rect(cvRound(t.window.x * sx), cvRound(t.window.y * sy),
+                            MAX(cvRound(t.window.width * sx), 1), MAX(cvRound(t.window.height * sy), 1)) &
+                       Rect(0, 0, width, height);
+        }
+        t.frame_size = size;
+    }
+    if (t.ref_size.area() <= 0)
+        t.ref_size = size;
+
+    int _vmin = p.vmin, _vmax = p.vmax;
+    pixel_pass ps;
+    ps.src = src;
+    ps.src_step = src_step;
+    ps.u = u;
+    ps.v = v;
+    ps.uv_step = uv_step;
+    ps.width = width;
+    ps.height = height;
+    ps.scale = 1;
+    ps.smin = saturate_cast<uchar>(p.smin);
+    ps.vlo = saturate_cast<uchar>(MIN(_vmin, _vmax));
+    ps.vhi = saturate_cast<uchar>(MAX(_vmin, _vmax));
+    ps.hue = &t.hue;
+    ps.mask = &t.mask;
+    ps.backproj = &t.backproj;
+    int strips = (height + STRIP_ROWS - 1) / STRIP_ROWS;
+    t.backproj.create(height, width, CV_8UC1);
+
+    if( t.state == 2 )
+    {
+        if (!search<Pixels>(t, ps, p, width, height))
+            return false;
+        t.state = 1;
+        r.new_hist = true;
+        r.scale = ps.scale;
+    }
+    else if( t.state < 0 )
+    {
+        t.selection &= Rect(0, 0, width, height);
+        if( t.selection.area() <= 0 )
+        {
+            t.state = 0;
+            return false;
+        }
+        t.hue.create(height, width, CV_8UC1);
+        t.mask.create(height, width, CV_8UC1);
+        strip_pool_run(t.pool, strips, pixel_kernel<Pixels, true>(ps), &ps);
+        Mat roi(t.hue, t.selection), maskroi(t.mask, t.selection);
+        calcHist(&roi, 1, 0, maskroi, t.hist, 1, &t.hsize, &phranges);
+        normalize(t.hist, t.hist, 0, 255, NORM_MINMAX);
+
+        t.window = t.selection;
+        t.state = 1;
+        r.new_hist = true;
+        calcBackProject(&t.hue, 1, 0, t.hist, t.backproj, &phranges);
+        t.backproj &= t.mask;
+
+        // what a later global search looks for
+        t.target_size = t.selection.size();
+        t.model_frame = size;
+        t.target_score = (float)mean(Mat(t.backproj, t.selection))[0];
+        t.patch.create(TARGET_PATCH, TARGET_PATCH, CV_8UC3);
+        sample_patch<Pixels>(ps, t.selection, t.patch.data);
+        t.search_hits = 0;
+    }
+    else
+    {
+        // the histogram is built at full scale, the other frames run at t.scale
+        int scale = t.scale == 2 || t.scale == 4 ? t.scale : 1;
+        if (width / scale < 8 || height / scale < 8)
+            scale = 1;
+        r.scale = ps.scale = scale;
+        ps.width = width / scale;
+        ps.height = height / scale;
+        strips = (ps.height + STRIP_ROWS - 1) / STRIP_ROWS;
+        back_project_lut(t, ps.lut);
+        strip_pool_run(t.pool, strips, pixel_kernel<Pixels, false>(ps), &ps);
+    }
+
+    // the scaled back projection fills the top left corner of t.backproj
+    const int scale = r.scale, cols = ps.width, rows = ps.height;
+    Mat prob(t.backproj, Rect(0, 0, cols, rows));
+    Rect window = t.window;
+    if (scale > 1) {
+        int x1 = (window.x + window.width + scale - 1) / scale, y1 = (window.y + window.height + scale - 1) / scale;
+        window = Rect(window.x / scale, window.y / scale, 0, 0);
+        window.width = MAX(x1 - window.x, 1);
+        window.height = MAX(y1 - window.y, 1);
+        window &= Rect(0, 0, cols, rows);
+    }
+    r.box = camshift(t.pool, prob, window,
+                     TermCriteria( TermCriteria::EPS | TermCriteria::COUNT, 10, 1 ), r.iterations);
+    if (r.box.size.area() <= 0)
+    {
+        // nothing of the target left in the window, search the whole frame again
+        t.state = 2;
+        t.search_hits = 0;
+        return false;
+    }
+    if( window.area() <= 1 )
+    {
+        int rr = (MIN(cols, rows) + 5)/6;
+        window = Rect(window.x - rr, window.y - rr,
+                      window.x + rr, window.y + rr) &
+                 Rect(0, 0, cols, rows);
+    }
+    t.window = window;
+    if (scale > 1) {
+        // back to frame pixels, sample x covers pixels [x * scale, (x + 1) * scale)
+        t.window = Rect(window.x * scale, window.y * scale, window.width * scale, window.height * scale) &
+                   Rect(0, 0, width, height);
+        r.box.center = Point2f(r.box.center.x * scale, r.box.center.y * scale);
+        r.box.size = Size2f(r.box.size.width * scale, r.box.size.height * scale);
+    }
+    Size rect_size = r.box.size;
+    Point2f center = r.box.center;
+    // fractions of the half frame, and of the frame area at the size ini_area is given in
+    r.x_err = (center.x - width * 0.5f) / (width * 0.5f);
+    r.y_err = (center.y - height * 0.5f) / (height * 0.5f);
+    float ref_area = (float)t.ref_size.area();
+    float area = rect_size.width * rect_size.height * ref_area / size.area();
+    int alpha = (p.ini_area > area) ? 1 : -1;
+    r.z_err = sqrt(fabs(p.ini_area - area) / ref_area) * alpha * 0.3;
+    return true;
+}
+
+bool tracker_process(tracker& t, const Mat& image, const track_params& p, track_result& r)
+{
+    CV_Assert(image.type() == CV_8UC3);
+    return process<bgr888_pixels>(t, image.data, image.step, image.cols, image.rows, p, r);
+}
+
+bool tracker_process_rgb565(tracker& t, const void *frame, int width, int height,
+                            const track_params& p, track_result& r)
+{
+    return process<rgb565_pixels>(t, (const uchar *)frame, UpAlign4(width * 2), width, height, p, r);
+}
+
+bool tracker_process_yuv420(tracker& t, const uint8_t *const planes[3], const int steps[3],
+                            int width, int height, const track_params& p, track_result& r)
+{
+    CV_Assert(steps[1] == steps[2]);
+    return process<yuv420_pixels>(t, planes[0], steps[0], width, height, p, r, planes[1], planes[2], steps[1]);
+}
@@ -0,0 +1,127 @@
+#ifndef TRACKER_H_
+#define TRACKER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "strip_pool.h"
+#include <Video/frame_shm.h>
+
+#define RGB565_MASK_RED        0xF800
+#define RGB565_MASK_GREEN                         0x07E0
+#define RGB565_MASK_BLUE                         0x001F
+#define UpAlign4(v)     (((v) + 0x3) & 0xFFFFFFFC)
+
+#define TARGET_PATCH (24)
+
+// camshift tuning, the trackbars of the live window point into it
+struct track_params {
+    int vmin;
+    int vmax;
+    int smin;
+    int ini_area;
+};
+
+struct track_result {
+    cv::RotatedRect box;
+    float x_err;
+    float y_err;
+    float z_err;
+    bool new_hist;      // the histogram was built on this frame
+    int iterations;     // mean shift iterations of this frame
+    int scale;          // processing scale of this frame, 1 on the frame the histogram is built from
+};
+
+// one camshift target, shared by the live and replay front ends (one per
+// recording when replay runs a directory in parallel)
+struct tracker {
+    int hsize;
+    float hranges[2];
+    // 0 idle, -1 build histogram from selection, 2 search the whole frame for
+    // the target (a loaded model, or the target was lost), 1 tracking
+    int state;
+    cv::Rect selection;
+    cv::Rect window;
+    // the frames are tracked on every scale-th pixel and row (1, 2 or 4),
+    // set by the caller (scale_governor.h). window and the results stay in
+    // frame pixels.
+    int scale;
+    // hue and mask are only filled on the frame the histogram is built from,
+    // at a reduced scale only the top left corner of backproj is
+    cv::Mat hue, mask, hist, backproj;
+    // the per-pixel steps and the moments run on it, NULL runs them in the caller
+    strip_pool *pool;
+    // size of the last frame, the window follows a change of resolution
+    cv::Size frame_size;
+    // size ini_area is measured in, the first frame tracked
+    cv::Size ref_size;
+    // What the global search looks for, set with the histogram and saved in
+    // the model : the target size in a model_frame frame, its mean back
+    // projection and a TARGET_PATCH x TARGET_PATCH BGR thumbnail (empty if
+    // the model has none).
+    cv::Size target_size, model_frame;
+    float target_score;
+    cv::Mat patch;
+    // integral image of the search, candidate and frames it was found in a row
+    cv::Mat search_sum;
+    cv::Rect search_last;
+    int search_hits;
+};
+
+// Every per-frame buffer of one tracker (RGB565 copy, BGR, hue, mask, back
+// projection), allocated once for the largest stream size. A change of
+// resolution only rebinds the views, nothing is allocated while frames flow.
+struct frame_pool {
+    cv::Size max_size;
+    std::vector<uint8_t> raw;   // the frame as published, RGB565 rows padded like rgb565_to_rgb888
+    cv::Size size;              // frame the views are bound to
+    cv::Mat bgr;                // view on bgr_store
+    std::vector<uint8_t> bgr_store, hue_store, mask_store, backproj_store;
+};
+
+void rgb565_to_rgb888(const void * psrc, int w, int h, void * pdst);
+
+// The per-pixel kernels have instances specialized for the stream sizes
+// (176x144, 320x240, 640x360, 1280x720), picked at run time. Off runs the
+// runtime sized instances for every size, for bench_imageprocess.
+void tracker_fixed_kernels(bool on);
+
+// bytes of an RGB565 frame of w x h, rows aligned on 4 bytes
+size_t rgb565_frame_size(int w, int h);
+
+void frame_pool_init(frame_pool& fp, const cv::Size& max_size);
+// points bgr and the hue, mask and back projection of t at the stores for a
+// size x frame, false (nothing changed) if it is larger than max_size
+bool frame_pool_bind(frame_pool& fp, tracker& t, const cv::Size& size);
+
+void tracker_init(tracker& t);
+void tracker_select(tracker& t, const cv::Rect& selection);
+void tracker_reset(tracker& t);
+// The target model : histogram, hsize, vmin, vmax, smin, target size and
+// reference patch, in a binary file of a few kB. Loading also reads the
+// YAML models of older versions (histogram and parameters only). A loaded
+// model is searched for in the whole frame until the target shows up.
+bool tracker_load_model(tracker& t, track_params& p, const std::string& path);
+bool tracker_save_model(const tracker& t, const track_params& p, const std::string& path);
+
+// the target as a restarted imageProcess needs it, false while not tracking
+bool tracker_checkpoint(const tracker& t, const track_params& p, track_resume& out);
+// goes on tracking from a checkpoint, false (t unchanged) if it is not usable
+bool tracker_resume(tracker& t, track_params& p, const track_resume& in);
+
+// moves the search window by the apparent motion of the scene caused by the
+// camera itself (ego-motion), in pixels, before the next tracker_process
+void tracker_shift(tracker& t, const cv::Point2f& shift, const cv::Size& frame);
+
+// image is the BGR frame, returns false when there is nothing to track
+bool tracker_process(tracker& t, const cv::Mat& image, const track_params& p, track_result& r);
+// same on the RGB565 frame of the shared memory, without a BGR copy
+bool tracker_process_rgb565(tracker& t, const void *frame, int width, int height,
+                            const track_params& p, track_result& r);
+// same on the planes of a YUV 4:2:0 frame (BT.601 video range, as libavcodec
+// decodes the drone stream), converted pixel by pixel without an RGB copy
+bool tracker_process_yuv420(tracker& t, const uint8_t *const planes[3], const int steps[3],
+                            int width, int height, const track_params& p, track_result& r);
+
+#endif // TRACKER_H_
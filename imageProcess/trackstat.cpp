@@ -0,0 +1,145 @@
+/**
+ * Live view of the tracking pipeline statistics.
+ *
+ * Maps the STATS_KEY page (Video/track_stats.h) read-only and prints, every
+ * --interval ms, the counters of the control process and imageProcess with
+ * their rates, the mean and max time of every stage over the interval, and
+ * the processing scale the governor of imageProcess picked.
+ * The processes never wait for the reader, it can run at any rate and come
+ * and go during a flight.
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <errno.h>
+#include <string>
+#include "timing.h"
+#include <Video/frame_shm.h>
+#include <Video/track_stats.h>
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+using namespace std;
+
+const char* keys =
+{
+    "{help h     |     | show help message}"
+    "{interval   |1000 | refresh period in ms}"
+    "{count      |0    | stop after this many refreshes, 0 runs until ctrl-c}"
+    "{plain      |     | append the reports instead of redrawing the screen}"
+    "{drone      |0    | drone ID, see --drones of imageProcess}"
+};
+
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal(int)
+{
+    quit = 1;
+}
+
+static const char *alive(int32_t pid)
+{
+    if (pid <= 0)
+        return "not started";
+    if (kill(pid, 0) == 0 || errno == EPERM)
+        return "running";
+    return "gone";
+}
+
+static void counter(const char *name, uint64_t cur, uint64_t prev, double dt_s)
+{
+    printf("  %-22s %12llu %10.1f/s\n", name, (unsigned long long)cur, (cur - prev) / dt_s);
+}
+
+static void timer(const char *name, const stat_timer& cur, const stat_timer& prev, double dt_s)
+{
+    uint64_t n = cur.count - prev.count;
+    double mean_us = n ? (cur.total_ns - prev.total_ns) / 1000.0 / n : 0;
+    printf("  %-22s %10.1f/s  mean %9.1f us  max %9.1f us\n",
+           name, n / dt_s, mean_us, cur.max_ns / 1000.0);
+}
+
+int main(int argc, char** argv)
+{
+    CommandLineParser parser(argc, argv, keys);
+    if (parser.has("help")) {
+        parser.printMessage();
+        return EXIT_SUCCESS;
+    }
+    double interval = parser.get<double>("interval");
+    int count = parser.get<int>("count");
+    bool plain = parser.has("plain");
+    int drone = parser.get<int>("drone");
+    if (interval <= 0 || count < 0 || drone < 0 || drone >= MAX_DRONES) {
+        fprintf(stderr, "bad interval, count or drone\n");
+        return EXIT_FAILURE;
+    }
+
+    const track_stats *page = track_stats_attach(drone_key(STATS_KEY, drone), 1);
+    if (NULL == page) {
+        fprintf(stderr, "no statistics page, start the control binary or imageProcess first\n");
+        return EXIT_FAILURE;
+    }
+    if (page->version != TRACK_STATS_VERSION) {
+        fprintf(stderr, "statistics page version %u, expected %d\n", page->version, TRACK_STATS_VERSION);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    track_stats prev = *page;
+    double prev_t = now_ms(), next = prev_t + interval;
+    for (int n = 0; !quit && (count == 0 || n < count); n++) {
+        sleep_until_ms(next);
+        next += interval;
+        track_stats cur = *page;
+        double t = now_ms(), dt_s = (t - prev_t) / 1000;
+        const control_stats &c = cur.control, &pc = prev.control;
+        const image_stats &i = cur.image, &pi = prev.image;
+
+        // a restarted process clears its section, start again from there
+        if (c.pid != pc.pid)
+            prev.control = c;
+        if (i.pid != pi.pid)
+            prev.image = i;
+
+        if (!plain)
+            printf("\033[H\033[2J");
+        printf("control (pid %d, %s)\n", c.pid, alive(c.pid));
+        counter("frames received", c.frames_received, pc.frames_received, dt_s);
+        counter("frames published", c.frames_published, pc.frames_published, dt_s);
+        counter("commands sent", c.commands_sent, pc.commands_sent, dt_s);
+        counter("stale results", c.results_stale, pc.results_stale, dt_s);
+        timer("publish wait", c.publish_wait, pc.publish_wait, dt_s);
+        timer("publish", c.publish, pc.publish, dt_s);
+        timer("result wait", c.result_wait, pc.result_wait, dt_s);
+        timer("control step", c.control_step, pc.control_step, dt_s);
+
+        printf("imageProcess (pid %d, %s)\n", i.pid, alive(i.pid));
+        counter("frames copied", i.frames_copied, pi.frames_copied, dt_s);
+        counter("frames processed", i.frames_processed, pi.frames_processed, dt_s);
+        counter("frames dropped", i.frames_dropped, pi.frames_dropped, dt_s);
+        counter("results", i.results, pi.results, dt_s);
+        uint64_t frames = i.frames_processed - pi.frames_processed;
+        printf("  %-22s %12.2f per frame\n", "camshift iterations",
+               frames ? (double)(i.camshift_iterations - pi.camshift_iterations) / frames : 0.0);
+        timer("copy wait", i.copy_wait, pi.copy_wait, dt_s);
+        timer("copy", i.copy, pi.copy, dt_s);
+        timer("convert", i.convert, pi.convert, dt_s);
+        timer("track", i.track, pi.track, dt_s);
+        timer("result wait", i.result_wait, pi.result_wait, dt_s);
+        counter("scale switches", i.scale_switches, pi.scale_switches, dt_s);
+        printf("  %-22s %12s  budget %9.1f us\n", "processing scale",
+               i.scale > 1 ? format("1/%u", i.scale).c_str() : "1", (double)i.budget_us);
+        if (plain)
+            printf("\n");
+        fflush(stdout);
+
+        prev = cur;
+        prev_t = t;
+    }
+    shmdt((const void*)page);
+    return EXIT_SUCCESS;
+}